@@ -2,11 +2,21 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include <archive.h>
 #include <archive_entry.h>
+#include <zlib.h>
 
 #include "log.h"
+#include "uring.h"
+#include "workers.h"
 #include "archive.h"
 
 #define EXTRACTION_OPTIONS (ARCHIVE_EXTRACT_OWNER | \
@@ -17,58 +27,1264 @@
                             ARCHIVE_EXTRACT_FFLAGS | \
                             ARCHIVE_EXTRACT_XATTR)
 
-static result_t _extract_file(struct archive *input, struct archive *output) {
+/* archive_write_disk_new() reads the umask by changing it temporarily, so
+ * archives extracted in parallel must not allocate their output at the same
+ * time */
+static pthread_mutex_t g_umask_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the size of the buffer used to compare extracted files with installed
+ * files */
+#define COMPARISON_BUFFER_SIZE (64 * 1024)
+
+/* the steps of writing a file through io_uring, encoded in the user data of
+ * each completion along with the file index */
+#define STEP_OPEN (0)
+#define STEP_WRITE (1)
+#define STEP_CLOSE (2)
+#define STEP_BITS (2)
+
+/* holes in sparse files read as zeros */
+static const unsigned char g_zeros[BUFSIZ] = {0};
+
+static void _digest(archive_file_state_t *state,
+                    off_t *digested,
+                    const void *block,
+                    const size_t size,
+                    const off_t offset) {
+	/* the size of a hole */
+	off_t hole = 0;
+
+	assert(NULL != state);
+	assert(NULL != digested);
+
+	for ( ; offset > *digested; *digested += hole) {
+		hole = offset - *digested;
+		if ((off_t) sizeof(g_zeros) < hole) {
+			hole = (off_t) sizeof(g_zeros);
+		}
+		state->digest = (uint32_t) crc32((uLong) state->digest,
+		                                 (const Bytef *) &g_zeros,
+		                                 (uInt) hole);
+	}
+
+	if (0 < size) {
+		state->digest = (uint32_t) crc32((uLong) state->digest,
+		                                 (const Bytef *) block,
+		                                 (uInt) size);
+		*digested += (off_t) size;
+	}
+}
+
+static result_t _extract_file(const archive_block_callback_t read,
+                              void *source,
+                              struct archive *output,
+                              archive_file_state_t *state,
+                              off_t digested) {
 	/* the data block offset */
-	__LA_INT64_T offset = 0LL;
+	int64_t offset = 0LL;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	/* the data block size */
+	size_t size = 0;
+
+	/* a data block */
+	const void *block = NULL;
+
+	assert(NULL != read);
+	assert(NULL != source);
+	assert(NULL != output);
+
+	do {
+		/* read a data block */
+		switch (read(source, &block, &size, &offset)) {
+			case ARCHIVE_OK:
+				break;
+
+			case ARCHIVE_EOF:
+				/* account for a hole at the end of the file */
+				if (NULL != state) {
+					_digest(state, &digested, NULL, 0, state->size);
+				}
+				goto end;
+
+			default:
+				result = RESULT_IO_ERROR;
+				goto end;
+		}
+
+		if (NULL != state) {
+			_digest(state, &digested, block, size, (off_t) offset);
+		}
+
+		/* extract the data block */
+		if (ARCHIVE_OK != archive_write_data_block(output,
+		                                           block,
+		                                           size,
+		                                           offset)) {
+			result = RESULT_IO_ERROR;
+			goto end;
+		}
+	} while (1);
+
+end:
+	return result;
+}
+
+static int _open_installed(struct archive_entry *entry,
+                           const char *path,
+                           const archive_file_state_t *previous) {
+	/* the installed file attributes */
+	struct stat attributes = {0};
+
+	/* the file descriptor */
+	int fd = (-1);
+
+	assert(NULL != entry);
+	assert(NULL != path);
+
+	/* only regular files whose recorded size and mode match the archive entry
+	 * may be identical */
+	if ((NULL == previous) ||
+	    (AE_IFREG != archive_entry_filetype(entry)) ||
+	    (NULL != archive_entry_hardlink(entry)) ||
+	    (previous->size != (off_t) archive_entry_size(entry)) ||
+	    (previous->mode != archive_entry_mode(entry))) {
+		goto end;
+	}
+
+	/* make sure the installed file still matches its recorded state */
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (-1 == fd) {
+		goto end;
+	}
+	if (-1 == fstat(fd, &attributes)) {
+		goto close_file;
+	}
+	if ((previous->size != attributes.st_size) ||
+	    (previous->mode != attributes.st_mode)) {
+		goto close_file;
+	}
+
+	/* the owner is restored only when running as root */
+	if (0 == geteuid()) {
+		if ((archive_entry_uid(entry) != (__LA_INT64_T) attributes.st_uid) ||
+		    (archive_entry_gid(entry) != (__LA_INT64_T) attributes.st_gid)) {
+			goto close_file;
+		}
+	}
+
+	goto end;
+
+close_file:
+	/* close the file */
+	(void) close(fd);
+	fd = (-1);
+
+end:
+	return fd;
+}
+
+static bool _is_identical(const int fd,
+                          const unsigned char *block,
+                          size_t size,
+                          off_t offset,
+                          unsigned char *buffer) {
+	/* the size of a chunk read from the installed file */
+	ssize_t chunk = 0;
+
+	assert(NULL != buffer);
+
+	for ( ; 0 < size; size -= (size_t) chunk, offset += (off_t) chunk) {
+		chunk = pread(fd,
+		              buffer,
+		              (COMPARISON_BUFFER_SIZE < size) ?
+		              COMPARISON_BUFFER_SIZE :
+		              size,
+		              offset);
+		if (0 >= chunk) {
+			return false;
+		}
+		if (0 != memcmp(block, buffer, (size_t) chunk)) {
+			return false;
+		}
+		block += chunk;
+	}
+
+	return true;
+}
+
+static result_t _extract_changed(const archive_block_callback_t read,
+                                 void *source,
+                                 struct archive *output,
+                                 struct archive_entry *entry,
+                                 archive_staged_file_t *file,
+                                 const int fd) {
+	/* a chunk of the installed file */
+	unsigned char buffer[COMPARISON_BUFFER_SIZE];
+
+	/* the installed file attributes */
+	struct stat attributes = {0};
+
+	/* the data block offset */
+	int64_t offset = 0LL;
+
+	/* the number of identical bytes */
+	off_t identical = 0;
+
+	/* the number of bytes copied from the installed file */
+	off_t copied = 0;
+
+	/* the data block size */
+	size_t size = 0;
+
+	/* the size of a chunk copied from the installed file */
+	ssize_t chunk = 0;
+
+	/* a data block */
+	const void *block = NULL;
 
 	/* the return value */
 	result_t result = RESULT_OK;
 
+	assert(NULL != read);
+	assert(NULL != source);
+	assert(NULL != output);
+	assert(NULL != entry);
+	assert(NULL != file);
+	assert(-1 != fd);
+
+	/* compare the file with the installed file, until they differ */
+	do {
+		switch (read(source, &block, &size, &offset)) {
+			case ARCHIVE_OK:
+				break;
+
+			case ARCHIVE_EOF:
+				/* if the files are identical, leave the installed file in
+				 * place */
+				if (file->state.size == identical) {
+					log_write(LOG_DEBUG, "%s is unchanged\n", file->path);
+					file->staged = false;
+					file->unchanged = true;
+					if (0 == fstat(fd, &attributes)) {
+						file->state.mtime = attributes.st_mtime;
+					}
+					goto end;
+				}
+				block = NULL;
+				size = 0;
+				goto extract;
+
+			default:
+				result = RESULT_IO_ERROR;
+				goto end;
+		}
+
+		if (((off_t) offset != identical) ||
+		    (false == _is_identical(fd,
+		                            (const unsigned char *) block,
+		                            size,
+		                            (off_t) offset,
+		                            (unsigned char *) &buffer))) {
+			break;
+		}
+		_digest(&file->state, &identical, block, size, (off_t) offset);
+	} while (1);
+
+extract:
+	/* extract the file, starting with the identical part, which is copied from
+	 * the installed file */
+	if (ARCHIVE_OK != archive_write_header(output, entry)) {
+		log_write(LOG_ERROR,
+		          "Failed to extract %s\n",
+		          archive_entry_pathname(entry));
+		result = RESULT_IO_ERROR;
+		goto end;
+	}
+	for ( ; identical > copied; copied += (off_t) chunk) {
+		chunk = pread(fd,
+		              &buffer,
+		              ((off_t) sizeof(buffer) < (identical - copied)) ?
+		              sizeof(buffer) :
+		              (size_t) (identical - copied),
+		              copied);
+		if (0 >= chunk) {
+			result = RESULT_IO_ERROR;
+			goto end;
+		}
+		if (ARCHIVE_OK != archive_write_data_block(output,
+		                                           &buffer,
+		                                           (size_t) chunk,
+		                                           (int64_t) copied)) {
+			result = RESULT_IO_ERROR;
+			goto end;
+		}
+	}
+
+	/* extract the rest of the file */
+	if (NULL == block) {
+		_digest(&file->state, &identical, NULL, 0, file->state.size);
+		goto end;
+	}
+	_digest(&file->state, &identical, block, size, (off_t) offset);
+	if (ARCHIVE_OK != archive_write_data_block(output, block, size, offset)) {
+		result = RESULT_IO_ERROR;
+		goto end;
+	}
+	result = _extract_file(read, source, output, &file->state, identical);
+
+end:
+	return result;
+}
+
+static const archive_staged_file_t *_find(const archive_staging_t *staging,
+                                          const char *path) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != staging);
+	assert(NULL != path);
+
+	for (i = staging->count; 0 < i; --i) {
+		if (0 == strcmp(path, staging->files[i - 1].path)) {
+			return &staging->files[i - 1];
+		}
+	}
+
+	return NULL;
+}
+
+static bool _get_staged_path(char *staged_path,
+                             const size_t size,
+                             const archive_staging_t *staging,
+                             const char *path) {
+	assert(NULL != staged_path);
+	assert(NULL != staging);
+	assert(NULL != staging->owner);
+	assert(NULL != path);
+
+	return (size > (size_t) snprintf(staged_path,
+	                                 size,
+	                                 "%s"STAGING_SUFFIX".%s",
+	                                 path,
+	                                 staging->owner)) ? true : false;
+}
+
+static result_t _stage(struct archive_entry *entry,
+                       const char *path,
+                       const archive_lookup_callback_t lookup,
+                       void *lookup_arg,
+                       archive_staging_t *staging,
+                       int *installed) {
+	/* the temporary path */
+	char staged_path[PATH_MAX] = {'\0'};
+
+	/* the enlarged list of files */
+	archive_staged_file_t *files = NULL;
+
+	/* the staged file */
+	archive_staged_file_t *file = NULL;
+
+	/* the hard link target */
+	const char *target = NULL;
+
+	/* the hard link target, if it was extracted earlier */
+	const archive_staged_file_t *target_file = NULL;
+
+	assert(NULL != entry);
+	assert(NULL != path);
+	assert(NULL != staging);
+	assert(NULL != installed);
+
+	*installed = (-1);
+
+	/* enlarge the list of files */
+	files = realloc(staging->files,
+	                sizeof(archive_staged_file_t) * (1 + staging->count));
+	if (NULL == files) {
+		return RESULT_MEM_ERROR;
+	}
+	staging->files = files;
+	file = &files[staging->count];
+
+	/* save the file path, since the entry path is about to change */
+	file->path = strdup(path);
+	if (NULL == file->path) {
+		return RESULT_MEM_ERROR;
+	}
+	file->staged = false;
+	file->created = false;
+	file->unchanged = false;
+	file->state.size = 0;
+	if (AE_IFREG == archive_entry_filetype(entry)) {
+		file->state.size = (off_t) archive_entry_size(entry);
+	}
+	file->state.mode = archive_entry_mode(entry);
+	file->state.digest = (uint32_t) crc32(0L, Z_NULL, 0);
+	file->state.mtime = 0;
+	if (0 != archive_entry_mtime_is_set(entry)) {
+		file->state.mtime = archive_entry_mtime(entry);
+	}
+	++(staging->count);
+
+	/* directories are created in place; remember whether they were created
+	 * here, to delete them if the extraction is rolled back. Packages are
+	 * extracted simultaneously, so only the package whose mkdir() succeeds
+	 * owns the directory; if its parent is missing, the directory is created
+	 * during extraction, with the parent */
+	if (AE_IFDIR == archive_entry_filetype(entry)) {
+		if (0 == mkdir(file->path, S_IRWXU)) {
+			file->created = true;
+		} else {
+			switch (errno) {
+				case EEXIST:
+					break;
+
+				case ENOENT:
+					file->created = true;
+					break;
+
+				default:
+					return RESULT_IO_ERROR;
+			}
+		}
+		return RESULT_OK;
+	}
+
+	/* extract all other files to a temporary path */
+	if (false == _get_staged_path((char *) &staged_path,
+	                              sizeof(staged_path),
+	                              staging,
+	                              file->path)) {
+		return RESULT_CORRUPT_DATA;
+	}
+	archive_entry_copy_pathname(entry, (const char *) &staged_path);
+	file->staged = true;
+
+	/* if the installed file may be identical, open it for comparison */
+	if (NULL != lookup) {
+		*installed = _open_installed(entry, file->path, lookup(file->path,
+		                                                      lookup_arg));
+	}
+
+	/* hard links point to files extracted earlier, which have temporary paths
+	 * too, unless they were left in place; a hard link shares the state of
+	 * its target */
+	target = archive_entry_hardlink(entry);
+	if (NULL == target) {
+		return RESULT_OK;
+	}
+	target_file = _find(staging, target);
+	if (NULL == target_file) {
+		return RESULT_OK;
+	}
+	file->state = target_file->state;
+	if (true == target_file->staged) {
+		if (false == _get_staged_path((char *) &staged_path,
+		                              sizeof(staged_path),
+		                              staging,
+		                              target)) {
+			return RESULT_CORRUPT_DATA;
+		}
+		archive_entry_copy_hardlink(entry, (const char *) &staged_path);
+	}
+
+	return RESULT_OK;
+}
+
+static struct archive *_open_output(void) {
+	/* extraction data */
+	struct archive *output = NULL;
+
+	/* allocate memory for extracting the archive */
+	(void) pthread_mutex_lock(&g_umask_lock);
+	output = archive_write_disk_new();
+	(void) pthread_mutex_unlock(&g_umask_lock);
+	if (NULL == output) {
+		return NULL;
+	}
+
+	/* set the extraction options */
+	archive_write_disk_set_options(output, EXTRACTION_OPTIONS);
+	archive_write_disk_set_standard_lookup(output);
+
+	return output;
+}
+
+static void _close_output(struct archive *output) {
+	assert(NULL != output);
+
+	/* free all memory used for output */
+	(void) archive_write_close(output);
+	archive_write_free(output);
+}
+
+static int _read_job(archive_job_t *job,
+                     const void **block,
+                     size_t *size,
+                     int64_t *offset) {
+	assert(NULL != job);
+	assert(NULL != block);
+	assert(NULL != size);
+	assert(NULL != offset);
+
+	/* the whole file is a single data block */
+	if ((true == job->read) || (0 == job->size)) {
+		return ARCHIVE_EOF;
+	}
+	job->read = true;
+
+	*block = job->contents;
+	*size = job->size;
+	*offset = 0LL;
+	return ARCHIVE_OK;
+}
+
+static result_t _write_job(archive_job_t *job, struct archive *output) {
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != job);
+	assert(NULL != output);
+
+	/* if the file may be identical to the installed file, extract it only if
+	 * they differ */
+	if (-1 != job->installed) {
+		result = _extract_changed((archive_block_callback_t) _read_job,
+		                          job,
+		                          output,
+		                          job->entry,
+		                          &job->file,
+		                          job->installed);
+	} else {
+		if (ARCHIVE_OK != archive_write_header(output, job->entry)) {
+			log_write(LOG_ERROR,
+			          "Failed to extract %s\n",
+			          archive_entry_pathname(job->entry));
+			return RESULT_IO_ERROR;
+		}
+		result = _extract_file((archive_block_callback_t) _read_job,
+		                       job,
+		                       output,
+		                       &job->file.state,
+		                       0);
+	}
+	if (RESULT_OK != result) {
+		return result;
+	}
+
+	/* restore the file metadata right away, since hard links to the file may
+	 * be extracted by another thread */
+	if ((true == job->file.staged) &&
+	    (ARCHIVE_OK != archive_write_finish_entry(output))) {
+		return RESULT_IO_ERROR;
+	}
+
+	return RESULT_OK;
+}
+
+static void _release_job(archive_job_t *job) {
+	assert(NULL != job);
+
+	if (-1 != job->installed) {
+		(void) close(job->installed);
+	}
+	archive_entry_free(job->entry);
+	free(job->contents);
+}
+
+static mode_t _get_umask(void) {
+	/* the umask */
+	mode_t mask = 0;
+
+	(void) pthread_mutex_lock(&g_umask_lock);
+	mask = umask(0);
+	(void) umask(mask);
+	(void) pthread_mutex_unlock(&g_umask_lock);
+
+	return mask;
+}
+
+static bool _can_batch(const archive_job_t *job) {
+	/* the file flags to set */
+	unsigned long set = 0;
+
+	/* the file flags to clear */
+	unsigned long clear = 0;
+
+	assert(NULL != job);
+
+	/* files which may be identical to the installed file, files with special
+	 * permission bits and files with extended metadata are written by
+	 * libarchive */
+	if ((-1 != job->installed) ||
+	    (0 != (archive_entry_mode(job->entry) & (S_ISUID |
+	                                             S_ISGID |
+	                                             S_ISVTX))) ||
+	    (0 != archive_entry_xattr_count(job->entry)) ||
+	    (0 != archive_entry_acl_types(job->entry))) {
+		return false;
+	}
+	archive_entry_fflags(job->entry, &set, &clear);
+
+	return ((0 == set) && (0 == clear));
+}
+
+static int _open_parent(archive_job_t *job,
+                        int *parents,
+                        const char **paths,
+                        size_t *lengths,
+                        unsigned int *count) {
+	/* the file path */
+	const char *path = NULL;
+
+	/* the parent directory path */
+	char *parent_path = NULL;
+
+	/* the length of the parent directory path */
+	size_t length = 0;
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != job);
+	assert(NULL != parents);
+	assert(NULL != paths);
+	assert(NULL != lengths);
+	assert(NULL != count);
+
+	/* all paths begin with "./" */
+	path = archive_entry_pathname(job->entry);
+	job->name = strrchr(path, '/') + 1;
+	length = (size_t) (job->name - path);
+
+	/* files in the same batch are often in the same directory */
+	for (i = *count; 0 < i; --i) {
+		if ((lengths[i - 1] == length) &&
+		    (0 == strncmp(paths[i - 1], path, length))) {
+			return parents[i - 1];
+		}
+	}
+
+	parent_path = strndup(path, length);
+	if (NULL == parent_path) {
+		return (-1);
+	}
+	parents[*count] = open(parent_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(parent_path);
+	if (-1 == parents[*count]) {
+		return (-1);
+	}
+	paths[*count] = path;
+	lengths[*count] = length;
+	++(*count);
+
+	return parents[*count - 1];
+}
+
+static bool _queue_chain(uring_t *ring,
+                         const archive_job_t *job,
+                         const unsigned int i) {
+	/* a submission queue entry */
+	struct io_uring_sqe *sqe = NULL;
+
+	assert(NULL != ring);
+	assert(NULL != job);
+	assert(-1 != job->parent);
+
+	/* create the file in direct file descriptor slot i, write its contents
+	 * and close it; a failure cancels the rest of the chain */
+	sqe = uring_get_sqe(ring);
+	if (NULL == sqe) {
+		return false;
+	}
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->fd = job->parent;
+	sqe->addr = (uint64_t) (uintptr_t) job->name;
+	sqe->len = (uint32_t) (archive_entry_mode(job->entry) & 0777);
+	/* direct file descriptors are never inherited, and O_CLOEXEC is rejected
+	 * with them */
+	sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW;
+	sqe->file_index = 1 + i;
+	sqe->user_data = ((uint64_t) i << STEP_BITS) | STEP_OPEN;
+
+	if (0 < job->size) {
+		sqe = uring_get_sqe(ring);
+		if (NULL == sqe) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+		sqe->fd = (int) i;
+		sqe->addr = (uint64_t) (uintptr_t) job->contents;
+		sqe->len = (uint32_t) job->size;
+		sqe->off = 0;
+		sqe->user_data = ((uint64_t) i << STEP_BITS) | STEP_WRITE;
+	}
+
+	sqe = uring_get_sqe(ring);
+	if (NULL == sqe) {
+		return false;
+	}
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = 1 + i;
+	sqe->user_data = ((uint64_t) i << STEP_BITS) | STEP_CLOSE;
+
+	return true;
+}
+
+static bool _restore_metadata(const archive_job_t *job,
+                              struct archive *output,
+                              const mode_t mask) {
+	/* the access and modification times */
+	struct timespec times[2];
+
+	/* the file permissions */
+	mode_t permissions = 0;
+
+	/* the file owner */
+	uid_t uid = 0;
+
+	/* the file group */
+	gid_t gid = 0;
+
+	assert(NULL != job);
+	assert(NULL != output);
+
+	/* the owner is restored only when running as root */
+	if (0 == geteuid()) {
+		uid = (uid_t) archive_write_disk_uid(output,
+		                                     archive_entry_uname(job->entry),
+		                                     archive_entry_uid(job->entry));
+		gid = (gid_t) archive_write_disk_gid(output,
+		                                     archive_entry_gname(job->entry),
+		                                     archive_entry_gid(job->entry));
+		if (((uid != geteuid()) || (gid != getegid())) &&
+		    (-1 == fchownat(job->parent,
+		                    job->name,
+		                    uid,
+		                    gid,
+		                    AT_SYMLINK_NOFOLLOW))) {
+			return false;
+		}
+	}
+
+	/* the file was created with the umask applied */
+	permissions = archive_entry_mode(job->entry) & 0777;
+	if ((0 != (permissions & mask)) &&
+	    (-1 == fchmodat(job->parent, job->name, permissions, 0))) {
+		return false;
+	}
+
+	if ((0 == archive_entry_atime_is_set(job->entry)) &&
+	    (0 == archive_entry_mtime_is_set(job->entry))) {
+		return true;
+	}
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_NOW;
+	if (0 != archive_entry_atime_is_set(job->entry)) {
+		times[0].tv_sec = archive_entry_atime(job->entry);
+		times[0].tv_nsec = archive_entry_atime_nsec(job->entry);
+	}
+	times[1].tv_sec = 0;
+	times[1].tv_nsec = UTIME_NOW;
+	if (0 != archive_entry_mtime_is_set(job->entry)) {
+		times[1].tv_sec = archive_entry_mtime(job->entry);
+		times[1].tv_nsec = archive_entry_mtime_nsec(job->entry);
+	}
+	if (-1 == utimensat(job->parent,
+	                    job->name,
+	                    (const struct timespec *) &times,
+	                    AT_SYMLINK_NOFOLLOW)) {
+		return false;
+	}
+
+	return true;
+}
+
+static result_t _write_batch(uring_t *ring,
+                             bool *batched,
+                             struct archive *output,
+                             archive_job_t **jobs,
+                             const unsigned int count,
+                             const mode_t mask) {
+	/* the parent directories of the files */
+	int parents[WRITE_BATCH_SIZE];
+
+	/* the parent directory paths */
+	const char *paths[WRITE_BATCH_SIZE];
+
+	/* the lengths of the parent directory paths */
+	size_t lengths[WRITE_BATCH_SIZE];
+
+	/* whether each file was written through io_uring */
+	bool written[WRITE_BATCH_SIZE];
+
+	/* a completion */
+	struct io_uring_cqe cqe;
+
+	/* the number of digested bytes */
+	off_t digested = 0;
+
+	/* the number of open parent directories */
+	unsigned int directories = 0;
+
+	/* the number of submitted entries */
+	unsigned int submitted = 0;
+
+	/* the index of a file */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	/* the result of writing a file */
+	result_t written_result = RESULT_OK;
+
+	assert(NULL != ring);
+	assert(NULL != batched);
+	assert(true == *batched);
+	assert(NULL != output);
+	assert(NULL != jobs);
+	assert(0 < count);
+	assert(WRITE_BATCH_SIZE >= count);
+
+	/* prepare a chain of operations for each file */
+	for ( ; count > i; ++i) {
+		written[i] = false;
+		jobs[i]->parent = (-1);
+		if (false == _can_batch(jobs[i])) {
+			continue;
+		}
+		jobs[i]->parent = _open_parent(jobs[i],
+		                               (int *) &parents,
+		                               (const char **) &paths,
+		                               (size_t *) &lengths,
+		                               &directories);
+		if (-1 == jobs[i]->parent) {
+			continue;
+		}
+		if (false == _queue_chain(ring, jobs[i], i)) {
+			jobs[i]->parent = (-1);
+			break;
+		}
+		written[i] = true;
+
+		digested = 0;
+		_digest(&jobs[i]->file.state,
+		        &digested,
+		        jobs[i]->contents,
+		        jobs[i]->size,
+		        0);
+	}
+
+	/* submit all chains at once and wait for all of them to complete; if
+	 * io_uring fails, stop using it */
+	submitted = ring->queued;
+	if (RESULT_OK != uring_submit(ring, submitted)) {
+		log_write(LOG_WARNING, "Failed to write files through io_uring\n");
+		uring_free(ring);
+		*batched = false;
+		for (i = 0; count > i; ++i) {
+			written[i] = false;
+		}
+		goto close_parents;
+	}
+	while (true == uring_get_cqe(ring, &cqe)) {
+		i = (unsigned int) (cqe.user_data >> STEP_BITS);
+		if ((0 > cqe.res) ||
+		    ((STEP_WRITE == (cqe.user_data & ((1 << STEP_BITS) - 1))) &&
+		     (jobs[i]->size != (size_t) cqe.res))) {
+			written[i] = false;
+		}
+	}
+
+	for (i = 0; count > i; ++i) {
+		if ((true == written[i]) &&
+		    (false == _restore_metadata(jobs[i], output, mask))) {
+			written[i] = false;
+		}
+	}
+
+close_parents:
+	for (i = 0; directories > i; ++i) {
+		(void) close(parents[i]);
+	}
+
+	/* write all other files through libarchive */
+	for (i = 0; count > i; ++i) {
+		if (true == written[i]) {
+			continue;
+		}
+		jobs[i]->read = false;
+		jobs[i]->file.state.digest = (uint32_t) crc32(0L, Z_NULL, 0);
+		written_result = _write_job(jobs[i], output);
+		if ((RESULT_OK != written_result) && (RESULT_OK == result)) {
+			result = written_result;
+		}
+	}
+
+	return result;
+}
+
+static void *_write_files(archive_queue_t *queue) {
+	/* the files written at once */
+	archive_job_t *jobs[WRITE_BATCH_SIZE];
+
+	/* the io_uring instance */
+	uring_t ring;
+
+	/* extraction data */
+	struct archive *output = NULL;
+
+	/* the umask */
+	mode_t mask = 0;
+
+	/* the number of files written at once */
+	unsigned int count = 0;
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* whether files are written through io_uring */
+	bool batched = false;
+
+	/* the result of writing files */
+	result_t result = RESULT_OK;
+
+	assert(NULL != queue);
+
+	output = _open_output();
+
+	/* if io_uring is available, write files in batches */
+	if (RESULT_OK == uring_new(&ring,
+	                           4 * WRITE_BATCH_SIZE,
+	                           WRITE_BATCH_SIZE)) {
+		mask = _get_umask();
+		batched = true;
+	}
+
+	(void) pthread_mutex_lock(&queue->lock);
+	if ((NULL == output) && (RESULT_OK == queue->result)) {
+		queue->result = RESULT_MEM_ERROR;
+	}
+
+	do {
+		/* wait for a file, until all files were queued */
+		while ((NULL == queue->head) && (false == queue->finished)) {
+			(void) pthread_cond_wait(&queue->queued, &queue->lock);
+		}
+		if (NULL == queue->head) {
+			break;
+		}
+
+		/* take one file, or a batch of files */
+		count = 0;
+		do {
+			jobs[count] = queue->head;
+			queue->head = queue->head->next;
+			++count;
+		} while ((true == batched) &&
+		         (WRITE_BATCH_SIZE > count) &&
+		         (NULL != queue->head));
+		if (NULL == queue->head) {
+			queue->tail = NULL;
+		}
+
+		/* once a file could not be written, skip all others */
+		result = queue->result;
+		(void) pthread_mutex_unlock(&queue->lock);
+
+		if (RESULT_OK == result) {
+			if (true == batched) {
+				result = _write_batch(&ring,
+				                      &batched,
+				                      output,
+				                      (archive_job_t **) &jobs,
+				                      count,
+				                      mask);
+			} else {
+				result = _write_job(jobs[0], output);
+			}
+		}
+		for (i = 0; count > i; ++i) {
+			_release_job(jobs[i]);
+		}
+
+		(void) pthread_mutex_lock(&queue->lock);
+		if (RESULT_OK == queue->result) {
+			queue->result = result;
+		}
+		for (i = 0; count > i; ++i) {
+			queue->size -= jobs[i]->size;
+			--(queue->pending);
+			jobs[i]->next = queue->done;
+			queue->done = jobs[i];
+		}
+		(void) pthread_cond_broadcast(&queue->written);
+	} while (1);
+
+	(void) pthread_mutex_unlock(&queue->lock);
+
+	if (true == batched) {
+		uring_free(&ring);
+	}
+	if (NULL != output) {
+		_close_output(output);
+	}
+
+	return NULL;
+}
+
+static result_t _queue_file(archive_queue_t *queue,
+                            struct archive *input,
+                            struct archive_entry *entry,
+                            const archive_staged_file_t *file,
+                            const unsigned int index,
+                            const int installed) {
+	/* the file */
+	archive_job_t *job = NULL;
+
+	/* the data block offset */
+	int64_t offset = 0LL;
+
 	/* the data block size */
 	size_t size = 0;
 
 	/* a data block */
 	const void *block = NULL;
 
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	assert(NULL != queue);
 	assert(NULL != input);
-	assert(NULL != output);
+	assert(NULL != entry);
+	assert(NULL != file);
+
+	job = malloc(sizeof(archive_job_t));
+	if (NULL == job) {
+		goto close_installed;
+	}
+	job->size = (size_t) file->state.size;
+	job->read = false;
+	job->installed = installed;
+	job->parent = (-1);
+	job->name = NULL;
+	job->index = index;
+	job->file = *file;
+	job->next = NULL;
+
+	/* holes in sparse files are left zeroed */
+	job->contents = calloc(1 + job->size, sizeof(unsigned char));
+	if (NULL == job->contents) {
+		goto free_job;
+	}
+	job->entry = archive_entry_clone(entry);
+	if (NULL == job->entry) {
+		goto free_contents;
+	}
 
+	/* decompress the file */
 	do {
-		/* read a data block */
 		switch (archive_read_data_block(input, &block, &size, &offset)) {
 			case ARCHIVE_OK:
 				break;
 
 			case ARCHIVE_EOF:
-				goto end;
+				goto queue;
 
 			default:
 				result = RESULT_IO_ERROR;
-				goto end;
+				goto free_entry;
 		}
 
-		/* extract the data block */
-		if (ARCHIVE_OK != archive_write_data_block(output,
-		                                           block,
-		                                           size,
-		                                           offset)) {
-			goto end;
+		if ((0LL > offset) ||
+		    (job->size < (size_t) offset) ||
+		    ((job->size - (size_t) offset) < size)) {
+			result = RESULT_CORRUPT_DATA;
+			goto free_entry;
 		}
+		(void) memcpy(&job->contents[(size_t) offset], block, size);
 	} while (1);
 
+queue:
+	/* wait until there is room for the file, then hand it to a writer
+	 * thread */
+	(void) pthread_mutex_lock(&queue->lock);
+	while ((0 < queue->pending) &&
+	       (MAX_QUEUE_SIZE < (queue->size + job->size)) &&
+	       (RESULT_OK == queue->result)) {
+		(void) pthread_cond_wait(&queue->written, &queue->lock);
+	}
+	result = queue->result;
+	if (RESULT_OK == result) {
+		if (NULL == queue->tail) {
+			queue->head = job;
+		} else {
+			queue->tail->next = job;
+		}
+		queue->tail = job;
+		queue->size += job->size;
+		++(queue->pending);
+		(void) pthread_cond_signal(&queue->queued);
+	}
+	(void) pthread_mutex_unlock(&queue->lock);
+	if (RESULT_OK == result) {
+		goto end;
+	}
+
+free_entry:
+	/* free the archive entry */
+	archive_entry_free(job->entry);
+
+free_contents:
+	/* free the file contents */
+	free(job->contents);
+
+free_job:
+	/* free the job */
+	free(job);
+
+close_installed:
+	/* close the installed file */
+	if (-1 != installed) {
+		(void) close(installed);
+	}
+
 end:
 	return result;
 }
 
-result_t archive_extract(unsigned char *contents,
-                         const size_t size,
+static void _save_written(archive_queue_t *queue, archive_staging_t *staging) {
+	/* the next written file */
+	archive_job_t *next = NULL;
+
+	assert(NULL != queue);
+	assert(NULL != staging);
+
+	for ( ; NULL != queue->done; queue->done = next) {
+		next = queue->done->next;
+		(void) memcpy(&staging->files[queue->done->index],
+		              &queue->done->file,
+		              sizeof(archive_staged_file_t));
+		free(queue->done);
+	}
+}
+
+static result_t _drain(archive_queue_t *queue, archive_staging_t *staging) {
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != queue);
+	assert(NULL != staging);
+
+	/* wait until all queued files are written */
+	(void) pthread_mutex_lock(&queue->lock);
+	while (0 < queue->pending) {
+		(void) pthread_cond_wait(&queue->written, &queue->lock);
+	}
+	_save_written(queue, staging);
+	result = queue->result;
+	(void) pthread_mutex_unlock(&queue->lock);
+
+	return result;
+}
+
+static unsigned int _start_writers(archive_queue_t *queue,
+                                   workers_t *threads,
+                                   const unsigned int writers) {
+	/* the number of writer threads */
+	unsigned int count = 0;
+
+	assert(NULL != queue);
+	assert(NULL != threads);
+	assert(1 < writers);
+
+	queue->head = NULL;
+	queue->tail = NULL;
+	queue->done = NULL;
+	queue->size = 0;
+	queue->pending = 0;
+	queue->finished = false;
+	queue->result = RESULT_OK;
+	if (0 != pthread_mutex_init(&queue->lock, NULL)) {
+		goto end;
+	}
+	if (0 != pthread_cond_init(&queue->queued, NULL)) {
+		goto destroy_lock;
+	}
+	if (0 != pthread_cond_init(&queue->written, NULL)) {
+		goto destroy_queued;
+	}
+
+	count = workers_start(threads,
+	                      writers,
+	                      (worker_routine_t) _write_files,
+	                      queue);
+	if (0 < count) {
+		log_write(LOG_DEBUG, "Writing files using %u threads\n", count);
+		goto end;
+	}
+
+	(void) pthread_cond_destroy(&queue->written);
+
+destroy_queued:
+	(void) pthread_cond_destroy(&queue->queued);
+
+destroy_lock:
+	(void) pthread_mutex_destroy(&queue->lock);
+
+end:
+	return count;
+}
+
+static result_t _stop_writers(archive_queue_t *queue,
+                              workers_t *threads,
+                              archive_staging_t *staging) {
+	assert(NULL != queue);
+	assert(NULL != threads);
+	assert(0 < threads->count);
+	assert(NULL != staging);
+
+	/* let the threads exit once all queued files are written */
+	(void) pthread_mutex_lock(&queue->lock);
+	queue->finished = true;
+	(void) pthread_cond_broadcast(&queue->queued);
+	(void) pthread_mutex_unlock(&queue->lock);
+
+	workers_join(threads);
+
+	_save_written(queue, staging);
+
+	(void) pthread_cond_destroy(&queue->written);
+	(void) pthread_cond_destroy(&queue->queued);
+	(void) pthread_mutex_destroy(&queue->lock);
+
+	return queue->result;
+}
+
+static result_t _extract(struct archive *input,
                          const file_callback_t callback,
-                         void *arg) {
+                         void *arg,
+                         const archive_lookup_callback_t lookup,
+                         void *lookup_arg,
+                         const unsigned int writers,
+                         archive_staging_t *staging) {
+	/* the files waiting for a writer thread */
+	archive_queue_t queue;
+
+	/* the writer threads */
+	workers_t threads = {0};
+
 	/* the return value */
 	result_t result = RESULT_MEM_ERROR;
 
-	/* the archive */
-	struct archive *input = NULL;
+	/* the result of writing files */
+	result_t written = RESULT_OK;
 
 	/* extraction data */
 	struct archive *output = NULL;
@@ -79,34 +1295,22 @@ result_t archive_extract(unsigned char *contents,
 	/* the file path */
 	const char *path = NULL;
 
-	assert(NULL != contents);
-	assert(0 < size);
-	assert(NULL != callback);
+	/* the installed file, if it may be identical */
+	int installed = (-1);
 
-	/* allocate memory for reading the archive */
-	input = archive_read_new();
-	if (NULL == input) {
-		goto end;
-	}
+	assert(NULL != input);
+	assert((NULL != callback) || (NULL != staging));
 
 	/* allocate memory for extracting the archive */
-	output = archive_write_disk_new();
+	output = _open_output();
 	if (NULL == output) {
-		goto close_input;
+		goto end;
 	}
 
-	/* set the reading options */
-	archive_read_support_filter_xz(input);
-	archive_read_support_format_tar(input);
-
-	/* set the extraction options */
-	archive_write_disk_set_options(output, EXTRACTION_OPTIONS);
-	archive_write_disk_set_standard_lookup(output);
-
-	/* open the archive */
-	if (0 != archive_read_open_memory(input, contents, size)) {
-		log_write(LOG_ERROR, "Failed to read the package\n");
-		goto close_output;
+	/* if requested, start the writer threads; this thread keeps writing
+	 * directories, so they exist before files are written to them */
+	if ((NULL != staging) && (1 < writers)) {
+		(void) _start_writers(&queue, &threads, writers);
 	}
 
 	do {
@@ -117,11 +1321,12 @@ result_t archive_extract(unsigned char *contents,
 
 			case ARCHIVE_EOF:
 				result = RESULT_OK;
-				goto close_output;
+				goto stop_writers;
 
 			default:
 				log_write(LOG_ERROR, "Failed to read an archive entry\n");
-				goto close_output;
+				result = RESULT_CORRUPT_DATA;
+				goto stop_writers;
 		}
 
 		/* get the file path */
@@ -144,26 +1349,229 @@ result_t archive_extract(unsigned char *contents,
 			continue;
 		}
 
-		/* call the callback */
-		result = callback(path, arg);
+		if (NULL == staging) {
+			/* call the callback */
+			result = callback(path, arg);
+		} else {
+			/* hard links can be extracted only once their target is */
+			if ((0 < threads.count) &&
+			    (NULL != archive_entry_hardlink(entry))) {
+				result = _drain(&queue, staging);
+				if (RESULT_OK != result) {
+					break;
+				}
+			}
+
+			/* redirect the file to a temporary path */
+			result = _stage(entry,
+			                path,
+			                lookup,
+			                lookup_arg,
+			                staging,
+			                &installed);
+		}
 		if (RESULT_OK != result) {
 			break;
 		}
 
+		/* hand small regular files to the writer threads */
+		if ((0 < threads.count) &&
+		    (AE_IFREG == archive_entry_filetype(entry)) &&
+		    (NULL == archive_entry_hardlink(entry)) &&
+		    (MAX_QUEUED_FILE_SIZE >= archive_entry_size(entry))) {
+			result = _queue_file(&queue,
+			                     input,
+			                     entry,
+			                     &staging->files[staging->count - 1],
+			                     staging->count - 1,
+			                     installed);
+			if (RESULT_OK != result) {
+				break;
+			}
+			continue;
+		}
+
+		/* if the file may be identical to the installed file, extract it
+		 * only if they differ */
+		if (-1 != installed) {
+			result = _extract_changed(
+			               (archive_block_callback_t) archive_read_data_block,
+			               input,
+			               output,
+			               entry,
+			               &staging->files[staging->count - 1],
+			               installed);
+			(void) close(installed);
+			if (RESULT_OK != result) {
+				break;
+			}
+			continue;
+		}
+
 		/* extract the file */
 		if (ARCHIVE_OK != archive_write_header(output, entry)) {
+			log_write(LOG_ERROR,
+			          "Failed to extract %s\n",
+			          archive_entry_pathname(entry));
+			result = RESULT_IO_ERROR;
 			break;
 		}
-		result = _extract_file(input, output);
+		result = _extract_file(
+		                    (archive_block_callback_t) archive_read_data_block,
+		                    input,
+		                    output,
+		                    ((NULL == staging) ||
+		                     (NULL != archive_entry_hardlink(entry))) ?
+		                    NULL :
+		                    &staging->files[staging->count - 1].state,
+		                    0);
 		if (RESULT_OK != result) {
 			break;
 		}
 	} while (1);
 
-close_output:
+stop_writers:
+	/* wait for all queued files to be written, before directory metadata is
+	 * restored */
+	if (0 < threads.count) {
+		written = _stop_writers(&queue, &threads, staging);
+		if (RESULT_OK == result) {
+			result = written;
+		}
+	}
+
 	/* free all memory used for output */
-	(void) archive_write_close(output);
-	archive_write_free(output);
+	_close_output(output);
+
+end:
+	return result;
+}
+
+static struct archive *_open(void) {
+	/* the archive */
+	struct archive *input = NULL;
+
+	/* allocate memory for reading the archive */
+	input = archive_read_new();
+	if (NULL == input) {
+		return NULL;
+	}
+
+	/* set the reading options */
+	archive_read_support_filter_xz(input);
+	archive_read_support_filter_zstd(input);
+	archive_read_support_format_tar(input);
+
+	return input;
+}
+
+static la_ssize_t _read(struct archive *input,
+                        archive_reader_t *reader,
+                        const void **block) {
+	assert(NULL != input);
+	assert(NULL != reader);
+	assert(NULL != block);
+
+	return (la_ssize_t) reader->callback(reader->arg, block);
+}
+
+result_t archive_extract(const archive_read_callback_t read,
+                         void *arg,
+                         const file_callback_t callback,
+                         void *callback_arg) {
+	/* the reading callback parameters */
+	archive_reader_t reader = {0};
+
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	/* the archive */
+	struct archive *input = NULL;
+
+	assert(NULL != read);
+	assert(NULL != callback);
+
+	/* allocate memory for reading the archive */
+	input = _open();
+	if (NULL == input) {
+		goto end;
+	}
+
+	/* open the archive */
+	reader.callback = read;
+	reader.arg = arg;
+	if (0 != archive_read_open(input,
+	                           &reader,
+	                           NULL,
+	                           (archive_read_callback *) _read,
+	                           NULL)) {
+		log_write(LOG_ERROR, "Failed to read the package\n");
+		goto close_input;
+	}
+
+	/* extract the archive */
+	result = _extract(input, callback, callback_arg, NULL, NULL, 1, NULL);
+
+close_input:
+	/* free all memory used for reading the archive */
+	(void) archive_read_close(input);
+	archive_read_free(input);
+
+end:
+	return result;
+}
+
+result_t archive_extract_staged(const archive_read_callback_t read,
+                                void *arg,
+                                const char *owner,
+                                const archive_lookup_callback_t lookup,
+                                void *lookup_arg,
+                                const unsigned int writers,
+                                archive_staging_t *staging) {
+	/* the reading callback parameters */
+	archive_reader_t reader = {0};
+
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	/* the archive */
+	struct archive *input = NULL;
+
+	assert(NULL != read);
+	assert(NULL != owner);
+	assert(NULL != staging);
+
+	/* initialize the list of extracted files */
+	staging->files = NULL;
+	staging->count = 0;
+	staging->owner = owner;
+
+	/* allocate memory for reading the archive */
+	input = _open();
+	if (NULL == input) {
+		goto end;
+	}
+
+	/* open the archive */
+	reader.callback = read;
+	reader.arg = arg;
+	if (0 != archive_read_open(input,
+	                           &reader,
+	                           NULL,
+	                           (archive_read_callback *) _read,
+	                           NULL)) {
+		log_write(LOG_ERROR, "Failed to read the package\n");
+		goto close_input;
+	}
+
+	/* extract the archive */
+	result = _extract(input,
+	                  NULL,
+	                  NULL,
+	                  lookup,
+	                  lookup_arg,
+	                  writers,
+	                  staging);
 
 close_input:
 	/* free all memory used for reading the archive */
@@ -173,3 +1581,165 @@ close_input:
 end:
 	return result;
 }
+
+result_t archive_decompress(const unsigned char *contents,
+                            const size_t size,
+                            unsigned char *output,
+                            const size_t output_size) {
+	/* an extra byte, used to detect excess data */
+	unsigned char excess = 0;
+
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	/* the compressed data */
+	struct archive *input = NULL;
+
+	/* the compressed data, as a single entry */
+	struct archive_entry *entry = NULL;
+
+	/* the number of decompressed bytes */
+	size_t total = 0;
+
+	/* the size of a decompressed block */
+	la_ssize_t block = 0;
+
+	assert(NULL != contents);
+	assert(0 < size);
+	assert(NULL != output);
+
+	/* allocate memory for reading the compressed data */
+	input = archive_read_new();
+	if (NULL == input) {
+		goto end;
+	}
+
+	/* set the reading options */
+	archive_read_support_filter_xz(input);
+	archive_read_support_filter_zstd(input);
+	archive_read_support_format_raw(input);
+
+	/* open the compressed data */
+	result = RESULT_CORRUPT_DATA;
+	if ((ARCHIVE_OK != archive_read_open_memory(input, contents, size)) ||
+	    (ARCHIVE_OK != archive_read_next_header(input, &entry))) {
+		goto close_input;
+	}
+
+	/* decompress the data and make sure its size is the expected one */
+	for ( ; output_size > total; total += (size_t) block) {
+		block = archive_read_data(input, &output[total], output_size - total);
+		if (0 >= block) {
+			goto close_input;
+		}
+	}
+	if (0 != archive_read_data(input, &excess, sizeof(excess))) {
+		goto close_input;
+	}
+
+	/* report success */
+	result = RESULT_OK;
+
+close_input:
+	if (RESULT_OK != result) {
+		log_write(LOG_ERROR, "Failed to decompress the package\n");
+	}
+
+	/* free all memory used for reading the compressed data */
+	(void) archive_read_close(input);
+	archive_read_free(input);
+
+end:
+	return result;
+}
+
+result_t archive_staging_commit(archive_staging_t *staging,
+                                const staged_file_callback_t callback,
+                                void *arg) {
+	/* the temporary path of a file */
+	char staged_path[PATH_MAX] = {'\0'};
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != staging);
+
+	for ( ; staging->count > i; ++i) {
+		/* move the file to its destination */
+		if (true == staging->files[i].staged) {
+			(void) _get_staged_path((char *) &staged_path,
+			                        sizeof(staged_path),
+			                        staging,
+			                        staging->files[i].path);
+			if (-1 == rename((const char *) &staged_path,
+			                 staging->files[i].path)) {
+				log_write(LOG_ERROR,
+				          "Failed to move %s into place\n",
+				          staging->files[i].path);
+				result = RESULT_IO_ERROR;
+				break;
+			}
+			staging->files[i].staged = false;
+		}
+
+		/* the file is no longer temporary */
+		staging->files[i].created = false;
+
+		/* call the callback */
+		if (NULL != callback) {
+			result = callback(&staging->files[i], arg);
+			if (RESULT_OK != result) {
+				break;
+			}
+		}
+	}
+
+	return result;
+}
+
+void archive_staging_rollback(archive_staging_t *staging) {
+	/* the temporary path of a file */
+	char staged_path[PATH_MAX] = {'\0'};
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != staging);
+
+	/* delete files in reverse order, so directories are empty when they get
+	 * deleted */
+	for (i = staging->count; 0 < i; --i) {
+		if (true == staging->files[i - 1].staged) {
+			(void) _get_staged_path((char *) &staged_path,
+			                        sizeof(staged_path),
+			                        staging,
+			                        staging->files[i - 1].path);
+			log_write(LOG_DEBUG, "Deleting %s\n", staged_path);
+			(void) unlink((const char *) &staged_path);
+		} else {
+			if (true == staging->files[i - 1].created) {
+				log_write(LOG_DEBUG,
+				          "Deleting %s\n",
+				          staging->files[i - 1].path);
+				(void) rmdir(staging->files[i - 1].path);
+			}
+		}
+	}
+}
+
+void archive_staging_free(archive_staging_t *staging) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != staging);
+
+	for ( ; staging->count > i; ++i) {
+		free(staging->files[i].path);
+	}
+	if (NULL != staging->files) {
+		free(staging->files);
+	}
+}
@@ -2,6 +2,9 @@
 #	define _ARCHIVE_H_INCLUDED
 
 #	include <sys/types.h>
+#	include <stdbool.h>
+#	include <stdint.h>
+#	include <pthread.h>
 
 #	include "result.h"
 
@@ -16,19 +19,247 @@
 typedef result_t (*file_callback_t)(const char *path, void *arg);
 
 /*!
- * @fn result_t archive_extract(unsigned char *contents,
- *                              const size_t size,
+ * @def STAGING_SUFFIX
+ * @brief The suffix appended to the paths of files extracted before they are
+ *        committed, followed by a dot and the name of their package
+ * @see archive_extract_staged */
+#	define STAGING_SUFFIX ".packdude-new"
+
+/*!
+ * @typedef archive_read_callback_t
+ * @brief A callback which reads the next block of an archive
+ *
+ * This function should return the block size, 0 at the end of the archive or
+ * -1 on failure. The block should remain valid until the next call. */
+typedef ssize_t (*archive_read_callback_t)(void *arg, const void **block);
+
+/*!
+ * @struct archive_reader_t
+ * @brief The parameters of _read() */
+typedef struct {
+	archive_read_callback_t callback; /*!< The callback which reads the
+	                                   * archive */
+	void *arg; /*!< A pointer passed to the callback */
+} archive_reader_t;
+
+/*!
+ * @struct archive_file_state_t
+ * @brief The recorded state of an extracted file */
+typedef struct {
+	off_t size; /*!< The file size */
+	mode_t mode; /*!< The file type and permissions */
+	uint32_t digest; /*!< A CRC32 checksum of the file contents */
+	time_t mtime; /*!< The file modification time, or 0 if unknown */
+} archive_file_state_t;
+
+/*!
+ * @typedef archive_lookup_callback_t
+ * @brief A callback which returns the recorded state of an installed file, or
+ *        NULL if there is none */
+typedef const archive_file_state_t *(*archive_lookup_callback_t)(
+                                                             const char *path,
+                                                             void *arg);
+
+/*!
+ * @struct archive_staged_file_t
+ * @brief A file extracted from an archive, which was not committed yet */
+typedef struct {
+	char *path; /*!< The file path */
+	archive_file_state_t state; /*!< The file state */
+	bool staged; /*!< Whether the file was extracted to a temporary path */
+	bool created; /*!< Whether the file is a directory created during
+	               * extraction */
+	bool unchanged; /*!< Whether the file is identical to the installed file
+	                 * and was not extracted */
+} archive_staged_file_t;
+
+/*!
+ * @typedef staged_file_callback_t
+ * @brief A callback executed for each file committed by
+ *        archive_staging_commit() */
+typedef result_t (*staged_file_callback_t)(const archive_staged_file_t *file,
+                                           void *arg);
+
+/*!
+ * @typedef archive_block_callback_t
+ * @brief A callback which reads the next data block of an extracted file
+ *
+ * This function has the same semantics as archive_read_data_block(). */
+typedef int (*archive_block_callback_t)(void *source,
+                                        const void **block,
+                                        size_t *size,
+                                        int64_t *offset);
+
+/*!
+ * @def MAX_QUEUED_FILE_SIZE
+ * @brief The maximum size of a file written by a writer thread; bigger files
+ *        are written by the thread which decompresses the archive */
+#	define MAX_QUEUED_FILE_SIZE (1024 * 1024)
+
+/*!
+ * @def MAX_QUEUE_SIZE
+ * @brief The maximum total size of decompressed files waiting for a writer
+ *        thread */
+#	define MAX_QUEUE_SIZE (16 * 1024 * 1024)
+
+/*!
+ * @def WRITE_BATCH_SIZE
+ * @brief The maximum number of files a writer thread creates through a single
+ *        io_uring submission */
+#	define WRITE_BATCH_SIZE (32)
+
+/*!
+ * @struct archive_job_t
+ * @brief A file decompressed into memory, which waits for a writer thread */
+typedef struct archive_job {
+	struct archive_entry *entry; /*!< The archive entry */
+	unsigned char *contents; /*!< The file contents */
+	size_t size; /*!< The file size */
+	bool read; /*!< Whether the contents were read by _read_job() */
+	int installed; /*!< The installed file, if it may be identical, or -1 */
+	int parent; /*!< The parent directory, while the file is written through
+	             * io_uring, or -1 */
+	const char *name; /*!< The file name, relative to \a parent */
+	unsigned int index; /*!< The index of the file in the list of extracted
+	                     * files */
+	archive_staged_file_t file; /*!< The extracted file */
+	struct archive_job *next; /*!< The next job */
+} archive_job_t;
+
+/*!
+ * @struct archive_queue_t
+ * @brief The parameters of _write_files() */
+typedef struct {
+	archive_job_t *head; /*!< The first file waiting for a writer thread */
+	archive_job_t *tail; /*!< The last file waiting for a writer thread */
+	archive_job_t *done; /*!< Written files, whose state was not saved yet */
+	size_t size; /*!< The total size of files not written yet */
+	unsigned int pending; /*!< The number of files not written yet */
+	bool finished; /*!< Whether all files were queued */
+	result_t result; /*!< The first writing failure, if any */
+	pthread_mutex_t lock; /*!< A lock which protects the queue */
+	pthread_cond_t queued; /*!< Signaled when a file is queued */
+	pthread_cond_t written; /*!< Signaled when a file is written */
+} archive_queue_t;
+
+/*!
+ * @struct archive_staging_t
+ * @brief All files extracted from an archive, which were not committed yet */
+typedef struct {
+	archive_staged_file_t *files; /*!< The files */
+	unsigned int count; /*!< The number of files */
+	const char *owner; /*!< The name of the package the files belong to; it
+	                    * must outlive the list */
+} archive_staging_t;
+
+/*!
+ * @fn result_t archive_extract(const archive_read_callback_t read,
+ *                              void *arg,
  *                              const file_callback_t callback,
- *                              void *arg)
- * @brief Extracts an archive
- * @param contents The archive
- * @param size The archive size
+ *                              void *callback_arg)
+ * @brief Extracts an archive read incrementally
+ * @param read The callback which reads the archive
+ * @param arg A pointer passed to \a read
  * @param callback A callback to run for each extracted file
- * @param arg A pointer passed to the callback */
-result_t archive_extract(unsigned char *contents,
-                         const size_t size,
+ * @param callback_arg A pointer passed to \a callback */
+result_t archive_extract(const archive_read_callback_t read,
+                         void *arg,
                          const file_callback_t callback,
-                         void *arg);
+                         void *callback_arg);
+
+/*!
+ * @fn result_t archive_extract_staged(const archive_read_callback_t read,
+ *                                     void *arg,
+ *                                     const char *owner,
+ *                                     const archive_lookup_callback_t lookup,
+ *                                     void *lookup_arg,
+ *                                     const unsigned int writers,
+ *                                     archive_staging_t *staging)
+ * @brief Extracts an archive read incrementally, without replacing existing
+ *        files
+ * @param read The callback which reads the archive
+ * @param arg A pointer passed to the callback
+ * @param owner The name of the package the archive belongs to
+ * @param lookup A callback which returns the recorded state of installed
+ *               files, or NULL
+ * @param lookup_arg A pointer passed to \a lookup
+ * @param writers The number of threads which write files
+ * @param staging The extracted files
+ * @see archive_staging_commit
+ * @see archive_staging_rollback
+ * @see archive_staging_free
+ *
+ * Files are extracted next to their destination, with \a STAGING_SUFFIX and
+ * \a owner appended to their paths, so packages which contain the same file
+ * can be extracted simultaneously. Directories are created in place; a
+ * directory is deleted on rollback only if its creation during extraction
+ * succeeded. A regular file
+ * whose recorded size and mode match the archive entry is compared with the
+ * installed file while it is being read, and it is extracted only if they
+ * differ.
+ *
+ * If \a writers is bigger than 1, the calling thread only decompresses the
+ * archive and regular files up to \a MAX_QUEUED_FILE_SIZE are written by a
+ * pool of writer threads. Directories, bigger files and special files are
+ * still written by the calling thread, in order, and hard links are written
+ * once their target is. If io_uring is available, writer threads create,
+ * write and close files in batches of up to \a WRITE_BATCH_SIZE, relative to
+ * their parent directory.
+ *
+ * Archives may be extracted this way by multiple threads simultaneously. */
+result_t archive_extract_staged(const archive_read_callback_t read,
+                                void *arg,
+                                const char *owner,
+                                const archive_lookup_callback_t lookup,
+                                void *lookup_arg,
+                                const unsigned int writers,
+                                archive_staging_t *staging);
+
+/*!
+ * @fn result_t archive_decompress(const unsigned char *contents,
+ *                                 const size_t size,
+ *                                 unsigned char *output,
+ *                                 const size_t output_size)
+ * @brief Decompresses a compressed block of data
+ * @param contents The compressed data
+ * @param size The compressed data size
+ * @param output The decompressed data
+ * @param output_size The expected decompressed data size
+ *
+ * This function fails if the decompressed data size is not \a output_size.
+ * Data may be decompressed this way by multiple threads simultaneously. */
+result_t archive_decompress(const unsigned char *contents,
+                            const size_t size,
+                            unsigned char *output,
+                            const size_t output_size);
+
+/*!
+ * @fn result_t archive_staging_commit(archive_staging_t *staging,
+ *                                     const staged_file_callback_t callback,
+ *                                     void *arg)
+ * @brief Moves all files extracted by archive_extract_staged() to their
+ *        destination
+ * @param staging The extracted files
+ * @param callback A callback to run for each committed file
+ * @param arg A pointer passed to the callback
+ *
+ * Unchanged files are left in place, but the callback runs for them too. */
+result_t archive_staging_commit(archive_staging_t *staging,
+                                const staged_file_callback_t callback,
+                                void *arg);
+
+/*!
+ * @fn void archive_staging_rollback(archive_staging_t *staging)
+ * @brief Deletes all files extracted by archive_extract_staged(), which were
+ *        not committed
+ * @param staging The extracted files */
+void archive_staging_rollback(archive_staging_t *staging);
+
+/*!
+ * @fn void archive_staging_free(archive_staging_t *staging)
+ * @brief Frees the list of files extracted by archive_extract_staged()
+ * @param staging The extracted files */
+void archive_staging_free(archive_staging_t *staging);
 
 /*!
  * @} */
@@ -0,0 +1,407 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "log.h"
+#include "cache.h"
+
+result_t cache_open(cache_t *cache, const char *path, const off_t max_size) {
+	assert(NULL != cache);
+	assert(NULL != path);
+
+	/* create the cache directory, if it does not exist */
+	if (-1 == mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH)) {
+		if (EEXIST != errno) {
+			log_write(LOG_DEBUG, "Failed to create %s\n", path);
+			return RESULT_IO_ERROR;
+		}
+	}
+
+	/* make sure the cache is writable */
+	if (-1 == access(path, R_OK | W_OK | X_OK)) {
+		log_write(LOG_DEBUG, "%s is inaccessible\n", path);
+		return RESULT_IO_ERROR;
+	}
+
+	cache->path = path;
+	cache->max_size = max_size;
+
+	return RESULT_OK;
+}
+
+static result_t _format_name(char *name,
+                             const size_t size,
+                             const char *format,
+                             const char *file_name,
+                             const uint32_t checksum) {
+	/* the current character */
+	char *position = NULL;
+
+	assert(NULL != name);
+	assert(NULL != format);
+	assert(NULL != file_name);
+
+	if (size <= snprintf(name,
+	                     size,
+	                     format,
+	                     file_name,
+	                     (unsigned int) checksum,
+	                     (long) getpid())) {
+		return RESULT_CORRUPT_DATA;
+	}
+
+	/* package file names may contain directories - flatten them */
+	for (position = name; '\0' != *position; ++position) {
+		if ('/' == *position) {
+			*position = '_';
+		}
+	}
+
+	return RESULT_OK;
+}
+
+result_t cache_get(cache_t *cache,
+                   const char *file_name,
+                   const uint32_t checksum,
+                   unsigned char **contents,
+                   size_t *size) {
+	/* the cached package path */
+	char path[PATH_MAX] = {'\0'};
+
+	/* the cached package name */
+	char name[NAME_MAX + 1] = {'\0'};
+
+	/* the package attributes */
+	struct stat attributes = {0};
+
+	/* the return value */
+	result_t result = RESULT_CORRUPT_DATA;
+
+	/* the package contents */
+	unsigned char *mapping = NULL;
+
+	/* the file descriptor */
+	int fd = (-1);
+
+	assert(NULL != cache);
+	assert(NULL != cache->path);
+	assert(NULL != file_name);
+	assert(NULL != contents);
+	assert(NULL != size);
+
+	/* format the cached package path */
+	result = _format_name((char *) &name,
+	                      sizeof(name),
+	                      CACHE_ENTRY_NAME_FORMAT,
+	                      file_name,
+	                      checksum);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	if (sizeof(path) <= snprintf((char *) &path,
+	                             sizeof(path),
+	                             "%s/%s",
+	                             cache->path,
+	                             (const char *) &name)) {
+		result = RESULT_CORRUPT_DATA;
+		goto end;
+	}
+
+	/* open the package */
+	fd = open((const char *) &path, O_RDONLY);
+	if (-1 == fd) {
+		if (ENOENT == errno) {
+			log_write(LOG_DEBUG, "%s is not cached\n", file_name);
+			result = RESULT_NOT_FOUND;
+		} else {
+			result = RESULT_IO_ERROR;
+		}
+		goto end;
+	}
+
+	/* get the package size */
+	if (-1 == fstat(fd, &attributes)) {
+		result = RESULT_IO_ERROR;
+		goto close_file;
+	}
+	if (0 == attributes.st_size) {
+		result = RESULT_NOT_FOUND;
+		goto close_file;
+	}
+
+	/* map the package contents to memory */
+	mapping = mmap(NULL,
+	               (size_t) attributes.st_size,
+	               PROT_READ,
+	               MAP_PRIVATE,
+	               fd,
+	               0);
+	if (MAP_FAILED == mapping) {
+		result = RESULT_IO_ERROR;
+		goto close_file;
+	}
+	*contents = mapping;
+	*size = (size_t) attributes.st_size;
+
+	/* mark the package as recently used */
+	(void) futimens(fd, NULL);
+
+	log_write(LOG_DEBUG, "Using the cached copy of %s\n", file_name);
+
+	/* report success */
+	result = RESULT_OK;
+
+close_file:
+	/* close the file descriptor */
+	(void) close(fd);
+
+end:
+	return result;
+}
+
+result_t cache_put(cache_t *cache,
+                   const char *file_name,
+                   const uint32_t checksum,
+                   const unsigned char *contents,
+                   const size_t size) {
+	/* the cached package path */
+	char path[PATH_MAX] = {'\0'};
+
+	/* the temporary path of the cached package */
+	char temporary_path[PATH_MAX] = {'\0'};
+
+	/* the cached package name */
+	char name[NAME_MAX + 1] = {'\0'};
+
+	/* the return value */
+	result_t result = RESULT_CORRUPT_DATA;
+
+	/* the file descriptor */
+	int fd = (-1);
+
+	assert(NULL != cache);
+	assert(NULL != cache->path);
+	assert(NULL != file_name);
+	assert(NULL != contents);
+
+	/* if the package is bigger than the cache, do not cache it */
+	if (cache->max_size < (off_t) size) {
+		result = RESULT_OK;
+		goto end;
+	}
+
+	/* format the cached package path and its temporary path */
+	result = _format_name((char *) &name,
+	                      sizeof(name),
+	                      CACHE_ENTRY_NAME_FORMAT,
+	                      file_name,
+	                      checksum);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	if (sizeof(path) <= snprintf((char *) &path,
+	                             sizeof(path),
+	                             "%s/%s",
+	                             cache->path,
+	                             (const char *) &name)) {
+		result = RESULT_CORRUPT_DATA;
+		goto end;
+	}
+	result = _format_name((char *) &name,
+	                      sizeof(name),
+	                      CACHE_TEMPORARY_NAME_FORMAT,
+	                      file_name,
+	                      checksum);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	if (sizeof(temporary_path) <= snprintf((char *) &temporary_path,
+	                                       sizeof(temporary_path),
+	                                       "%s/%s",
+	                                       cache->path,
+	                                       (const char *) &name)) {
+		result = RESULT_CORRUPT_DATA;
+		goto end;
+	}
+
+	log_write(LOG_DEBUG, "Adding %s to the package cache\n", file_name);
+
+	/* write the package to a temporary file, so other instances never see a
+	 * partially written package */
+	fd = open((const char *) &temporary_path,
+	          O_WRONLY | O_CREAT | O_TRUNC,
+	          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (-1 == fd) {
+		result = RESULT_IO_ERROR;
+		goto end;
+	}
+	if ((ssize_t) size != write(fd, contents, size)) {
+		result = RESULT_IO_ERROR;
+		goto delete_file;
+	}
+	if (-1 == close(fd)) {
+		result = RESULT_IO_ERROR;
+		goto delete_file;
+	}
+	fd = (-1);
+
+	/* put the package in place */
+	if (-1 == rename((const char *) &temporary_path, (const char *) &path)) {
+		result = RESULT_IO_ERROR;
+		goto delete_file;
+	}
+
+	/* evict old packages, if the cache is too big */
+	result = cache_prune(cache, cache->max_size);
+	goto end;
+
+delete_file:
+	/* delete the temporary file */
+	if (-1 != fd) {
+		(void) close(fd);
+	}
+	(void) unlink((const char *) &temporary_path);
+
+end:
+	return result;
+}
+
+static int _compare_entries(const cache_entry_t *a, const cache_entry_t *b) {
+	if (a->last_use < b->last_use) {
+		return (-1);
+	}
+	if (a->last_use > b->last_use) {
+		return 1;
+	}
+	return 0;
+}
+
+result_t cache_prune(cache_t *cache, const off_t max_size) {
+	/* a cached package path */
+	char path[PATH_MAX] = {'\0'};
+
+	/* the attributes of a cached package */
+	struct stat attributes = {0};
+
+	/* the cached packages */
+	cache_entry_t *entries = NULL;
+
+	/* the enlarged list of cached packages */
+	cache_entry_t *more_entries = NULL;
+
+	/* the cache directory */
+	DIR *directory = NULL;
+
+	/* a file in the cache directory */
+	struct dirent *file = NULL;
+
+	/* the total size of all cached packages */
+	off_t total_size = 0;
+
+	/* the number of cached packages */
+	unsigned int count = 0;
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_IO_ERROR;
+
+	assert(NULL != cache);
+	assert(NULL != cache->path);
+
+	/* list the cached packages */
+	directory = opendir(cache->path);
+	if (NULL == directory) {
+		goto end;
+	}
+
+	do {
+		file = readdir(directory);
+		if (NULL == file) {
+			break;
+		}
+
+		/* format the package path and get its attributes */
+		if (sizeof(path) <= snprintf((char *) &path,
+		                             sizeof(path),
+		                             "%s/%s",
+		                             cache->path,
+		                             file->d_name)) {
+			continue;
+		}
+		if (-1 == lstat((const char *) &path, &attributes)) {
+			continue;
+		}
+		if (!S_ISREG(attributes.st_mode)) {
+			continue;
+		}
+
+		/* add the package to the list */
+		more_entries = realloc(entries, sizeof(cache_entry_t) * (1 + count));
+		if (NULL == more_entries) {
+			result = RESULT_MEM_ERROR;
+			goto free_entries;
+		}
+		entries = more_entries;
+		entries[count].name = strdup(file->d_name);
+		if (NULL == entries[count].name) {
+			result = RESULT_MEM_ERROR;
+			goto free_entries;
+		}
+		entries[count].size = attributes.st_size;
+		entries[count].last_use = attributes.st_mtime;
+		total_size += attributes.st_size;
+		++count;
+	} while (1);
+
+	/* delete the least recently used packages first, until the cache is small
+	 * enough */
+	if (max_size < total_size) {
+		qsort(entries,
+		      count,
+		      sizeof(cache_entry_t),
+		      (int (*)(const void *, const void *)) _compare_entries);
+		for (i = 0; (count > i) && (max_size < total_size); ++i) {
+			(void) snprintf((char *) &path,
+			                sizeof(path),
+			                "%s/%s",
+			                cache->path,
+			                entries[i].name);
+			log_write(LOG_DEBUG, "Evicting %s from the package cache\n", path);
+			if (-1 == unlink((const char *) &path)) {
+				if (ENOENT != errno) {
+					goto free_entries;
+				}
+			}
+			total_size -= entries[i].size;
+		}
+	}
+
+	/* report success */
+	result = RESULT_OK;
+
+free_entries:
+	/* free the list of cached packages */
+	for (i = 0; count > i; ++i) {
+		free(entries[i].name);
+	}
+	if (NULL != entries) {
+		free(entries);
+	}
+
+	/* close the cache directory */
+	(void) closedir(directory);
+
+end:
+	return result;
+}
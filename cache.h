@@ -0,0 +1,116 @@
+#ifndef _CACHE_H_INCLUDED
+#	define _CACHE_H_INCLUDED
+
+#	include <stdint.h>
+#	include <sys/types.h>
+
+#	include "result.h"
+
+/*!
+ * @defgroup cache Cache
+ * @brief Local package cache
+ * @{ */
+
+/*!
+ * @def PACKAGE_CACHE_PATH
+ * @brief The package cache directory
+ *
+ * Unlike the rest of packdude's state, the package cache is not relative to the
+ * operation prefix, so it is shared by all prefixes. */
+#	define PACKAGE_CACHE_PATH VAR_DIR"/packdude/cache"
+
+/*!
+ * @def MAX_PACKAGE_CACHE_SIZE
+ * @brief The maximum size of the package cache, in bytes */
+#	define MAX_PACKAGE_CACHE_SIZE (512LL * 1024LL * 1024LL)
+
+/*!
+ * @def CACHE_ENTRY_NAME_FORMAT
+ * @brief The file name of a cached package: the package file name, followed by
+ *        the checksum in its header */
+#	define CACHE_ENTRY_NAME_FORMAT "%s-%08x"
+
+/*!
+ * @def CACHE_TEMPORARY_NAME_FORMAT
+ * @brief The file name of a package while it is being added to the cache */
+#	define CACHE_TEMPORARY_NAME_FORMAT ".%s-%08x.%ld"
+
+/*!
+ * @struct cache_t
+ * @brief A package cache */
+typedef struct {
+	const char *path; /*!< The cache directory */
+	off_t max_size; /*!< The maximum cache size, in bytes */
+} cache_t;
+
+/*!
+ * @struct cache_entry_t
+ * @brief A cached package, as seen by cache_prune() */
+typedef struct {
+	char *name; /*!< The file name */
+	off_t size; /*!< The file size */
+	time_t last_use; /*!< The last time the package was used */
+} cache_entry_t;
+
+/*!
+ * @fn result_t cache_open(cache_t *cache,
+ *                         const char *path,
+ *                         const off_t max_size)
+ * @brief Opens a package cache, creating it if needed
+ * @param cache The cache
+ * @param path The cache directory
+ * @param max_size The maximum cache size, in bytes */
+result_t cache_open(cache_t *cache, const char *path, const off_t max_size);
+
+/*!
+ * @fn result_t cache_get(cache_t *cache,
+ *                        const char *file_name,
+ *                        const uint32_t checksum,
+ *                        unsigned char **contents,
+ *                        size_t *size)
+ * @brief Maps a cached package to memory
+ * @param cache The cache
+ * @param file_name The package file name
+ * @param checksum The checksum in the package header
+ * @param contents The package contents
+ * @param size The package size
+ * @return \a RESULT_NOT_FOUND if the package is not cached
+ *
+ * The package contents should be unmapped using \a munmap(). */
+result_t cache_get(cache_t *cache,
+                   const char *file_name,
+                   const uint32_t checksum,
+                   unsigned char **contents,
+                   size_t *size);
+
+/*!
+ * @fn result_t cache_put(cache_t *cache,
+ *                        const char *file_name,
+ *                        const uint32_t checksum,
+ *                        const unsigned char *contents,
+ *                        const size_t size)
+ * @brief Adds a package to the cache, then evicts the least recently used
+ *        packages if the cache is too big
+ * @param cache The cache
+ * @param file_name The package file name
+ * @param checksum The checksum in the package header
+ * @param contents The package contents
+ * @param size The package size */
+result_t cache_put(cache_t *cache,
+                   const char *file_name,
+                   const uint32_t checksum,
+                   const unsigned char *contents,
+                   const size_t size);
+
+/*!
+ * @fn result_t cache_prune(cache_t *cache, const off_t max_size)
+ * @brief Evicts the least recently used packages, until the cache is small
+ *        enough
+ * @param cache The cache
+ * @param max_size The maximum cache size, in bytes */
+result_t cache_prune(cache_t *cache, const off_t max_size);
+
+/*!
+ * @} */
+
+#endif
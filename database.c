@@ -6,18 +6,145 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <errno.h>
 
 #include <sqlite3.h>
 
 #include "log.h"
+#include "version.h"
 #include "database.h"
 
+/* the metadata columns of all packages which are new or changed, compared to
+ * an attached older copy of a metadata database */
+#define CHANGED_PACKAGES_QUERY \
+	"SELECT name, version, desc, file_name, arch, deps FROM main.packages " \
+	"EXCEPT " \
+	"SELECT name, version, desc, file_name, arch, deps FROM old.packages"
+
+/* the name of an attached metadata database, in queries against an
+ * installation data database */
+#define METADATA_SCHEMA "repo"
+
+/* the maximum number of columns returned by a prepared statement */
+#define MAX_COLUMNS (INSTALLATION_DATA_FIELDS_COUNT)
+
+/* the bit which marks a prepared statement parameter as an integer */
+#define INTEGER_PARAMETER(index) (1U << (index))
+
+static result_t _run_query(database_t *database,
+                           const char *query,
+                           const query_callback_t callback,
+                           void *arg);
+
 static const char *g_initialization_queries[] = {
 	METADATA_DATABASE_CREATION_QUERY,
 	INSTALLATION_DATA_DATABASE_CREATION_QUERY
 };
 
+/* the queries which apply each durability profile */
+static const char *g_durability_queries[] = {
+	"PRAGMA journal_mode = DELETE;\n"
+	"PRAGMA synchronous = FULL;",
+
+	"PRAGMA journal_mode = WAL;\n"
+	"PRAGMA synchronous = NORMAL;",
+
+	"PRAGMA journal_mode = MEMORY;\n"
+	"PRAGMA synchronous = OFF;"
+};
+
+/* the query which creates the dependencies table and fills it, by splitting the
+ * dependencies list of each package */
+#define DEPENDENCIES_MIGRATION_QUERY \
+	"CREATE TABLE IF NOT EXISTS dependencies (package TEXT NOT NULL,\n" \
+	"                                         depends_on TEXT NOT NULL);\n" \
+	"CREATE INDEX IF NOT EXISTS dependencies_package " \
+	"ON dependencies (package);\n" \
+	"CREATE INDEX IF NOT EXISTS dependencies_depends_on " \
+	"ON dependencies (depends_on);\n" \
+	"INSERT INTO dependencies\n" \
+	"WITH RECURSIVE split(package, depends_on, rest) AS (\n" \
+	"    SELECT name, '', deps || ' ' FROM packages\n" \
+	"    WHERE '" NO_DEPENDENCIES "' != deps\n" \
+	"    UNION ALL\n" \
+	"    SELECT package,\n" \
+	"           substr(rest, 1, instr(rest, ' ') - 1),\n" \
+	"           substr(rest, instr(rest, ' ') + 1)\n" \
+	"    FROM split WHERE '' != rest)\n" \
+	"SELECT package, depends_on FROM split WHERE '' != depends_on;"
+
+/* the schema migrations of metadata databases: the query at index n upgrades
+ * the schema from version n to n + 1 */
+static const char *g_metadata_migrations[] = {
+	/* 1: list dependencies in a table */
+	DEPENDENCIES_MIGRATION_QUERY
+};
+
+/* the schema migrations of installation data databases */
+static const char *g_installation_data_migrations[] = {
+	/* 1: index the files table, so looking up a package's files or a file's
+	 * package does not scan the entire table */
+	"CREATE INDEX IF NOT EXISTS files_package ON files (package, id);\n"
+	"CREATE INDEX IF NOT EXISTS files_path ON files (path);",
+
+	/* 2: list dependencies in a table */
+	DEPENDENCIES_MIGRATION_QUERY,
+
+	/* 3: record the state of each file, so unchanged files are not rewritten
+	 * when a package is upgraded */
+	"ALTER TABLE files ADD COLUMN size INTEGER;\n"
+	"ALTER TABLE files ADD COLUMN mode INTEGER;\n"
+	"ALTER TABLE files ADD COLUMN digest INTEGER;",
+
+	/* 4: record the modification time of each file, so verification does not
+	 * read files which were not modified */
+	"ALTER TABLE files ADD COLUMN mtime INTEGER;"
+};
+
+static const struct {
+	const char **queries;
+	unsigned long count;
+} g_migrations[] = {
+	{
+		g_metadata_migrations,
+		sizeof(g_metadata_migrations) / sizeof(const char *)
+	},
+	{
+		g_installation_data_migrations,
+		sizeof(g_installation_data_migrations) / sizeof(const char *)
+	}
+};
+
+static const char *g_statement_queries[] = {
+	"SELECT * FROM packages WHERE name = ? LIMIT 1",
+	"SELECT 1 FROM packages WHERE name = ? LIMIT 1",
+	"SELECT * FROM packages",
+	"INSERT INTO packages VALUES (?, ?, ?, ?, ?, ?, NULL)",
+	"INSERT INTO packages VALUES (?, ?, ?, ?, ?, ?, ?, NULL)",
+	"DELETE FROM packages WHERE name = ?",
+	"INSERT INTO files VALUES (?, ?, NULL, ?, ?, ?, ?)",
+	"SELECT * FROM files WHERE package = ? ORDER BY id DESC",
+	"INSERT INTO dependencies VALUES (?, ?)",
+	"DELETE FROM dependencies WHERE package = ?",
+	"SELECT depends_on FROM dependencies WHERE package = ?",
+	"SELECT package FROM dependencies WHERE depends_on = ?",
+	"SELECT package, depends_on FROM dependencies",
+	"SELECT a.* FROM "METADATA_SCHEMA".packages a WHERE NOT EXISTS "
+	"(SELECT 1 FROM main.packages i WHERE i.name = a.name)",
+	"SELECT i.name, i.version, a.version FROM main.packages i "
+	"JOIN "METADATA_SCHEMA".packages a ON a.name = i.name "
+	"WHERE version_compare(a.version, i.version) > 0",
+	"SELECT i.* FROM main.packages i WHERE NOT EXISTS "
+	"(SELECT 1 FROM "METADATA_SCHEMA".packages a WHERE a.name = i.name)",
+	"SELECT p.* FROM packages p LEFT JOIN "
+	"(SELECT depends_on, COUNT(*) AS dependents FROM dependencies "
+	"WHERE package != depends_on GROUP BY depends_on) d "
+	"ON d.depends_on = p.name WHERE p.reason = ? AND d.dependents IS NULL",
+	"DELETE FROM files WHERE package = ?",
+	"SELECT 1 FROM files WHERE path = ? LIMIT 1"
+};
+
 void package_info_free(package_info_t *info) {
 	/* a loop index */
 	int i = INSTALLATION_DATA_FIELDS_COUNT - 1;
@@ -31,15 +158,48 @@ void package_info_free(package_info_t *info) {
 	}
 }
 
+static void _compare_versions(sqlite3_context *context,
+                              int count,
+                              sqlite3_value **values) {
+	/* the first version */
+	const unsigned char *a = NULL;
+
+	/* the second version */
+	const unsigned char *b = NULL;
+
+	assert(2 == count);
+
+	a = sqlite3_value_text(values[0]);
+	b = sqlite3_value_text(values[1]);
+	if ((NULL == a) || (NULL == b)) {
+		sqlite3_result_null(context);
+		return;
+	}
+
+	sqlite3_result_int(context,
+	                   version_compare((const char *) a, (const char *) b));
+}
+
 static result_t _open_database(database_t *database,
                                const char *path,
                                const int flags) {
 	/* the return value */
 	result_t result = RESULT_DATABASE_ERROR;
 
+	/* the tuning query */
+	char *query = NULL;
+
+	/* a loop index */
+	unsigned int i = 0;
+
 	assert(NULL != database);
 	assert(NULL != path);
 
+	/* statements are prepared on first use */
+	for ( ; STATEMENTS_COUNT > i; ++i) {
+		database->statements[i] = NULL;
+	}
+
 	/* open the database for reading */
 	if (SQLITE_OK != sqlite3_open_v2(path,
 	                                 &database->handle,
@@ -48,6 +208,39 @@ static result_t _open_database(database_t *database,
 		goto end;
 	}
 
+	/* let SQLite map the database to memory and cache more of it, instead of
+	 * reading the same pages repeatedly */
+	query = sqlite3_mprintf("PRAGMA mmap_size = %d;\n"
+	                        "PRAGMA cache_size = -%d;",
+	                        DATABASE_MMAP_SIZE,
+	                        DATABASE_CACHE_SIZE);
+	if (NULL == query) {
+		(void) sqlite3_close(database->handle);
+		goto end;
+	}
+	result = _run_query(database, query, NULL, NULL);
+	sqlite3_free(query);
+	if (RESULT_OK != result) {
+		(void) sqlite3_close(database->handle);
+		goto end;
+	}
+
+	/* let queries compare package versions */
+	if (SQLITE_OK != sqlite3_create_function_v2(database->handle,
+	                                            "version_compare",
+	                                            2,
+	                                            SQLITE_UTF8 |
+	                                            SQLITE_DETERMINISTIC,
+	                                            NULL,
+	                                            _compare_versions,
+	                                            NULL,
+	                                            NULL,
+	                                            NULL)) {
+		result = RESULT_DATABASE_ERROR;
+		(void) sqlite3_close(database->handle);
+		goto end;
+	}
+
 	/* report success */
 	result = RESULT_OK;
 
@@ -101,6 +294,250 @@ static result_t _run_query(database_t *database,
 	return result;
 }
 
+static sqlite3_stmt *_get_statement(database_t *database,
+                                    const statement_t id) {
+	/* the statement */
+	sqlite3_stmt *statement = NULL;
+
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(STATEMENTS_COUNT > id);
+
+	/* if the statement was prepared already, reuse it - unless it is in use by
+	 * a caller up the stack */
+	if (NULL != database->statements[id]) {
+		if (0 == sqlite3_stmt_busy(database->statements[id])) {
+			return database->statements[id];
+		}
+	}
+
+	log_write(LOG_DEBUG, "Preparing a SQL query: %s\n", g_statement_queries[id]);
+	if (SQLITE_OK != sqlite3_prepare_v2(database->handle,
+	                                    g_statement_queries[id],
+	                                    -1,
+	                                    &statement,
+	                                    NULL)) {
+		log_write(LOG_DEBUG,
+		          "An SQLite3 error occurred: %s\n",
+		          sqlite3_errmsg(database->handle));
+		return NULL;
+	}
+
+	/* cache the statement, unless the cached one is in use */
+	if (NULL == database->statements[id]) {
+		database->statements[id] = statement;
+	}
+
+	return statement;
+}
+
+static void _put_statement(database_t *database,
+                           const statement_t id,
+                           sqlite3_stmt *statement) {
+	assert(NULL != database);
+	assert(STATEMENTS_COUNT > id);
+	assert(NULL != statement);
+
+	/* if the statement is not cached, free it */
+	if (statement != database->statements[id]) {
+		(void) sqlite3_finalize(statement);
+		return;
+	}
+
+	/* otherwise, let it run again with other parameters */
+	(void) sqlite3_reset(statement);
+	(void) sqlite3_clear_bindings(statement);
+}
+
+static result_t _run_prepared(database_t *database,
+                              const statement_t id,
+                              const query_callback_t callback,
+                              void *arg,
+                              const int count,
+                              const unsigned int integers,
+                              ...) {
+	/* the statement parameters */
+	va_list parameters;
+
+	/* the values of a returned row */
+	char *values[MAX_COLUMNS] = {NULL};
+
+	/* the column names */
+	char *names[MAX_COLUMNS] = {NULL};
+
+	/* the statement */
+	sqlite3_stmt *statement = NULL;
+
+	/* the number of columns */
+	int columns = 0;
+
+	/* the result of binding a parameter */
+	int bound = SQLITE_OK;
+
+	/* a loop index */
+	int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_DATABASE_ERROR;
+
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(STATEMENTS_COUNT > id);
+	assert((sizeof(integers) * 8) >= count);
+
+	/* get the prepared statement */
+	statement = _get_statement(database, id);
+	if (NULL == statement) {
+		goto end;
+	}
+
+	/* bind the parameters; integers are bound as such, so they are not
+	 * formatted and parsed again */
+	va_start(parameters, integers);
+	for (i = 0; count > i; ++i) {
+		if (0 != (INTEGER_PARAMETER(i) & integers)) {
+			bound = sqlite3_bind_int64(statement,
+			                           1 + i,
+			                           va_arg(parameters, sqlite3_int64));
+		} else {
+			bound = sqlite3_bind_text(statement,
+			                          1 + i,
+			                          va_arg(parameters, const char *),
+			                          -1,
+			                          SQLITE_STATIC);
+		}
+		if (SQLITE_OK != bound) {
+			va_end(parameters);
+			goto put_statement;
+		}
+	}
+	va_end(parameters);
+
+	/* run the statement */
+	log_write(LOG_DEBUG, "Running a SQL query: %s\n", g_statement_queries[id]);
+	columns = sqlite3_column_count(statement);
+	assert(MAX_COLUMNS >= columns);
+	do {
+		switch (sqlite3_step(statement)) {
+			case SQLITE_DONE:
+				result = RESULT_OK;
+				goto put_statement;
+
+			case SQLITE_ROW:
+				break;
+
+			default:
+				log_write(LOG_DEBUG,
+				          "An SQLite3 error occurred: %s\n",
+				          sqlite3_errmsg(database->handle));
+				goto put_statement;
+		}
+
+		if (NULL == callback) {
+			continue;
+		}
+
+		/* pass the row to the callback */
+		for (i = 0; columns > i; ++i) {
+			values[i] = (char *) sqlite3_column_text(statement, i);
+			names[i] = (char *) sqlite3_column_name(statement, i);
+		}
+		if (0 != callback(arg, columns, (char **) &values, (char **) &names)) {
+			log_write(LOG_DEBUG, "The SQL query has been aborted\n");
+			result = RESULT_ABORTED;
+			goto put_statement;
+		}
+	} while (1);
+
+put_statement:
+	/* release the statement */
+	_put_statement(database, id, statement);
+
+end:
+	return result;
+}
+
+static int _copy_number(void *arg,
+                        int count,
+                        char **values,
+                        char **names) {
+	/* the end of the parsed number */
+	char *number_end = NULL;
+
+	assert(NULL != arg);
+	assert(1 == count);
+	assert(NULL != values);
+	assert(NULL != names);
+
+	if (NULL == values[0]) {
+		return 1;
+	}
+	*((unsigned long *) arg) = strtoul(values[0], &number_end, 10);
+	if ('\0' != *number_end) {
+		return 1;
+	}
+
+	return 0;
+}
+
+static result_t _migrate(database_t *database, const database_type_t type) {
+	/* the schema version */
+	unsigned long version = 0;
+
+	/* the return value */
+	result_t result = RESULT_DATABASE_ERROR;
+
+	/* the query which sets the schema version */
+	char *query = NULL;
+
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert((DATABASE_TYPE_METADATA == type) ||
+	       (DATABASE_TYPE_INSTALLATION_DATA == type));
+
+	/* get the schema version */
+	result = _run_query(database, "PRAGMA user_version", _copy_number, &version);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	if (g_migrations[type].count < version) {
+		log_write(LOG_ERROR,
+		          "The database schema (version %lu) is too new\n",
+		          version);
+		result = RESULT_INCOMPATIBLE;
+		goto end;
+	}
+
+	/* apply all missing migrations, each in its own transaction */
+	for ( ; g_migrations[type].count > version; ++version) {
+		log_write(LOG_DEBUG,
+		          "Upgrading the database schema to version %lu\n",
+		          1 + version);
+		query = sqlite3_mprintf("BEGIN TRANSACTION;\n"
+		                        "%s\n"
+		                        "PRAGMA user_version = %lu;\n"
+		                        "COMMIT;",
+		                        g_migrations[type].queries[version],
+		                        1 + version);
+		if (NULL == query) {
+			result = RESULT_MEM_ERROR;
+			goto end;
+		}
+		result = _run_query(database, query, NULL, NULL);
+		sqlite3_free(query);
+		if (RESULT_OK != result) {
+			database_rollback(database);
+			goto end;
+		}
+	}
+
+	/* report success */
+	result = RESULT_OK;
+
+end:
+	return result;
+}
+
 result_t database_open_write(database_t *database,
                              const database_type_t type,
                              const char *path) {
@@ -147,6 +584,14 @@ result_t database_open_write(database_t *database,
 		}
 	}
 
+	/* bring the schema up to date */
+	result = _migrate(database, type);
+	if (RESULT_OK != result) {
+		log_write(LOG_ERROR, "Failed to upgrade the database schema\n");
+		database_close(database);
+		goto end;
+	}
+
 	/* report success */
 	result = RESULT_OK;
 
@@ -154,9 +599,31 @@ end:
 	return result;
 }
 
+result_t database_set_durability(database_t *database,
+                                 const durability_t durability) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert((DURABILITY_SAFE == durability) ||
+	       (DURABILITY_BALANCED == durability) ||
+	       (DURABILITY_IMAGE_BUILD == durability));
+
+	return _run_query(database, g_durability_queries[durability], NULL, NULL);
+}
+
 void database_close(database_t *database) {
+	/* a loop index */
+	unsigned int i = 0;
+
 	assert(NULL != database);
 
+	/* free all prepared statements */
+	for ( ; STATEMENTS_COUNT > i; ++i) {
+		if (NULL != database->statements[i]) {
+			(void) sqlite3_finalize(database->statements[i]);
+			database->statements[i] = NULL;
+		}
+	}
+
 	/* close the database */
 	(void) sqlite3_close(database->handle);
 }
@@ -191,9 +658,6 @@ result_t database_get(database_t *database,
 	/* the return value */
 	result_t result = RESULT_DATABASE_ERROR;
 
-	/* the executed query */
-	char *query = NULL;
-
 	assert(NULL != database);
 	assert(NULL != database->handle);
 	assert(NULL != name);
@@ -201,126 +665,233 @@ result_t database_get(database_t *database,
 
 	log_write(LOG_DEBUG, "Searching the package database for %s\n", name);
 
-	/* format the query */
-	query = sqlite3_mprintf("SELECT * FROM packages WHERE name = '%q' LIMIT 1",
-	                        name);
-	if (NULL == query) {
-		goto end;
-	}
-
 	/* unset the package name name */
 	info->p_name = NULL;
 
 	/* run the query */
-	result = _run_query(database, query, _copy_info, info);
-	if (SQLITE_OK != result) {
-		goto free_query;
+	result = _run_prepared(database,
+	                       STATEMENT_GET_PACKAGE,
+	                       _copy_info,
+	                       info,
+	                       1,
+	                       0,
+	                       name);
+	if (RESULT_OK != result) {
+		goto end;
 	}
 
 	/* if the package was not found, report failure */
 	if (NULL == info->p_name) {
 		result = RESULT_NOT_FOUND;
-		goto free_query;
+		goto end;
 	}
 
 	/* report success */
 	result = RESULT_OK;
 
-free_query:
-	/* free the query */
-	sqlite3_free(query);
-
 end:
 	return result;
 }
 
-result_t database_set_installation_data(database_t *database,
-                                        const package_info_t *info) {
-	/* the return value */
-	result_t result = RESULT_CORRUPT_DATA;
+static int _mark_found(void *arg, int count, char **values, char **names) {
+	assert(NULL != arg);
 
-	/* the executed query */
-	char *query = NULL;
+	*((bool *) arg) = true;
+	return 0;
+}
+
+result_t database_contains(database_t *database, const char *name) {
+	/* a flag which indicates whether the package was found */
+	bool found = false;
+
+	/* the return value */
+	result_t result = RESULT_DATABASE_ERROR;
 
 	assert(NULL != database);
 	assert(NULL != database->handle);
+	assert(NULL != name);
+
+	/* run the query */
+	result = _run_prepared(database,
+	                       STATEMENT_FIND_PACKAGE,
+	                       _mark_found,
+	                       &found,
+	                       1,
+	                       0,
+	                       name);
+	if (RESULT_OK != result) {
+		return result;
+	}
+
+	if (true == found) {
+		return RESULT_YES;
+	}
+	return RESULT_NO;
+}
+
+static result_t _add_dependencies(database_t *database,
+                                  const package_info_t *info) {
+	/* the dependencies list */
+	char *dependencies = NULL;
+
+	/* strtok_r()'s position within the dependencies list */
+	char *position = NULL;
+
+	/* a single dependency */
+	char *dependency = NULL;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != database);
 	assert(NULL != info);
+	assert(NULL != info->p_name);
+	assert(NULL != info->p_deps);
 
-	/* format the query */
-	query = sqlite3_mprintf("INSERT INTO packages VALUES ('%q', '%q', '%q', " \
-	                        "'%q', '%q', '%q', '%q', NULL)",
-	                        info->p_name,
-	                        info->p_version,
-	                        info->p_desc,
-	                        info->p_file_name,
-	                        info->p_arch,
-	                        info->p_deps,
-	                        info->p_reason);
-	if (NULL == query) {
+	/* if the package has no dependencies, do nothing */
+	if (0 == strcmp(NO_DEPENDENCIES, info->p_deps)) {
 		goto end;
 	}
 
-	/* run the query */
-	result = _run_query(database, query, NULL, NULL);
-	if (SQLITE_OK != result) {
-		goto free_query;
+	/* duplicate the dependencies list */
+	dependencies = strdup(info->p_deps);
+	if (NULL == dependencies) {
+		result = RESULT_MEM_ERROR;
+		goto end;
 	}
 
-	/* report success */
-	result = RESULT_OK;
+	/* add a row for each dependency */
+	for (dependency = strtok_r(dependencies, " ", &position);
+	     NULL != dependency;
+	     dependency = strtok_r(NULL, " ", &position)) {
+		result = _run_prepared(database,
+		                       STATEMENT_ADD_DEPENDENCY,
+		                       NULL,
+		                       NULL,
+		                       2,
+		                       0,
+		                       info->p_name,
+		                       dependency);
+		if (RESULT_OK != result) {
+			break;
+		}
+	}
 
-free_query:
-	/* free the query */
-	sqlite3_free(query);
+	/* free the dependencies list */
+	free(dependencies);
 
 end:
 	return result;
 }
 
-result_t database_set_metadata(database_t *database,
-                               const package_info_t *info) {
+static result_t _remove_package(database_t *database, const char *package) {
 	/* the return value */
-	result_t result = RESULT_CORRUPT_DATA;
+	result_t result = RESULT_DATABASE_ERROR;
 
-	/* the executed query */
-	char *query = NULL;
+	assert(NULL != database);
+	assert(NULL != package);
+
+	result = _run_prepared(database,
+	                       STATEMENT_REMOVE_DEPENDENCIES,
+	                       NULL,
+	                       NULL,
+	                       1,
+	                       0,
+	                       package);
+	if (RESULT_OK != result) {
+		return result;
+	}
+
+	return _run_prepared(database,
+	                     STATEMENT_REMOVE_PACKAGE,
+	                     NULL,
+	                     NULL,
+	                     1,
+	                     0,
+	                     package);
+}
+
+result_t database_set_installation_data(database_t *database,
+                                        const package_info_t *info) {
+	/* the return value */
+	result_t result = RESULT_DATABASE_ERROR;
 
 	assert(NULL != database);
 	assert(NULL != database->handle);
 	assert(NULL != info);
 
-	/* format the query */
-	query = sqlite3_mprintf("INSERT INTO packages VALUES ('%q', '%q', '%q', " \
-	                        "'%q', '%q', '%q', NULL)",
-	                        info->p_name,
-	                        info->p_version,
-	                        info->p_desc,
-	                        info->p_file_name,
-	                        info->p_arch,
-	                        info->p_deps);
-	if (NULL == query) {
-		goto end;
+	result = _run_prepared(database,
+	                       STATEMENT_ADD_INSTALLATION_DATA,
+	                       NULL,
+	                       NULL,
+	                       INSTALLATION_DATA_FIELDS_COUNT - PRIVATE_FIELDS_COUNT,
+	                       0,
+	                       info->p_name,
+	                       info->p_version,
+	                       info->p_desc,
+	                       info->p_file_name,
+	                       info->p_arch,
+	                       info->p_deps,
+	                       info->p_reason);
+	if (RESULT_OK != result) {
+		return result;
 	}
 
-	/* run the query */
-	result = _run_query(database, query, NULL, NULL);
-	if (SQLITE_OK != result) {
-		goto free_query;
+	return _add_dependencies(database, info);
+}
+
+result_t database_set_metadata(database_t *database,
+                               const package_info_t *info) {
+	/* the return value */
+	result_t result = RESULT_DATABASE_ERROR;
+
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != info);
+
+	result = _run_prepared(database,
+	                       STATEMENT_ADD_METADATA,
+	                       NULL,
+	                       NULL,
+	                       METADATA_FIELDS_COUNT - PRIVATE_FIELDS_COUNT,
+	                       0,
+	                       info->p_name,
+	                       info->p_version,
+	                       info->p_desc,
+	                       info->p_file_name,
+	                       info->p_arch,
+	                       info->p_deps);
+	if (RESULT_OK != result) {
+		return result;
 	}
 
-	/* report success */
-	result = RESULT_OK;
+	return _add_dependencies(database, info);
+}
 
-free_query:
-	/* free the query */
-	sqlite3_free(query);
+result_t database_remove_metadata(database_t *database, const char *package) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != package);
 
-end:
-	return result;
+	log_write(LOG_DEBUG, "Removing %s\n", package);
+
+	return _remove_package(database, package);
 }
 
-result_t database_remove_installation_data(database_t *database,
-                                           const char *package) {
+result_t database_get_generation(database_t *database,
+                                 unsigned long *generation) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != generation);
+
+	return _run_query(database,
+	                  "SELECT number FROM generation LIMIT 1",
+	                  _copy_number,
+	                  generation);
+}
+
+result_t database_set_generation(database_t *database,
+                                 const unsigned long generation) {
 	/* the return value */
 	result_t result = RESULT_CORRUPT_DATA;
 
@@ -329,13 +900,9 @@ result_t database_remove_installation_data(database_t *database,
 
 	assert(NULL != database);
 	assert(NULL != database->handle);
-	assert(NULL != package);
-
-	log_write(LOG_INFO, "Unregistering %s\n", package);
 
 	/* format the query */
-	query = sqlite3_mprintf("DELETE FROM packages WHERE name = '%q'",
-	                        package);
+	query = sqlite3_mprintf("UPDATE generation SET number = %lu", generation);
 	if (NULL == query) {
 		goto end;
 	}
@@ -357,9 +924,11 @@ end:
 	return result;
 }
 
-result_t database_register_path(database_t *database,
-                                const char *path,
-                                const char *package) {
+result_t database_for_each_change(database_t *database,
+                                  const char *path,
+                                  const query_callback_t removed,
+                                  const query_callback_t added,
+                                  void *arg) {
 	/* the return value */
 	result_t result = RESULT_CORRUPT_DATA;
 
@@ -369,26 +938,40 @@ result_t database_register_path(database_t *database,
 	assert(NULL != database);
 	assert(NULL != database->handle);
 	assert(NULL != path);
-	assert(NULL != package);
-
-	log_write(LOG_DEBUG, "Registering %s (%s)\n", path, package);
+	assert(NULL != removed);
+	assert(NULL != added);
 
-	/* format the query */
-	query = sqlite3_mprintf("INSERT INTO files VALUES ('%q', '%q', NULL)",
-	                        package,
-	                        path);
+	/* attach the older copy */
+	query = sqlite3_mprintf("ATTACH DATABASE '%q' AS old", path);
 	if (NULL == query) {
 		goto end;
 	}
-
-	/* run the query */
 	result = _run_query(database, query, NULL, NULL);
 	if (SQLITE_OK != result) {
 		goto free_query;
 	}
 
-	/* report success */
-	result = RESULT_OK;
+	/* list removed or changed packages, then their new entries */
+	result = _run_query(database,
+	                    "SELECT name FROM old.packages " \
+	                    "WHERE name NOT IN " \
+	                    "(SELECT name FROM main.packages) " \
+	                    "UNION " \
+	                    "SELECT name FROM " \
+	                    "(" CHANGED_PACKAGES_QUERY ") " \
+	                    "WHERE name IN (SELECT name FROM old.packages)",
+	                    removed,
+	                    arg);
+	if (SQLITE_OK != result) {
+		goto detach;
+	}
+	result = _run_query(database, CHANGED_PACKAGES_QUERY, added, arg);
+
+detach:
+	/* detach the older copy */
+	if (RESULT_OK != _run_query(database, "DETACH DATABASE old", NULL, NULL)) {
+		result = RESULT_DATABASE_ERROR;
+	}
 
 free_query:
 	/* free the query */
@@ -398,40 +981,67 @@ end:
 	return result;
 }
 
-result_t database_unregister_path(database_t *database, const char *path) {
-	/* the return value */
-	result_t result = RESULT_CORRUPT_DATA;
+result_t database_begin(database_t *database) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
 
-	/* the executed query */
-	char *query = NULL;
+	return _run_query(database, "BEGIN TRANSACTION", NULL, NULL);
+}
 
+result_t database_commit(database_t *database) {
 	assert(NULL != database);
 	assert(NULL != database->handle);
-	assert(NULL != path);
 
-	log_write(LOG_DEBUG, "Unregistering %s\n", path);
+	return _run_query(database, "COMMIT", NULL, NULL);
+}
 
-	/* format the query */
-	query = sqlite3_mprintf("DELETE FROM files WHERE path = '%q'", path);
-	if (NULL == query) {
-		goto end;
-	}
+void database_rollback(database_t *database) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
 
-	/* run the query */
-	result = _run_query(database, query, NULL, NULL);
-	if (SQLITE_OK != result) {
-		goto free_query;
-	}
+	(void) _run_query(database, "ROLLBACK", NULL, NULL);
+}
 
-	/* report success */
-	result = RESULT_OK;
+result_t database_remove_installation_data(database_t *database,
+                                           const char *package) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != package);
 
-free_query:
-	/* free the query */
-	sqlite3_free(query);
+	log_write(LOG_INFO, "Unregistering %s\n", package);
 
-end:
-	return result;
+	return _remove_package(database, package);
+}
+
+result_t database_register_path(database_t *database,
+                                const char *path,
+                                const char *package,
+                                const off_t size,
+                                const mode_t mode,
+                                const uint32_t digest,
+                                const time_t mtime) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != path);
+	assert(NULL != package);
+
+	log_write(LOG_DEBUG, "Registering %s (%s)\n", path, package);
+
+	return _run_prepared(database,
+	                     STATEMENT_REGISTER_PATH,
+	                     NULL,
+	                     NULL,
+	                     6,
+	                     INTEGER_PARAMETER(2) |
+	                     INTEGER_PARAMETER(3) |
+	                     INTEGER_PARAMETER(4) |
+	                     INTEGER_PARAMETER(5),
+	                     package,
+	                     path,
+	                     (sqlite3_int64) size,
+	                     (sqlite3_int64) mode,
+	                     (sqlite3_int64) digest,
+	                     (sqlite3_int64) mtime);
 }
 
 result_t database_for_each_inst_package(database_t *database,
@@ -442,45 +1052,214 @@ result_t database_for_each_inst_package(database_t *database,
 	assert(NULL != callback);
 
 	/* run the query */
-	return _run_query(database, "SELECT * from packages", callback, arg);
+	return _run_prepared(database,
+	                     STATEMENT_LIST_PACKAGES,
+	                     callback,
+	                     arg,
+	                     0,
+	                     0);
 }
 
 result_t database_for_each_file(database_t *database,
                                 const char *name,
                                 const query_callback_t callback,
                                 void *arg) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != name);
+	assert(NULL != callback);
+
+	/* run the query */
+	return _run_prepared(database,
+	                     STATEMENT_LIST_FILES,
+	                     callback,
+	                     arg,
+	                     1,
+	                     0,
+	                     name);
+}
+
+result_t database_for_each_dependency(database_t *database,
+                                      const char *name,
+                                      const query_callback_t callback,
+                                      void *arg) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != name);
+	assert(NULL != callback);
+
+	return _run_prepared(database,
+	                     STATEMENT_LIST_DEPENDENCIES,
+	                     callback,
+	                     arg,
+	                     1,
+	                     0,
+	                     name);
+}
+
+result_t database_for_each_dependent(database_t *database,
+                                     const char *name,
+                                     const query_callback_t callback,
+                                     void *arg) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != name);
+	assert(NULL != callback);
+
+	return _run_prepared(database,
+	                     STATEMENT_LIST_DEPENDENTS,
+	                     callback,
+	                     arg,
+	                     1,
+	                     0,
+	                     name);
+}
+
+result_t database_unregister_files(database_t *database, const char *package) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != package);
+
+	return _run_prepared(database,
+	                     STATEMENT_UNREGISTER_FILES,
+	                     NULL,
+	                     NULL,
+	                     1,
+	                     0,
+	                     package);
+}
+
+result_t database_owns_path(database_t *database, const char *path) {
+	/* a flag which indicates whether the path was found */
+	bool found = false;
+
 	/* the return value */
-	result_t result = RESULT_CORRUPT_DATA;
+	result_t result = RESULT_DATABASE_ERROR;
 
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != path);
+
+	result = _run_prepared(database,
+	                       STATEMENT_FIND_PATH,
+	                       _mark_found,
+	                       &found,
+	                       1,
+	                       0,
+	                       path);
+	if (RESULT_OK != result) {
+		return result;
+	}
+
+	return (true == found) ? RESULT_YES : RESULT_NO;
+}
+
+result_t database_for_each_leaf_package(database_t *database,
+                                        const char *reason,
+                                        const query_callback_t callback,
+                                        void *arg) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != reason);
+	assert(NULL != callback);
+
+	return _run_prepared(database,
+	                     STATEMENT_LIST_LEAVES,
+	                     callback,
+	                     arg,
+	                     1,
+	                     0,
+	                     reason);
+}
+
+result_t database_for_each_dependency_pair(database_t *database,
+                                           const query_callback_t callback,
+                                           void *arg) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != callback);
+
+	return _run_prepared(database,
+	                     STATEMENT_LIST_ALL_DEPENDENCIES,
+	                     callback,
+	                     arg,
+	                     0,
+	                     0);
+}
+
+result_t database_attach_metadata(database_t *database, database_t *metadata) {
 	/* the executed query */
 	char *query = NULL;
 
+	/* the metadata database path */
+	const char *path = NULL;
+
+	/* the return value */
+	result_t result = RESULT_DATABASE_ERROR;
+
 	assert(NULL != database);
 	assert(NULL != database->handle);
-	assert(NULL != name);
-	assert(NULL != callback);
+	assert(NULL != metadata);
+	assert(NULL != metadata->handle);
 
-	/* format the query */
-	query = sqlite3_mprintf(
-	                "SELECT * from files WHERE package = '%q' ORDER BY id DESC",
-	                name);
-	if (NULL == query) {
+	path = sqlite3_db_filename(metadata->handle, "main");
+	if (NULL == path) {
 		goto end;
 	}
 
-	/* run the query */
-	result = _run_query(database, query, callback, arg);
-	if (SQLITE_OK != result) {
-		goto free_query;
+	query = sqlite3_mprintf("ATTACH DATABASE '%q' AS "METADATA_SCHEMA, path);
+	if (NULL == query) {
+		result = RESULT_MEM_ERROR;
+		goto end;
 	}
-
-	/* report success */
-	result = RESULT_OK;
-
-free_query:
-	/* free the query */
+	result = _run_query(database, query, NULL, NULL);
 	sqlite3_free(query);
 
 end:
 	return result;
 }
+
+result_t database_for_each_uninstalled_package(database_t *database,
+                                               const query_callback_t callback,
+                                               void *arg) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != callback);
+
+	return _run_prepared(database,
+	                     STATEMENT_LIST_UNINSTALLED,
+	                     callback,
+	                     arg,
+	                     0,
+	                     0);
+}
+
+result_t database_for_each_upgradable_package(database_t *database,
+                                              const query_callback_t callback,
+                                              void *arg) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != callback);
+
+	return _run_prepared(database,
+	                     STATEMENT_LIST_UPGRADABLE,
+	                     callback,
+	                     arg,
+	                     0,
+	                     0);
+}
+
+result_t database_for_each_orphaned_package(database_t *database,
+                                            const query_callback_t callback,
+                                            void *arg) {
+	assert(NULL != database);
+	assert(NULL != database->handle);
+	assert(NULL != callback);
+
+	return _run_prepared(database,
+	                     STATEMENT_LIST_ORPHANED,
+	                     callback,
+	                     arg,
+	                     0,
+	                     0);
+}
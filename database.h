@@ -1,6 +1,8 @@
 #ifndef _DATABASE_H_INCLUDED
 #	define _DATABASE_H_INCLUDED
 
+#	include <sys/types.h>
+#	include <stdint.h>
 #	include <sqlite3.h>
 
 #	include "result.h"
@@ -22,11 +24,16 @@
 	"                       arch TEXT NOT NULL,\n" \
 	"                       deps TEXT NOT NULL,\n" \
 	"                       id INTEGER PRIMARY KEY);\n" \
+	"CREATE TABLE generation (number INTEGER NOT NULL);\n" \
+	"INSERT INTO generation VALUES (0);\n" \
 	"COMMIT;"
 
 /*!
  * @def INSTALLATION_DATA_DATABASE_CREATION_QUERY
- * @brief The SQL query used to initialize a installation data database */
+ * @brief The SQL query used to initialize a installation data database
+ *
+ * Once created, the schema is brought up to date by the same migrations which
+ * upgrade existing databases. */
 #	define INSTALLATION_DATA_DATABASE_CREATION_QUERY \
 	"BEGIN TRANSACTION;\n" \
 	"CREATE TABLE packages (name TEXT UNIQUE NOT NULL,\n" \
@@ -42,6 +49,11 @@
 	"                    id INTEGER PRIMARY KEY);\n" \
 	"COMMIT;"
 
+/*!
+ * @def NO_DEPENDENCIES
+ * @brief The contents of an empty dependencies list */
+#	define NO_DEPENDENCIES "-"
+
 /*!
  * @def MAX_SQL_QUERY_LENGTH
  * @brief The maximum length of a SQL query */
@@ -60,13 +72,41 @@
 /*!
  * @def FILE_FIELDS_COUNT
  * @brief The number of fields in the installed files table */
-#	define FILE_FIELDS_COUNT (3)
+#	define FILE_FIELDS_COUNT (7)
 
 /*!
  * @def PRIVATE_FIELDS_COUNT
  * @brief The number fields used internally by the package manager */
 #	define PRIVATE_FIELDS_COUNT (1)
 
+/*!
+ * @def DATABASE_MMAP_SIZE
+ * @brief The maximum number of database bytes accessed through memory mapping
+ *        instead of reading */
+#	define DATABASE_MMAP_SIZE (64 * 1024 * 1024)
+
+/*!
+ * @def DATABASE_CACHE_SIZE
+ * @brief The maximum size of the page cache of each database, in kilobytes */
+#	define DATABASE_CACHE_SIZE (8 * 1024)
+
+/*!
+ * @typedef durability_t
+ * @brief A trade-off between the durability of changes to a database and the
+ *        speed of writing them */
+typedef unsigned int durability_t;
+
+enum durability_profiles {
+	DURABILITY_SAFE        = 0, /*!< Sync each transaction (the default) */
+	DURABILITY_BALANCED    = 1, /*!< Write-ahead logging: a power loss may
+	                             * undo the last transactions, but never
+	                             * corrupts the database; readers are not
+	                             * blocked by writers */
+	DURABILITY_IMAGE_BUILD = 2  /*!< Never sync; a crash may corrupt the
+	                             * database, so this is suitable only for
+	                             * throwaway file systems */
+};
+
 /*!
  * @typedef database_type_t
  * @brief A database type */
@@ -91,7 +131,50 @@ enum package_fields {
 enum file_fields {
 	FILE_FIELD_PACKAGE = 0,
 	FILE_FIELD_PATH    = 1,
-	FILE_FIELD_ID      = 2
+	FILE_FIELD_ID      = 2,
+	FILE_FIELD_SIZE    = 3,
+	FILE_FIELD_MODE    = 4,
+	FILE_FIELD_DIGEST  = 5,
+	FILE_FIELD_MTIME   = 6
+};
+
+enum upgrade_fields {
+	UPGRADE_FIELD_NAME              = 0,
+	UPGRADE_FIELD_INSTALLED_VERSION = 1,
+	UPGRADE_FIELD_AVAILABLE_VERSION = 2
+};
+
+enum dependency_fields {
+	DEPENDENCY_FIELD_PACKAGE    = 0,
+	DEPENDENCY_FIELD_DEPENDS_ON = 1
+};
+
+/*!
+ * @typedef statement_t
+ * @brief A prepared statement, cached by a database */
+typedef unsigned int statement_t;
+
+enum statements {
+	STATEMENT_GET_PACKAGE           = 0,
+	STATEMENT_FIND_PACKAGE          = 1,
+	STATEMENT_LIST_PACKAGES         = 2,
+	STATEMENT_ADD_METADATA          = 3,
+	STATEMENT_ADD_INSTALLATION_DATA = 4,
+	STATEMENT_REMOVE_PACKAGE        = 5,
+	STATEMENT_REGISTER_PATH         = 6,
+	STATEMENT_LIST_FILES            = 7,
+	STATEMENT_ADD_DEPENDENCY        = 8,
+	STATEMENT_REMOVE_DEPENDENCIES   = 9,
+	STATEMENT_LIST_DEPENDENCIES     = 10,
+	STATEMENT_LIST_DEPENDENTS       = 11,
+	STATEMENT_LIST_ALL_DEPENDENCIES = 12,
+	STATEMENT_LIST_UNINSTALLED      = 13,
+	STATEMENT_LIST_UPGRADABLE       = 14,
+	STATEMENT_LIST_ORPHANED         = 15,
+	STATEMENT_LIST_LEAVES           = 16,
+	STATEMENT_UNREGISTER_FILES      = 17,
+	STATEMENT_FIND_PATH             = 18,
+	STATEMENTS_COUNT                = 19
 };
 
 /*!
@@ -115,6 +198,8 @@ typedef struct {
  * @brief A database */
 typedef struct {
 	sqlite3 *handle; /*!< A \a SQLite3 handle */
+	sqlite3_stmt *statements[STATEMENTS_COUNT]; /*!< Prepared statements,
+	                                             * created on first use */
 } database_t;
 
 /*!
@@ -143,11 +228,26 @@ result_t database_open_read(database_t *database, const char *path);
  * @param path The database path
  * @see DATABASE_TYPE_METADATA
  * @see DATABASE_TYPE_INSTALLATION_DATA
- * @see database_close */
+ * @see database_close
+ *
+ * If the database schema is outdated, it is upgraded in place; its version is
+ * stored in \a PRAGMA \a user_version. */
 result_t database_open_write(database_t *database,
                              const database_type_t type,
                              const char *path);
 
+/*!
+ * @fn result_t database_set_durability(database_t *database,
+ *                                      const durability_t durability)
+ * @brief Sets the durability profile of a writable database
+ * @param database The database
+ * @param durability The durability profile
+ *
+ * The journaling mode of a database persists, so the profile should be set
+ * each time the database is opened. */
+result_t database_set_durability(database_t *database,
+                                 const durability_t durability);
+
 /*!
  * @fn void database_close(database_t *database)
  * @brief Disconnects from a database
@@ -169,6 +269,16 @@ result_t database_get(database_t *database,
                       const char *name,
                       package_info_t *info);
 
+/*!
+ * @fn result_t database_contains(database_t *database, const char *name)
+ * @brief Determines whether a database contains a package entry
+ * @param database The database
+ * @param name The package name
+ * @return \a RESULT_YES or \a RESULT_NO, unless an error occurs
+ *
+ * Unlike database_get(), this function does not copy the package entry. */
+result_t database_contains(database_t *database, const char *name);
+
 /*!
  * @def database_get_metadata
  * @brief Currently, a synonym for database_get. */
@@ -190,16 +300,100 @@ void package_info_free(package_info_t *info);
  *                                    const package_info_t *info)
  * @brief Adds a package metadata entry to a database
  * @param database The database
- * @param info The package entry */
+ * @param info The package entry
+ *
+ * The package dependencies are added to the dependencies table as well. */
 result_t database_set_metadata(database_t *database,
                                const package_info_t *info);
 
+/*!
+ * @fn result_t database_remove_metadata(database_t *database,
+ *                                       const char *package)
+ * @brief Removes a package metadata entry from a database
+ * @param database The database
+ * @param package The package name */
+result_t database_remove_metadata(database_t *database, const char *package);
+
+/*!
+ * @fn result_t database_get_generation(database_t *database,
+ *                                      unsigned long *generation)
+ * @brief Fetches the generation of a metadata database
+ * @param database The database
+ * @param generation The generation
+ * @see database_set_generation
+ *
+ * Each time a repository's metadata database is published, its generation is
+ * incremented. Databases created by older versions of packdude have no
+ * generation. */
+result_t database_get_generation(database_t *database,
+                                 unsigned long *generation);
+
+/*!
+ * @fn result_t database_set_generation(database_t *database,
+ *                                      const unsigned long generation)
+ * @brief Sets the generation of a metadata database
+ * @param database The database
+ * @param generation The generation
+ * @see database_get_generation */
+result_t database_set_generation(database_t *database,
+                                 const unsigned long generation);
+
+/*!
+ * @fn result_t database_for_each_change(database_t *database,
+ *                                       const char *path,
+ *                                       const query_callback_t removed,
+ *                                       const query_callback_t added,
+ *                                       void *arg)
+ * @brief Runs a callback for each difference between an older copy of a
+ *        metadata database and a database
+ * @param database The database
+ * @param path The path of the older copy
+ * @param removed The callback to run for each removed or changed package name
+ * @param added The callback to run for each added or changed package entry,
+ *              without its private fields
+ * @param arg A pointer passed to the callbacks
+ *
+ * All removals are reported before all additions, so the changes can be
+ * applied in the same order. */
+result_t database_for_each_change(database_t *database,
+                                  const char *path,
+                                  const query_callback_t removed,
+                                  const query_callback_t added,
+                                  void *arg);
+
+/*!
+ * @fn result_t database_begin(database_t *database)
+ * @brief Starts a transaction
+ * @param database The database
+ * @see database_commit
+ * @see database_rollback
+ *
+ * Changes made within a transaction are written to disk once, when it is
+ * committed; otherwise, each change is written and synced separately. */
+result_t database_begin(database_t *database);
+
+/*!
+ * @fn result_t database_commit(database_t *database)
+ * @brief Ends a transaction and applies its changes
+ * @param database The database
+ * @see database_begin */
+result_t database_commit(database_t *database);
+
+/*!
+ * @fn void database_rollback(database_t *database)
+ * @brief Ends a transaction and discards its changes
+ * @param database The database
+ * @see database_begin */
+void database_rollback(database_t *database);
+
 /*!
  * @fn result_t database_set_installation_data(database_t *database,
  *                                             const package_info_t *info)
  * @brief Adds a package installation data entry to a database
  * @param database The database
- * @param info The package entry */
+ * @param info The package entry
+ *
+ * The package dependencies are added to the dependencies table as well. */
 result_t database_set_installation_data(database_t *database,
                                         const package_info_t *info);
 
@@ -215,22 +409,26 @@ result_t database_remove_installation_data(database_t *database,
 /*!
  * @fn result_t database_register_path(database_t *database,
  *                                     const char *path,
- *                                     const char *package)
+ *                                     const char *package,
+ *                                     const off_t size,
+ *                                     const mode_t mode,
+ *                                     const uint32_t digest,
+ *                                     const time_t mtime)
  * @brief Associates a file with an installed package
  * @param database The database
  * @param path The file path
- * @param package The package name */
+ * @param package The package name
+ * @param size The file size
+ * @param mode The file type and permissions
+ * @param digest A CRC32 checksum of the file contents
+ * @param mtime The file modification time, or 0 if unknown */
 result_t database_register_path(database_t *database,
                                 const char *path,
-                                const char *package);
-
-/*!
- * @fn result_t database_unregister_path(database_t *database, const char *path)
- * @brief Unassociates a file with an installed package
- * @param database The database
- * @param path The file path
- * @param package The package name */
-result_t database_unregister_path(database_t *database, const char *path);
+                                const char *package,
+                                const off_t size,
+                                const mode_t mode,
+                                const uint32_t digest,
+                                const time_t mtime);
 
 /*!
  * @fn result_t database_for_each_inst_package(database_t *database,
@@ -244,6 +442,62 @@ result_t database_for_each_inst_package(database_t *database,
                                         const query_callback_t callback,
                                         void *arg);
 
+/*!
+ * @fn result_t database_attach_metadata(database_t *database,
+ *                                       database_t *metadata)
+ * @brief Attaches a metadata database to an installation data database, so
+ *        both can be queried together
+ * @param database The installation data database
+ * @param metadata The metadata database
+ * @see database_for_each_uninstalled_package
+ * @see database_for_each_upgradable_package
+ * @see database_for_each_orphaned_package */
+result_t database_attach_metadata(database_t *database, database_t *metadata);
+
+/*!
+ * @fn result_t database_for_each_uninstalled_package(
+ *                                               database_t *database,
+ *                                               const query_callback_t callback,
+ *                                               void *arg)
+ * @brief Runs a callback for each package in the attached metadata database,
+ *        which is not installed
+ * @param database The installation data database
+ * @param callback The callback to run
+ * @param arg A pointer passed to the callback */
+result_t database_for_each_uninstalled_package(database_t *database,
+                                               const query_callback_t callback,
+                                               void *arg);
+
+/*!
+ * @fn result_t database_for_each_upgradable_package(
+ *                                               database_t *database,
+ *                                               const query_callback_t callback,
+ *                                               void *arg)
+ * @brief Runs a callback for each installed package, whose version in the
+ *        attached metadata database is newer
+ * @see version_compare
+ * @param database The installation data database
+ * @param callback The callback to run
+ * @param arg A pointer passed to the callback
+ * @see upgrade_fields */
+result_t database_for_each_upgradable_package(database_t *database,
+                                              const query_callback_t callback,
+                                              void *arg);
+
+/*!
+ * @fn result_t database_for_each_orphaned_package(
+ *                                               database_t *database,
+ *                                               const query_callback_t callback,
+ *                                               void *arg)
+ * @brief Runs a callback for each installed package, which is missing from
+ *        the attached metadata database
+ * @param database The installation data database
+ * @param callback The callback to run
+ * @param arg A pointer passed to the callback */
+result_t database_for_each_orphaned_package(database_t *database,
+                                            const query_callback_t callback,
+                                            void *arg);
+
 /*!
  * @def database_for_each_avail_package
  * @brief Currently, a synonym for database_for_each_inst_package. */
@@ -264,6 +518,82 @@ result_t database_for_each_file(database_t *database,
                                 const query_callback_t callback,
                                 void *arg);
 
+/*!
+ * @fn result_t database_for_each_dependency(database_t *database,
+ *                                           const char *name,
+ *                                           const query_callback_t callback,
+ *                                           void *arg)
+ * @brief Runs a callback for each dependency of a package
+ * @param database The database
+ * @param name The package name
+ * @param callback The callback to run
+ * @param arg A pointer passed to the callback */
+result_t database_for_each_dependency(database_t *database,
+                                      const char *name,
+                                      const query_callback_t callback,
+                                      void *arg);
+
+/*!
+ * @fn result_t database_for_each_dependent(database_t *database,
+ *                                          const char *name,
+ *                                          const query_callback_t callback,
+ *                                          void *arg)
+ * @brief Runs a callback for each package which depends on a package
+ * @param database The database
+ * @param name The package name
+ * @param callback The callback to run
+ * @param arg A pointer passed to the callback */
+result_t database_for_each_dependent(database_t *database,
+                                     const char *name,
+                                     const query_callback_t callback,
+                                     void *arg);
+
+/*!
+ * @fn result_t database_unregister_files(database_t *database,
+ *                                        const char *package)
+ * @brief Unregisters all files associated with a package
+ * @param database The database
+ * @param package The package name */
+result_t database_unregister_files(database_t *database, const char *package);
+
+/*!
+ * @fn result_t database_owns_path(database_t *database, const char *path)
+ * @brief Determines whether any installed package is associated with a path
+ * @param database The database
+ * @param path The path
+ * @return \a RESULT_YES or \a RESULT_NO, unless an error occurs */
+result_t database_owns_path(database_t *database, const char *path);
+
+/*!
+ * @fn result_t database_for_each_leaf_package(database_t *database,
+ *                                             const char *reason,
+ *                                             const query_callback_t callback,
+ *                                             void *arg)
+ * @brief Runs a callback for each installed package with a given installation
+ *        reason, which no other package depends on
+ * @param database The database
+ * @param reason The installation reason
+ * @param callback The callback to run
+ * @param arg A pointer passed to the callback */
+result_t database_for_each_leaf_package(database_t *database,
+                                        const char *reason,
+                                        const query_callback_t callback,
+                                        void *arg);
+
+/*!
+ * @fn result_t database_for_each_dependency_pair(
+ *                                               database_t *database,
+ *                                               const query_callback_t callback,
+ *                                               void *arg)
+ * @brief Runs a callback for each pair of a package and one of its
+ *        dependencies
+ * @param database The database
+ * @param callback The callback to run
+ * @param arg A pointer passed to the callback */
+result_t database_for_each_dependency_pair(database_t *database,
+                                           const query_callback_t callback,
+                                           void *arg);
+
 /*!
  * @} */
 
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "log.h"
+#include "delta.h"
+
+static int _write_removal(void *arg, int count, char **values, char **names) {
+	assert(NULL != arg);
+	assert(1 == count);
+	assert(NULL != values);
+	assert(NULL != names);
+
+	if (0 > fprintf((FILE *) arg, DELTA_REMOVAL",%s\n", values[0])) {
+		return 1;
+	}
+
+	return 0;
+}
+
+static int _write_addition(void *arg, int count, char **values, char **names) {
+	assert(NULL != arg);
+	assert((METADATA_FIELDS_COUNT - PRIVATE_FIELDS_COUNT) == count);
+	assert(NULL != values);
+	assert(NULL != names);
+
+	log_write(LOG_DEBUG, "%s has been added or changed\n", values[0]);
+	if (0 > fprintf((FILE *) arg,
+	                DELTA_ADDITION",%s,%s,%s,%s,%s,%s\n",
+	                values[PACKAGE_FIELD_NAME],
+	                values[PACKAGE_FIELD_VERSION],
+	                values[PACKAGE_FIELD_DESC],
+	                values[PACKAGE_FIELD_FILE_NAME],
+	                values[PACKAGE_FIELD_ARCH],
+	                values[PACKAGE_FIELD_DEPS])) {
+		return 1;
+	}
+
+	return 0;
+}
+
+result_t delta_write(database_t *database, const char *path, FILE *output) {
+	assert(NULL != database);
+	assert(NULL != path);
+	assert(NULL != output);
+
+	return database_for_each_change(database,
+	                                path,
+	                                _write_removal,
+	                                _write_addition,
+	                                output);
+}
+
+result_t delta_apply(database_t *database, char *contents) {
+	/* package metadata */
+	package_info_t info = {{0}};
+
+	/* the change type */
+	const char *type = NULL;
+
+	/* a delta line */
+	char *line = NULL;
+
+	/* strtok_r()'s position within the delta */
+	char *line_position = NULL;
+
+	/* strtok_r()'s position within the line */
+	char *position = NULL;
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != database);
+	assert(NULL != contents);
+
+	for (line = strtok_r(contents, "\n", &line_position);
+	     NULL != line;
+	     line = strtok_r(NULL, "\n", &line_position)) {
+		/* parse the change type and the package name */
+		type = strtok_r(line, ",", &position);
+		info.p_name = strtok_r(NULL, ",", &position);
+		if ((NULL == type) || (NULL == info.p_name)) {
+			return RESULT_CORRUPT_DATA;
+		}
+
+		if (0 == strcmp(DELTA_REMOVAL, type)) {
+			result = database_remove_metadata(database, info.p_name);
+		} else {
+			if (0 != strcmp(DELTA_ADDITION, type)) {
+				return RESULT_CORRUPT_DATA;
+			}
+
+			/* parse the rest of the package entry */
+			for (i = 1; (METADATA_FIELDS_COUNT - 1) > i; ++i) {
+				info._fields[i] = strtok_r(NULL, ",", &position);
+				if (NULL == info._fields[i]) {
+					return RESULT_CORRUPT_DATA;
+				}
+			}
+
+			log_write(LOG_DEBUG, "Updating %s\n", info.p_name);
+			result = database_set_metadata(database, &info);
+		}
+		if (RESULT_OK != result) {
+			break;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,73 @@
+#ifndef _DELTA_H_INCLUDED
+#	define _DELTA_H_INCLUDED
+
+#	include <stdio.h>
+
+#	include "result.h"
+#	include "database.h"
+
+/*!
+ * @defgroup delta Delta
+ * @brief Incremental updates of repository metadata databases
+ * @{ */
+
+/*!
+ * @def DELTA_FILE_NAME_FORMAT
+ * @brief The file name of the changes which turn a metadata database of the
+ *        previous generation into one of a given generation */
+#	define DELTA_FILE_NAME_FORMAT "repo-%lu.delta"
+
+/*!
+ * @def DELTA_INDEX_FILE_NAME
+ * @brief The file name of the list of deltas published by a repository
+ * @see DELTA_INDEX_FORMAT */
+#	define DELTA_INDEX_FILE_NAME "repo.deltas"
+
+/*!
+ * @def DELTA_INDEX_FORMAT
+ * @brief The format of the list of deltas: the generation of the metadata
+ *        database, followed by the generation of the oldest delta */
+#	define DELTA_INDEX_FORMAT "%lu %lu\n"
+
+/*!
+ * @def MAX_DELTAS
+ * @brief The maximum number of deltas kept by a repository */
+#	define MAX_DELTAS (64)
+
+/*!
+ * @def DELTA_REMOVAL
+ * @brief The first field of a delta line which removes a package */
+#	define DELTA_REMOVAL "-"
+
+/*!
+ * @def DELTA_ADDITION
+ * @brief The first field of a delta line which adds a package */
+#	define DELTA_ADDITION "+"
+
+/*!
+ * @fn result_t delta_write(database_t *database,
+ *                          const char *path,
+ *                          FILE *output)
+ * @brief Writes the changes between an older copy of a metadata database and a
+ *        database
+ * @param database The database
+ * @param path The path of the older copy
+ * @param output The output file
+ *
+ * Each line of a delta is either \a DELTA_REMOVAL followed by a package name or
+ * \a DELTA_ADDITION followed by a package entry, in the format accepted by
+ * \a repodude. Changed packages are removed, then added again. */
+result_t delta_write(database_t *database, const char *path, FILE *output);
+
+/*!
+ * @fn result_t delta_apply(database_t *database, char *contents)
+ * @brief Applies a delta to a metadata database
+ * @param database The database
+ * @param contents The delta contents; modified by this function
+ * @see delta_write */
+result_t delta_apply(database_t *database, char *contents);
+
+/*!
+ * @} */
+
+#endif
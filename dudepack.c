@@ -3,24 +3,188 @@
 #include <stdio.h>
 
 #include <zlib.h>
+#include <archive.h>
+#include <archive_entry.h>
 
 #include "package.h"
 #include "log.h"
 
-#	define CHUNK_SIZE (BUFSIZ)
+/* the block size used for reading the archive */
+#define BLOCK_SIZE (BUFSIZ)
 
-int main(int argc, char *argv[]) {
-	/* the reading buffer */
-	char chunk[CHUNK_SIZE] = {'\0'};
+/* the compression level of each chunk; presets of xz above 6 differ only by
+ * their dictionary size, which is bigger than a chunk anyway */
+static const char *g_levels[COMPRESSIONS_COUNT] = {
+	"6",
+	"19"
+};
+
+typedef struct {
+	uint32_t checksum; /* the checksum of everything written so far */
+	size_t size; /* the size of the chunk being written */
+} output_t;
+
+static bool _write_all(output_t *output, const void *block, const size_t size) {
+	/* the number of bytes written */
+	size_t total = 0;
+
+	/* the size of a written block */
+	ssize_t written = 0;
+
+	/* update the checksum */
+	output->checksum = (uint32_t) crc32((uLong) output->checksum,
+	                                    (const Bytef *) block,
+	                                    (uInt) size);
+
+	/* write the block to standard output */
+	for ( ; size > total; total += (size_t) written) {
+		written = write(STDOUT_FILENO,
+		                (const char *) block + total,
+		                size - total);
+		if (0 >= written) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static la_ssize_t _write_block(struct archive *chunk,
+                               output_t *output,
+                               const void *block,
+                               size_t size) {
+	if (false == _write_all(output, block, size)) {
+		return (-1);
+	}
+	output->size += size;
+	return (la_ssize_t) size;
+}
+
+static ssize_t _read_chunk(struct archive *input,
+                           unsigned char *chunk,
+                           const size_t size) {
+	/* the number of bytes read */
+	size_t total = 0;
+
+	/* the size of a read block */
+	la_ssize_t block = 0;
+
+	/* fill the chunk, unless the archive ends */
+	for ( ; size > total; total += (size_t) block) {
+		block = archive_read_data(input, &chunk[total], size - total);
+		if (0 > block) {
+			return (-1);
+		}
+		if (0 == block) {
+			break;
+		}
+	}
+
+	return (ssize_t) total;
+}
+
+static bool _write_chunk(const unsigned char *chunk,
+                         const size_t size,
+                         const compression_t compression,
+                         output_t *output) {
+	/* the compressed chunk */
+	struct archive *archive = NULL;
+
+	/* the chunk, as a single entry */
+	struct archive_entry *entry = NULL;
+
+	/* the return value */
+	bool is_success = false;
+
+	archive = archive_write_new();
+	if (NULL == archive) {
+		goto end;
+	}
+
+	/* compress the chunk as a whole, without padding it */
+	if (COMPRESSION_XZ == compression) {
+		if (ARCHIVE_OK != archive_write_add_filter_xz(archive)) {
+			goto free_archive;
+		}
+	} else {
+		if (ARCHIVE_OK != archive_write_add_filter_zstd(archive)) {
+			goto free_archive;
+		}
+	}
+	if ((ARCHIVE_OK != archive_write_set_filter_option(
+	                                              archive,
+	                                              NULL,
+	                                              "compression-level",
+	                                              g_levels[compression])) ||
+	    (ARCHIVE_OK != archive_write_set_format_raw(archive)) ||
+	    (ARCHIVE_OK != archive_write_set_bytes_per_block(archive, 0))) {
+		goto free_archive;
+	}
+
+	output->size = 0;
+	if (ARCHIVE_OK != archive_write_open(
+	                                  archive,
+	                                  output,
+	                                  NULL,
+	                                  (archive_write_callback *) _write_block,
+	                                  NULL)) {
+		goto free_archive;
+	}
+
+	entry = archive_entry_new();
+	if (NULL == entry) {
+		goto close_archive;
+	}
+	archive_entry_set_filetype(entry, AE_IFREG);
+	archive_entry_set_size(entry, (la_int64_t) size);
+	if ((ARCHIVE_OK != archive_write_header(archive, entry)) ||
+	    ((la_ssize_t) size != archive_write_data(archive, chunk, size))) {
+		goto free_entry;
+	}
 
+	/* report success */
+	is_success = true;
+
+free_entry:
+	archive_entry_free(entry);
+
+close_archive:
+	/* flush the compressed chunk */
+	if (ARCHIVE_OK != archive_write_close(archive)) {
+		is_success = false;
+	}
+
+free_archive:
+	archive_write_free(archive);
+
+end:
+	return is_success;
+}
+
+int main(int argc, char *argv[]) {
 	/* the package header */
 	package_header_t header = {0};
 
+	/* the package output */
+	output_t output = {0};
+
+	/* the archive */
+	struct archive *input = NULL;
+
+	/* the archive, as a single entry */
+	struct archive_entry *entry = NULL;
+
+	/* the decompressed archive chunk */
+	unsigned char *chunk = NULL;
+
+	/* the chunk index */
+	package_chunk_t *chunks = NULL;
+
 	/* the size of a read chunk */
 	ssize_t chunk_size = 0;
 
-	/* the total archive size */
-	ssize_t total_size = 0;
+	/* the archive compression */
+	compression_t compression = COMPRESSION_XZ;
 
 	/* the exit code */
 	int exit_code = EXIT_FAILURE;
@@ -32,48 +196,109 @@ int main(int argc, char *argv[]) {
 	}
 
 	/* initialize the checksum */
-	header.checksum = (uint32_t) crc32(0L, Z_NULL, 0);
+	output.checksum = (uint32_t) crc32(0L, Z_NULL, 0);
+
+	/* open the archive, decompressing it */
+	input = archive_read_new();
+	if (NULL == input) {
+		goto end;
+	}
+	archive_read_support_filter_xz(input);
+	archive_read_support_filter_zstd(input);
+	archive_read_support_format_raw(input);
+	if ((ARCHIVE_OK != archive_read_open_fd(input, STDIN_FILENO, BLOCK_SIZE)) ||
+	    (ARCHIVE_OK != archive_read_next_header(input, &entry))) {
+		log_write(LOG_ERROR, "Failed to read the archive\n");
+		goto close_input;
+	}
 
+	/* determine the archive compression; the chunks are compressed the same
+	 * way */
+	switch (archive_filter_code(input, 0)) {
+		case ARCHIVE_FILTER_XZ:
+			compression = COMPRESSION_XZ;
+			break;
+
+		case ARCHIVE_FILTER_ZSTD:
+			compression = COMPRESSION_ZSTD;
+			break;
+
+		default:
+			log_write(LOG_ERROR, "The archive compression is unsupported\n");
+			goto close_input;
+	}
+
+	chunk = malloc(CHUNK_SIZE);
+	if (NULL == chunk) {
+		goto close_input;
+	}
+	chunks = malloc(sizeof(package_chunk_t) * MAX_CHUNKS);
+	if (NULL == chunks) {
+		goto free_chunk;
+	}
+
+	/* split the archive into chunks and compress each of them independently,
+	 * so they can be decompressed in parallel */
 	do {
-		/* read a single chunk from standard input */
-		chunk_size = read(STDIN_FILENO, (void *) &chunk, sizeof(chunk));
-		total_size += chunk_size;
-		switch (chunk_size) {
-			case 0:
-				if (0 == total_size) {
-					goto end;
-				}
-				goto write_header;
-
-			case (-1):
-				goto end;
-
-			default:
-				/* update the checksum */
-				header.checksum = (uint32_t) crc32((uLong) header.checksum,
-				                                   (const Bytef *) &chunk,
-				                                   (uInt) chunk_size);
-
-				/* write the chunk to standard output */
-				if (chunk_size != write(STDOUT_FILENO,
-				                        &chunk,
-				                        (size_t) chunk_size)) {
-					goto end;
-				}
+		chunk_size = _read_chunk(input, chunk, CHUNK_SIZE);
+		if (-1 == chunk_size) {
+			log_write(LOG_ERROR, "Failed to read the archive\n");
+			goto free_chunks;
+		}
+		if (0 == chunk_size) {
+			break;
+		}
+
+		if (MAX_CHUNKS == header.chunks) {
+			log_write(LOG_ERROR, "The archive is too big\n");
+			goto free_chunks;
+		}
+		if (false == _write_chunk(chunk,
+		                          (size_t) chunk_size,
+		                          compression,
+		                          &output)) {
+			goto free_chunks;
 		}
-	} while (1);
+		chunks[header.chunks].size = (uint32_t) output.size;
+		chunks[header.chunks].extracted_size = (uint32_t) chunk_size;
+		++(header.chunks);
+	} while (CHUNK_SIZE == chunk_size);
+	if (0 == header.chunks) {
+		goto free_chunks;
+	}
+
+	/* write the chunk index */
+	if (false == _write_all(&output,
+	                        chunks,
+	                        sizeof(package_chunk_t) * header.chunks)) {
+		goto free_chunks;
+	}
 
-write_header:
 	/* write the package header */
+	header.compression = (uint8_t) compression;
 	header.magic = MAGIC;
 	header.version = VERSION;
+	header.checksum = output.checksum;
 	if (sizeof(header) != write(STDOUT_FILENO, &header, sizeof(header))) {
-		goto end;
+		goto free_chunks;
 	}
 
 	/* report success */
 	exit_code = EXIT_SUCCESS;
 
+free_chunks:
+	/* free the chunk index */
+	free(chunks);
+
+free_chunk:
+	/* free the chunk */
+	free(chunk);
+
+close_input:
+	/* close the archive */
+	(void) archive_read_close(input);
+	archive_read_free(input);
+
 end:
 	return exit_code;
 }
@@ -21,6 +21,12 @@ int main(int argc, char *argv[]) {
 	/* the package */
 	package_t package = {0};
 
+	/* the decompressed archive */
+	package_reader_t reader = {0};
+
+	/* the number of processors */
+	long processors = 0;
+
 	/* the file descriptor */
 	int fd = (-1);
 
@@ -75,17 +81,32 @@ int main(int argc, char *argv[]) {
 		goto close_package;
 	}
 
-	/* extract the archive contained in the package */
-	if (RESULT_OK != archive_extract(package.archive,
-	                                 package.archive_size,
-	                                 _print_path,
-	                                 NULL)) {
+	/* decompress the package chunks using all processors */
+	processors = sysconf(_SC_NPROCESSORS_ONLN);
+	if (RESULT_OK != package_reader_open(&reader,
+	                                     &package,
+	                                     (0 < processors) ?
+	                                     (unsigned int) processors :
+	                                     1)) {
 		goto close_package;
 	}
 
+	/* extract the archive contained in the package */
+	if (RESULT_OK != archive_extract(
+	                             (archive_read_callback_t) package_reader_read,
+	                             &reader,
+	                             _print_path,
+	                             NULL)) {
+		goto close_reader;
+	}
+
 	/* report success */
 	exit_code = EXIT_SUCCESS;
 
+close_reader:
+	/* stop decompressing the package */
+	package_reader_close(&reader);
+
 close_package:
 	/* close the package */
 	package_close(&package);
@@ -5,6 +5,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <limits.h>
+#include <strings.h>
+#include <sys/mman.h>
 
 #include "log.h"
 #include "fetch.h"
@@ -14,6 +18,22 @@ static size_t _append_to_buffer(const void *ptr,
                                 size_t nmemb,
                                 void *buffer);
 
+/* the length of a string literal */
+#define STRLEN(x) (sizeof(x) - sizeof(char))
+
+/* the header which carries the entity tag of a fetched URL */
+#define ETAG_HEADER "ETag:"
+
+/* the header used to fetch a URL only if its entity tag changed */
+#define IF_NONE_MATCH_HEADER "If-None-Match: "
+
+/* the HTTP response code which indicates a URL did not change */
+#define HTTP_NOT_MODIFIED (304)
+
+/* the scheme of local files, which libcurl reads without being able to pause
+ * the transfer */
+#define FILE_SCHEME "file"
+
 /* the number of fetchers */
 unsigned int g_fetcher_count = 0;
 
@@ -52,6 +72,11 @@ result_t fetcher_new(fetcher_t *fetcher) {
 	                                 1)) {
 		goto cleanup;
 	}
+	if (CURLE_OK != curl_easy_setopt(fetcher->handle,
+	                                 CURLOPT_NOSIGNAL,
+	                                 1L)) {
+		goto cleanup;
+	}
 	if (CURLE_OK != curl_easy_setopt(fetcher->handle,
 	                                 CURLOPT_WRITEFUNCTION,
 	                                 _append_to_buffer)) {
@@ -97,7 +122,6 @@ static size_t _append_to_buffer(const void *ptr,
 	new_buffer.buffer = realloc(((fetcher_buffer_t *) buffer)->buffer,
 	                            new_buffer.size);
 	if (NULL == new_buffer.buffer) {
-		free(((fetcher_buffer_t *) buffer)->buffer);
 		goto end;
 	}
 
@@ -138,6 +162,7 @@ result_t fetcher_fetch_to_memory(fetcher_t *fetcher,
 	/* fetch the URL */
 	buffer->buffer = NULL;
 	buffer->size = 0;
+	buffer->mapped = false;
 	if (CURLE_OK != curl_easy_perform(fetcher->handle)) {
 		result = RESULT_NETWORK_ERROR;
 		if (NULL != buffer->buffer) {
@@ -153,6 +178,79 @@ end:
 	return result;
 }
 
+void fetcher_buffer_free(fetcher_buffer_t *buffer) {
+	assert(NULL != buffer);
+
+	if (NULL == buffer->buffer) {
+		return;
+	}
+
+	if (true == buffer->mapped) {
+		(void) munmap(buffer->buffer, buffer->size);
+	} else {
+		free(buffer->buffer);
+	}
+	buffer->buffer = NULL;
+}
+
+static result_t _write_file(const char *path, const fetcher_buffer_t *buffer) {
+	/* the temporary path of the file */
+	char temporary_path[PATH_MAX] = {'\0'};
+
+	/* the return value */
+	result_t result = RESULT_IO_ERROR;
+
+	/* the file descriptor */
+	int fd = (-1);
+
+	assert(NULL != path);
+	assert(NULL != buffer);
+
+	/* format the temporary path */
+	if (sizeof(temporary_path) <= snprintf((char *) &temporary_path,
+	                                       sizeof(temporary_path),
+	                                       "%s"FETCHER_TEMPORARY_SUFFIX,
+	                                       path)) {
+		result = RESULT_CORRUPT_DATA;
+		goto end;
+	}
+
+	/* write the file contents to a temporary file, so readers of the file
+	 * never see it partially written */
+	fd = open((const char *) &temporary_path,
+	          O_WRONLY | O_CREAT | O_TRUNC,
+	          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (-1 == fd) {
+		goto end;
+	}
+	if ((ssize_t) buffer->size != write(fd, buffer->buffer, buffer->size)) {
+		goto delete_file;
+	}
+	if (-1 == close(fd)) {
+		fd = (-1);
+		goto delete_file;
+	}
+	fd = (-1);
+
+	/* put the file in place */
+	if (-1 == rename((const char *) &temporary_path, path)) {
+		goto delete_file;
+	}
+
+	/* report success */
+	result = RESULT_OK;
+	goto end;
+
+delete_file:
+	/* delete the temporary file */
+	if (-1 != fd) {
+		(void) close(fd);
+	}
+	(void) unlink((const char *) &temporary_path);
+
+end:
+	return result;
+}
 
 result_t fetcher_fetch_to_file(fetcher_t *fetcher,
                                const char *url,
@@ -163,9 +261,6 @@ result_t fetcher_fetch_to_file(fetcher_t *fetcher,
 	/* the return value */
 	result_t result = RESULT_MEM_ERROR;
 
-	/* the file descriptor */
-	int fd = (-1);
-
 	assert(NULL != fetcher);
 	assert(NULL != fetcher->handle);
 	assert(NULL != url);
@@ -173,44 +268,208 @@ result_t fetcher_fetch_to_file(fetcher_t *fetcher,
 
 	log_write(LOG_DEBUG, "Fetching %s\n", url);
 
-	/* set the URL */
-	if (CURLE_OK != curl_easy_setopt(fetcher->handle, CURLOPT_URL, url)) {
+	/* fetch the URL */
+	result = fetcher_fetch_to_memory(fetcher, url, &buffer);
+	if (RESULT_OK != result) {
 		goto end;
 	}
 
+	/* write the file */
+	result = _write_file(path, &buffer);
+
+	/* free the file contents */
+	free(buffer.buffer);
+
+end:
+	return result;
+}
+
+static size_t _parse_header(const char *header,
+                            size_t size,
+                            size_t nmemb,
+                            void *etag) {
+	/* the header length */
+	size_t length = 0;
+
+	/* the header value */
+	const char *value = NULL;
+
+	/* the value length */
+	size_t value_length = 0;
+
+	assert(NULL != header);
+	assert(NULL != etag);
+
+	length = size * nmemb;
+
+	/* ignore all headers but the entity tag */
+	if ((STRLEN(ETAG_HEADER) > length) ||
+	    (0 != strncasecmp(header, ETAG_HEADER, STRLEN(ETAG_HEADER)))) {
+		goto end;
+	}
+
+	/* skip leading whitespace and trailing line breaks */
+	value = header + STRLEN(ETAG_HEADER);
+	value_length = length - STRLEN(ETAG_HEADER);
+	while ((0 < value_length) && (' ' == *value)) {
+		++value;
+		--value_length;
+	}
+	while ((0 < value_length) &&
+	       (('\r' == value[value_length - 1]) ||
+	        ('\n' == value[value_length - 1]))) {
+		--value_length;
+	}
+
+	/* ignore entity tags which are too long to be stored */
+	if (MAX_ETAG_LENGTH <= value_length) {
+		goto end;
+	}
+	(void) memcpy(etag, value, value_length);
+	((char *) etag)[value_length] = '\0';
+
+end:
+	return length;
+}
+
+result_t fetcher_revalidate_to_file(fetcher_t *fetcher,
+                                    const char *url,
+                                    const char *path,
+                                    fetcher_validators_t *validators) {
+	/* the If-None-Match header */
+	char condition[STRLEN(IF_NONE_MATCH_HEADER) + MAX_ETAG_LENGTH] = {'\0'};
+
+	/* the validators of the fetched copy */
+	fetcher_validators_t fetched = {{'\0'}};
+
+	/* the fetched file */
+	fetcher_buffer_t buffer = {0};
+
+	/* the request headers */
+	struct curl_slist *headers = NULL;
+
+	/* the response code */
+	long code = 0;
+
+	/* whether the time condition was not met */
+	long unmet = 0;
+
+	/* the modification time of the fetched copy */
+	long last_modified = (-1);
+
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	assert(NULL != fetcher);
+	assert(NULL != fetcher->handle);
+	assert(NULL != url);
+	assert(NULL != path);
+	assert(NULL != validators);
+
+	log_write(LOG_DEBUG, "Revalidating %s\n", url);
+
+	/* if the entity tag of the previous copy is known, ask the server to send
+	 * the file only if it changed */
+	if ('\0' != validators->etag[0]) {
+		(void) sprintf((char *) &condition,
+		               IF_NONE_MATCH_HEADER"%s",
+		               (const char *) &validators->etag);
+		headers = curl_slist_append(NULL, (const char *) &condition);
+		if (NULL == headers) {
+			goto end;
+		}
+		if (CURLE_OK != curl_easy_setopt(fetcher->handle,
+		                                 CURLOPT_HTTPHEADER,
+		                                 headers)) {
+			goto reset_options;
+		}
+	}
+
+	/* same, with the modification time */
+	if (0 != validators->last_modified) {
+		if (CURLE_OK != curl_easy_setopt(fetcher->handle,
+		                                 CURLOPT_TIMECONDITION,
+		                                 CURL_TIMECOND_IFMODSINCE)) {
+			goto reset_options;
+		}
+		if (CURLE_OK != curl_easy_setopt(fetcher->handle,
+		                                 CURLOPT_TIMEVALUE,
+		                                 (long) validators->last_modified)) {
+			goto reset_options;
+		}
+	}
+
+	/* collect the validators of the fetched copy */
+	if (CURLE_OK != curl_easy_setopt(fetcher->handle,
+	                                 CURLOPT_HEADERFUNCTION,
+	                                 _parse_header)) {
+		goto reset_options;
+	}
+	if (CURLE_OK != curl_easy_setopt(fetcher->handle,
+	                                 CURLOPT_HEADERDATA,
+	                                 &fetched.etag)) {
+		goto reset_options;
+	}
+	if (CURLE_OK != curl_easy_setopt(fetcher->handle, CURLOPT_FILETIME, 1L)) {
+		goto reset_options;
+	}
+
 	/* fetch the URL */
 	result = fetcher_fetch_to_memory(fetcher, url, &buffer);
 	if (RESULT_OK != result) {
-		goto end;
+		goto reset_options;
 	}
 
-	/* open the output file */
-	fd = open(path,  O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-	if (-1 == fd) {
-		result = RESULT_IO_ERROR;
+	/* if the URL did not change, keep the previous copy */
+	if ((CURLE_OK != curl_easy_getinfo(fetcher->handle,
+	                                   CURLINFO_RESPONSE_CODE,
+	                                   &code)) ||
+	    (CURLE_OK != curl_easy_getinfo(fetcher->handle,
+	                                   CURLINFO_CONDITION_UNMET,
+	                                   &unmet))) {
+		result = RESULT_NETWORK_ERROR;
 		goto free_buffer;
 	}
-
-	/* write the file contents */
-	if ((ssize_t) buffer.size != write(fd, buffer.buffer, buffer.size)) {
-		goto delete_file;
+	if ((HTTP_NOT_MODIFIED == code) || (0 != unmet)) {
+		log_write(LOG_DEBUG, "%s did not change\n", url);
+		result = RESULT_NOT_MODIFIED;
+		goto free_buffer;
 	}
 
-	/* report success */
-	result = RESULT_OK;
-	goto close_file;
-
-delete_file:
-	/* delete the file */
-	(void) unlink(path);
+	/* write the file */
+	result = _write_file(path, &buffer);
+	if (RESULT_OK != result) {
+		goto free_buffer;
+	}
 
-close_file:
-	/* close the file */
-	(void) close(fd);
+	/* save the validators of the new copy */
+	if ((CURLE_OK != curl_easy_getinfo(fetcher->handle,
+	                                   CURLINFO_FILETIME,
+	                                   &last_modified)) ||
+	    (-1 == last_modified)) {
+		last_modified = 0;
+	}
+	fetched.last_modified = (time_t) last_modified;
+	(void) memcpy(validators, &fetched, sizeof(fetched));
 
 free_buffer:
 	/* free the file contents */
-	free(buffer.buffer);
+	if (NULL != buffer.buffer) {
+		free(buffer.buffer);
+	}
+
+reset_options:
+	/* let the fetcher fetch URLs unconditionally again */
+	(void) curl_easy_setopt(fetcher->handle, CURLOPT_HTTPHEADER, NULL);
+	(void) curl_easy_setopt(fetcher->handle,
+	                        CURLOPT_TIMECONDITION,
+	                        CURL_TIMECOND_NONE);
+	(void) curl_easy_setopt(fetcher->handle, CURLOPT_HEADERFUNCTION, NULL);
+	(void) curl_easy_setopt(fetcher->handle, CURLOPT_HEADERDATA, NULL);
+	(void) curl_easy_setopt(fetcher->handle, CURLOPT_FILETIME, 0L);
+	if (NULL != headers) {
+		curl_slist_free_all(headers);
+	}
 
 end:
 	return result;
@@ -232,3 +491,491 @@ void fetcher_free(fetcher_t *fetcher) {
 		curl_global_cleanup();
 	}
 }
+
+result_t fetcher_pool_new(fetcher_pool_t *pool,
+                          const unsigned int concurrency) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	assert(NULL != pool);
+	assert(0 < concurrency);
+
+	/* allocate memory for the fetchers */
+	pool->fetchers = malloc(sizeof(fetcher_t) * concurrency);
+	if (NULL == pool->fetchers) {
+		goto end;
+	}
+
+	/* initialize the fetchers */
+	for ( ; concurrency > i; ++i) {
+		result = fetcher_new(&pool->fetchers[i]);
+		if (RESULT_OK != result) {
+			goto free_fetchers;
+		}
+	}
+
+	/* initialize a "multi" libcurl session, which drives all fetchers */
+	pool->handle = curl_multi_init();
+	if (NULL == pool->handle) {
+		result = RESULT_MEM_ERROR;
+		goto free_fetchers;
+	}
+
+	/* save the maximum number of simultaneous transfers */
+	pool->concurrency = concurrency;
+
+	/* report success */
+	result = RESULT_OK;
+	goto end;
+
+free_fetchers:
+	/* free all initialized fetchers */
+	for ( ; 0 < i; --i) {
+		fetcher_free(&pool->fetchers[i - 1]);
+	}
+	free(pool->fetchers);
+
+end:
+	return result;
+}
+
+void fetcher_pool_free(fetcher_pool_t *pool) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != pool);
+	assert(NULL != pool->handle);
+	assert(NULL != pool->fetchers);
+
+	/* end the "multi" libcurl session */
+	(void) curl_multi_cleanup(pool->handle);
+
+	/* free the fetchers */
+	for ( ; pool->concurrency > i; ++i) {
+		fetcher_free(&pool->fetchers[i]);
+	}
+	free(pool->fetchers);
+}
+
+static result_t _start_job(fetcher_pool_t *pool,
+                           CURL *handle,
+                           fetcher_job_t *job) {
+	/* the requested range */
+	char range[FETCHER_MAX_RANGE_LENGTH] = {'\0'};
+
+	assert(NULL != pool);
+	assert(NULL != handle);
+	assert(NULL != job);
+
+	log_write(LOG_DEBUG, "Fetching %s\n", job->url);
+
+	/* set the input URL and the output buffer */
+	if (CURLE_OK != curl_easy_setopt(handle, CURLOPT_URL, job->url)) {
+		return RESULT_MEM_ERROR;
+	}
+
+	/* if only the end of the URL is requested, set the range */
+	if (0 < job->tail) {
+		(void) sprintf((char *) &range, "-%lu", (unsigned long) job->tail);
+		if (CURLE_OK != curl_easy_setopt(handle, CURLOPT_RANGE, range)) {
+			return RESULT_MEM_ERROR;
+		}
+	} else {
+		if (CURLE_OK != curl_easy_setopt(handle, CURLOPT_RANGE, NULL)) {
+			return RESULT_MEM_ERROR;
+		}
+	}
+	if (CURLE_OK != curl_easy_setopt(handle, CURLOPT_WRITEDATA, &job->buffer)) {
+		return RESULT_MEM_ERROR;
+	}
+
+	/* attach the job to the handle, to find it once the transfer is over */
+	if (CURLE_OK != curl_easy_setopt(handle, CURLOPT_PRIVATE, job)) {
+		return RESULT_MEM_ERROR;
+	}
+
+	/* start the transfer */
+	if (CURLM_OK != curl_multi_add_handle(pool->handle, handle)) {
+		return RESULT_MEM_ERROR;
+	}
+
+	return RESULT_OK;
+}
+
+result_t fetcher_pool_fetch_to_memory(fetcher_pool_t *pool,
+                                      fetcher_job_t *jobs,
+                                      const unsigned int count) {
+	/* a finished transfer */
+	CURLMsg *message = NULL;
+
+	/* the handle of a finished transfer */
+	CURL *handle = NULL;
+
+	/* the job associated with a finished transfer */
+	fetcher_job_t *job = NULL;
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the index of the next job to start */
+	unsigned int next = 0;
+
+	/* the number of transfers in progress */
+	unsigned int active = 0;
+
+	/* the number of running transfers, as reported by libcurl */
+	int running = 0;
+
+	/* the number of messages left in the libcurl queue */
+	int queued = 0;
+
+	/* the status of a finished transfer */
+	CURLcode status = CURLE_OK;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != pool);
+	assert(NULL != pool->handle);
+	assert(NULL != jobs);
+
+	/* initialize all jobs, so those which never start are reported as
+	 * failed */
+	for ( ; count > i; ++i) {
+		jobs[i].buffer.buffer = NULL;
+		jobs[i].buffer.size = 0;
+		jobs[i].buffer.mapped = false;
+		jobs[i].result = RESULT_ABORTED;
+	}
+
+	/* start the first transfers, one per fetcher */
+	for (i = 0; (pool->concurrency > i) && (count > next); ++i, ++next) {
+		result = _start_job(pool, pool->fetchers[i].handle, &jobs[next]);
+		if (RESULT_OK != result) {
+			goto abort;
+		}
+		++active;
+	}
+
+	while (0 < active) {
+		/* advance all transfers */
+		if (CURLM_OK != curl_multi_perform(pool->handle, &running)) {
+			result = RESULT_NETWORK_ERROR;
+			goto abort;
+		}
+
+		/* handle finished transfers */
+		do {
+			message = curl_multi_info_read(pool->handle, &queued);
+			if (NULL == message) {
+				break;
+			}
+			if (CURLMSG_DONE != message->msg) {
+				continue;
+			}
+
+			/* the message is freed once the handle is detached, so copy the
+			 * transfer details first */
+			handle = message->easy_handle;
+			status = message->data.result;
+			if (CURLE_OK != curl_easy_getinfo(handle,
+			                                  CURLINFO_PRIVATE,
+			                                  (char **) &job)) {
+				result = RESULT_MEM_ERROR;
+				goto abort;
+			}
+			(void) curl_multi_remove_handle(pool->handle, handle);
+			--active;
+
+			if (CURLE_OK == status) {
+				job->result = RESULT_OK;
+			} else {
+				log_write(LOG_ERROR,
+				          "Failed to fetch %s: %s\n",
+				          job->url,
+				          curl_easy_strerror(status));
+				job->result = RESULT_NETWORK_ERROR;
+				if (NULL != job->buffer.buffer) {
+					free(job->buffer.buffer);
+					job->buffer.buffer = NULL;
+				}
+				result = RESULT_NETWORK_ERROR;
+			}
+
+			/* reuse the handle for the next job */
+			if (count > next) {
+				result = _start_job(pool, handle, &jobs[next]);
+				if (RESULT_OK != result) {
+					goto abort;
+				}
+				++next;
+				++active;
+			}
+		} while (1);
+
+		/* wait until there is activity on one of the connections */
+		if (0 < active) {
+			if (CURLM_OK != curl_multi_wait(pool->handle,
+			                                NULL,
+			                                0,
+			                                FETCHER_POLL_TIMEOUT,
+			                                NULL)) {
+				result = RESULT_NETWORK_ERROR;
+				goto abort;
+			}
+		}
+	}
+
+	/* if any transfer failed, report failure */
+	for (i = 0; count > i; ++i) {
+		if (RESULT_OK != jobs[i].result) {
+			result = jobs[i].result;
+			break;
+		}
+	}
+	goto end;
+
+abort:
+	/* stop all transfers */
+	for (i = 0; pool->concurrency > i; ++i) {
+		(void) curl_multi_remove_handle(pool->handle,
+		                                pool->fetchers[i].handle);
+	}
+
+	/* free the buffers of all unfinished transfers */
+	for (i = 0; count > i; ++i) {
+		if ((RESULT_OK != jobs[i].result) && (NULL != jobs[i].buffer.buffer)) {
+			free(jobs[i].buffer.buffer);
+			jobs[i].buffer.buffer = NULL;
+		}
+	}
+
+end:
+	return result;
+}
+
+static bool _can_pause(const fetcher_stream_t *stream) {
+	/* the transfer scheme */
+	const char *scheme = NULL;
+
+	assert(NULL != stream);
+
+	if ((CURLE_OK != curl_easy_getinfo(stream->fetcher->handle,
+	                                   CURLINFO_SCHEME,
+	                                   &scheme)) ||
+	    (NULL == scheme)) {
+		return false;
+	}
+
+	return (0 == strcasecmp(FILE_SCHEME, scheme)) ? false : true;
+}
+
+static size_t _append_to_stream(const void *ptr,
+                                size_t size,
+                                size_t nmemb,
+                                void *stream) {
+	/* the enlarged buffer */
+	unsigned char *buffer = NULL;
+
+	/* the number of available bytes */
+	size_t bytes_available = 0;
+
+	assert(NULL != ptr);
+	assert(NULL != stream);
+
+	/* if enough data is buffered, pause the transfer until it is read; libcurl
+	 * will pass the same data again once the transfer is resumed. Local files
+	 * are read in one go, since their transfer cannot be paused */
+	if ((FETCHER_STREAM_BUFFER_SIZE <=
+	     ((fetcher_stream_t *) stream)->buffer.size) &&
+	    (true == _can_pause((const fetcher_stream_t *) stream))) {
+		((fetcher_stream_t *) stream)->paused = true;
+		return CURL_WRITEFUNC_PAUSE;
+	}
+
+	/* calculate the number of available bytes */
+	bytes_available = size * nmemb;
+
+	/* enlarge the buffer, if needed */
+	if (((fetcher_stream_t *) stream)->capacity <
+	    (((fetcher_stream_t *) stream)->buffer.size + bytes_available)) {
+		buffer = realloc(((fetcher_stream_t *) stream)->buffer.buffer,
+		                 ((fetcher_stream_t *) stream)->buffer.size + \
+		                 bytes_available);
+		if (NULL == buffer) {
+			return 0;
+		}
+		((fetcher_stream_t *) stream)->buffer.buffer = buffer;
+		((fetcher_stream_t *) stream)->capacity = \
+		                 ((fetcher_stream_t *) stream)->buffer.size + \
+		                 bytes_available;
+	}
+
+	/* copy the data to the buffer */
+	(void) memcpy(&((fetcher_stream_t *) stream)->buffer.buffer[
+	                               ((fetcher_stream_t *) stream)->buffer.size],
+	              ptr,
+	              bytes_available);
+	((fetcher_stream_t *) stream)->buffer.size += bytes_available;
+
+	return bytes_available;
+}
+
+result_t fetcher_stream_open(fetcher_stream_t *stream,
+                             fetcher_t *fetcher,
+                             const char *url) {
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	assert(NULL != stream);
+	assert(NULL != fetcher);
+	assert(NULL != fetcher->handle);
+	assert(NULL != url);
+
+	log_write(LOG_DEBUG, "Streaming %s\n", url);
+
+	/* initialize the stream */
+	stream->fetcher = fetcher;
+	stream->buffer.buffer = NULL;
+	stream->buffer.size = 0;
+	stream->capacity = 0;
+	stream->paused = false;
+	stream->done = false;
+	stream->status = CURLE_OK;
+
+	/* initialize a "multi" libcurl session, used to drive the transfer from
+	 * the reading side */
+	stream->handle = curl_multi_init();
+	if (NULL == stream->handle) {
+		goto end;
+	}
+
+	/* set the input URL and the output stream */
+	if (CURLE_OK != curl_easy_setopt(fetcher->handle, CURLOPT_URL, url)) {
+		goto cleanup;
+	}
+	if (CURLE_OK != curl_easy_setopt(fetcher->handle,
+	                                 CURLOPT_WRITEFUNCTION,
+	                                 _append_to_stream)) {
+		goto cleanup;
+	}
+	if (CURLE_OK != curl_easy_setopt(fetcher->handle,
+	                                 CURLOPT_WRITEDATA,
+	                                 stream)) {
+		goto restore_callback;
+	}
+
+	/* start the transfer */
+	if (CURLM_OK != curl_multi_add_handle(stream->handle, fetcher->handle)) {
+		goto restore_callback;
+	}
+
+	/* report success */
+	result = RESULT_OK;
+	goto end;
+
+restore_callback:
+	/* let the fetcher fetch URLs to memory again */
+	(void) curl_easy_setopt(fetcher->handle,
+	                        CURLOPT_WRITEFUNCTION,
+	                        _append_to_buffer);
+
+cleanup:
+	/* end the "multi" libcurl session */
+	(void) curl_multi_cleanup(stream->handle);
+
+end:
+	return result;
+}
+
+ssize_t fetcher_stream_read(fetcher_stream_t *stream, const void **block) {
+	/* a transfer status message */
+	CURLMsg *message = NULL;
+
+	/* the number of running transfers */
+	int running = 0;
+
+	/* the number of messages left in the libcurl queue */
+	int queued = 0;
+
+	assert(NULL != stream);
+	assert(NULL != stream->handle);
+	assert(NULL != block);
+
+	/* the previous block has been read */
+	stream->buffer.size = 0;
+
+	/* if the transfer was paused because the buffer was full, resume it */
+	if (true == stream->paused) {
+		stream->paused = false;
+		if (CURLE_OK != curl_easy_pause(stream->fetcher->handle,
+		                                CURLPAUSE_CONT)) {
+			log_write(LOG_ERROR, "Failed to resume a transfer\n");
+			return (-1);
+		}
+	}
+
+	/* advance the transfer until there is some data to read */
+	while ((0 == stream->buffer.size) && (false == stream->done)) {
+		if (CURLM_OK != curl_multi_perform(stream->handle, &running)) {
+			return (-1);
+		}
+
+		/* check whether the transfer is over */
+		do {
+			message = curl_multi_info_read(stream->handle, &queued);
+			if (NULL == message) {
+				break;
+			}
+			if (CURLMSG_DONE == message->msg) {
+				stream->status = message->data.result;
+				stream->done = true;
+			}
+		} while (1);
+
+		/* wait until there is activity on the connection */
+		if ((0 == stream->buffer.size) && (false == stream->done)) {
+			if (CURLM_OK != curl_multi_wait(stream->handle,
+			                                NULL,
+			                                0,
+			                                FETCHER_POLL_TIMEOUT,
+			                                NULL)) {
+				return (-1);
+			}
+		}
+	}
+
+	/* if the transfer failed, report failure only once all data received
+	 * before the failure has been read */
+	if ((0 == stream->buffer.size) && (CURLE_OK != stream->status)) {
+		log_write(LOG_ERROR,
+		          "Failed to fetch a file: %s\n",
+		          curl_easy_strerror(stream->status));
+		return (-1);
+	}
+
+	*block = stream->buffer.buffer;
+	return (ssize_t) stream->buffer.size;
+}
+
+void fetcher_stream_close(fetcher_stream_t *stream) {
+	assert(NULL != stream);
+	assert(NULL != stream->handle);
+
+	/* stop the transfer */
+	(void) curl_multi_remove_handle(stream->handle, stream->fetcher->handle);
+	(void) curl_multi_cleanup(stream->handle);
+
+	/* let the fetcher fetch URLs to memory again */
+	(void) curl_easy_setopt(stream->fetcher->handle,
+	                        CURLOPT_WRITEFUNCTION,
+	                        _append_to_buffer);
+
+	/* free the buffer */
+	if (NULL != stream->buffer.buffer) {
+		free(stream->buffer.buffer);
+	}
+}
@@ -2,6 +2,8 @@
 #	define _FETCH_H_INCLUDED
 
 #	include <sys/types.h>
+#	include <stdbool.h>
+#	include <time.h>
 
 #	include <curl/curl.h>
 
@@ -32,14 +34,92 @@ typedef struct {
 	CURL *handle; /*!< The underlying \a cURL handle */
 } fetcher_t;
 
+/*!
+ * @def DEFAULT_FETCHER_CONCURRENCY
+ * @brief The default maximum number of simultaneous transfers
+ * @see fetcher_pool_new */
+#	define DEFAULT_FETCHER_CONCURRENCY (4)
+
+/*!
+ * @def FETCHER_MAX_RANGE_LENGTH
+ * @brief The maximum length of a byte range specification */
+#	define FETCHER_MAX_RANGE_LENGTH (32)
+
+/*!
+ * @def FETCHER_POLL_TIMEOUT
+ * @brief The maximum time to wait for network activity, in milliseconds */
+#	define FETCHER_POLL_TIMEOUT (1000)
+
+/*!
+ * @def FETCHER_TEMPORARY_SUFFIX
+ * @brief The suffix appended to the path of a file while it is being written
+ * @see fetcher_fetch_to_file */
+#	define FETCHER_TEMPORARY_SUFFIX ".part"
+
+/*!
+ * @def MAX_ETAG_LENGTH
+ * @brief The maximum length of an entity tag */
+#	define MAX_ETAG_LENGTH (256)
+
+/*!
+ * @struct fetcher_validators_t
+ * @brief The validators of a fetched URL, used to fetch it again only if it
+ *        changed */
+typedef struct {
+	char etag[MAX_ETAG_LENGTH]; /*!< The entity tag, or an empty string */
+	time_t last_modified; /*!< The modification time, or 0 if unknown */
+} fetcher_validators_t;
+
 /*!
  * @struct fetcher_buffer_t
  * @brief A dynamically-growing buffer */
 typedef struct {
 	unsigned char *buffer; /*!< The buffer contents */
 	size_t size; /*!< The buffer size */
+	bool mapped; /*!< Whether the buffer is a file mapped to memory, instead of
+	              * dynamically-allocated memory */
 } fetcher_buffer_t;
 
+/*!
+ * @def FETCHER_STREAM_BUFFER_SIZE
+ * @brief The amount of data buffered by a stream before the transfer is paused
+ * @see fetcher_stream_t */
+#	define FETCHER_STREAM_BUFFER_SIZE (64 * 1024)
+
+/*!
+ * @struct fetcher_stream_t
+ * @brief A URL read incrementally, while it is being fetched */
+typedef struct {
+	CURLM *handle; /*!< The \a cURL "multi" handle which drives the transfer */
+	fetcher_t *fetcher; /*!< The fetcher used for the transfer */
+	fetcher_buffer_t buffer; /*!< Data received but not read yet */
+	size_t capacity; /*!< The allocated size of the buffer */
+	bool paused; /*!< Whether the transfer is paused */
+	bool done; /*!< Whether the transfer is over */
+	CURLcode status; /*!< The transfer status, once it is over */
+} fetcher_stream_t;
+
+/*!
+ * @struct fetcher_job_t
+ * @brief A URL fetched by a fetcher pool */
+typedef struct {
+	char url[MAX_URL_LENGTH]; /*!< The fetched URL */
+	size_t tail; /*!< If non-zero, only the last bytes of the URL are
+	              * fetched */
+	fetcher_buffer_t buffer; /*!< The output buffer */
+	result_t result; /*!< The transfer status */
+} fetcher_job_t;
+
+/*!
+ * @struct fetcher_pool_t
+ * @brief A set of fetchers, used to fetch multiple URLs simultaneously */
+typedef struct {
+	CURLM *handle; /*!< The underlying \a cURL "multi" handle */
+	fetcher_t *fetchers; /*!< The fetchers */
+	unsigned int concurrency; /*!< The maximum number of simultaneous
+	                           * transfers */
+} fetcher_pool_t;
+
 /*!
  * @fn result_t fetcher_new(fetcher_t *fetcher)
  * @brief Initializes a URL fetching session
@@ -61,11 +141,31 @@ void fetcher_free(fetcher_t *fetcher);
  * @brief Fetches a URL into a file
  * @param fetcher The session data
  * @param url The fetched URL
- * @param path The output file */
+ * @param path The output file
+ *
+ * The file is replaced atomically, once the URL has been fetched. */
 result_t fetcher_fetch_to_file(fetcher_t *fetcher,
                                const char *url,
                                const char *path);
 
+/*!
+ * @fn result_t fetcher_revalidate_to_file(fetcher_t *fetcher,
+ *                                         const char *url,
+ *                                         const char *path,
+ *                                         fetcher_validators_t *validators)
+ * @brief Fetches a URL into a file, unless it did not change
+ * @param fetcher The session data
+ * @param url The fetched URL
+ * @param path The output file
+ * @param validators The validators of the previously fetched copy; updated if
+ *                   the URL is fetched
+ * @return \a RESULT_NOT_MODIFIED if the URL did not change
+ * @see fetcher_fetch_to_file */
+result_t fetcher_revalidate_to_file(fetcher_t *fetcher,
+                                    const char *url,
+                                    const char *path,
+                                    fetcher_validators_t *validators);
+
 /*!
  * @fn result_t fetcher_fetch_to_memory(fetcher_t *fetcher,
  *                                      const char *url,
@@ -78,6 +178,82 @@ result_t fetcher_fetch_to_memory(fetcher_t *fetcher,
                                  const char *url,
                                  fetcher_buffer_t *buffer);
 
+/*!
+ * @fn void fetcher_buffer_free(fetcher_buffer_t *buffer)
+ * @brief Frees a buffer filled by a fetcher or mapped to memory
+ * @param buffer The buffer */
+void fetcher_buffer_free(fetcher_buffer_t *buffer);
+
+/*!
+ * @fn result_t fetcher_stream_open(fetcher_stream_t *stream,
+ *                                  fetcher_t *fetcher,
+ *                                  const char *url)
+ * @brief Starts fetching a URL, for incremental reading
+ * @param stream The stream
+ * @param fetcher The session data
+ * @param url The fetched URL
+ * @see fetcher_stream_read
+ * @see fetcher_stream_close */
+result_t fetcher_stream_open(fetcher_stream_t *stream,
+                             fetcher_t *fetcher,
+                             const char *url);
+
+/*!
+ * @fn ssize_t fetcher_stream_read(fetcher_stream_t *stream,
+ *                                 const void **block)
+ * @brief Reads the next block of data from a stream
+ * @param stream The stream
+ * @param block The data block
+ * @return The block size, 0 once all data has been read or -1 on failure
+ *
+ * The block remains valid until the next call. While the caller does not read
+ * from the stream, the transfer is paused once \a FETCHER_STREAM_BUFFER_SIZE
+ * bytes are buffered, unless the URL is a local file, which libcurl cannot
+ * pause; local files are buffered whole. */
+ssize_t fetcher_stream_read(fetcher_stream_t *stream, const void **block);
+
+/*!
+ * @fn void fetcher_stream_close(fetcher_stream_t *stream)
+ * @brief Stops fetching a URL
+ * @param stream The stream
+ * @see fetcher_stream_open */
+void fetcher_stream_close(fetcher_stream_t *stream);
+
+/*!
+ * @fn result_t fetcher_pool_new(fetcher_pool_t *pool,
+ *                               const unsigned int concurrency)
+ * @brief Initializes a set of URL fetching sessions
+ * @param pool The fetcher pool
+ * @param concurrency The maximum number of simultaneous transfers
+ * @see DEFAULT_FETCHER_CONCURRENCY
+ * @see fetcher_pool_free */
+result_t fetcher_pool_new(fetcher_pool_t *pool,
+                          const unsigned int concurrency);
+
+/*!
+ * @fn void fetcher_pool_free(fetcher_pool_t *pool)
+ * @brief Ends a set of URL fetching sessions
+ * @param pool The fetcher pool
+ * @see fetcher_pool_new */
+void fetcher_pool_free(fetcher_pool_t *pool);
+
+/*!
+ * @fn result_t fetcher_pool_fetch_to_memory(fetcher_pool_t *pool,
+ *                                           fetcher_job_t *jobs,
+ *                                           const unsigned int count)
+ * @brief Fetches multiple URLs into dynamically-allocated memory,
+ *        simultaneously
+ * @param pool The fetcher pool
+ * @param jobs The fetched URLs
+ * @param count The number of fetched URLs
+ *
+ * The status of each transfer is stored in its \a result field; the return
+ * value is \a RESULT_OK only if all transfers succeeded. The buffers of failed
+ * transfers are freed. */
+result_t fetcher_pool_fetch_to_memory(fetcher_pool_t *pool,
+                                      fetcher_job_t *jobs,
+                                      const unsigned int count);
+
 /*!
  * @} */
 
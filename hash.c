@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "hash.h"
+
+/* the FNV-1a parameters */
+#define FNV_OFFSET_BASIS (2166136261U)
+#define FNV_PRIME (16777619U)
+
+static size_t _hash_key(const char *key) {
+	/* the hash */
+	uint32_t hash = FNV_OFFSET_BASIS;
+
+	for ( ; '\0' != *key; ++key) {
+		hash ^= (uint32_t) (unsigned char) *key;
+		hash *= FNV_PRIME;
+	}
+
+	return (size_t) hash;
+}
+
+static hash_entry_t *_find(const hash_entry_t *entries,
+                           const size_t size,
+                           const char *key) {
+	/* the slot index */
+	size_t i = 0;
+
+	/* probe the slots linearly, starting from the key hash, until the key or
+	 * a free slot is found */
+	for (i = _hash_key(key) & (size - 1);
+	     (NULL != entries[i].key) && (0 != strcmp(key, entries[i].key));
+	     i = (i + 1) & (size - 1));
+
+	return (hash_entry_t *) &entries[i];
+}
+
+static result_t _resize(hash_t *hash, const size_t size) {
+	/* the new slots */
+	hash_entry_t *entries = NULL;
+
+	/* a loop index */
+	size_t i = 0;
+
+	assert(NULL != hash);
+	assert(hash->count < size);
+
+	entries = calloc(size, sizeof(hash_entry_t));
+	if (NULL == entries) {
+		return RESULT_MEM_ERROR;
+	}
+
+	/* move all keys to the new slots */
+	for ( ; hash->size > i; ++i) {
+		if (NULL != hash->entries[i].key) {
+			(void) memcpy(_find(entries, size, hash->entries[i].key),
+			              &hash->entries[i],
+			              sizeof(hash_entry_t));
+		}
+	}
+
+	if (NULL != hash->entries) {
+		free(hash->entries);
+	}
+	hash->entries = entries;
+	hash->size = size;
+
+	return RESULT_OK;
+}
+
+result_t hash_new(hash_t *hash, const size_t count) {
+	/* the number of slots */
+	size_t size = MIN_HASH_SIZE;
+
+	assert(NULL != hash);
+
+	/* keep the hash table at most half full */
+	for ( ; (count * 2) > size; size *= 2);
+
+	hash->entries = NULL;
+	hash->size = 0;
+	hash->count = 0;
+	return _resize(hash, size);
+}
+
+void hash_free(hash_t *hash) {
+	assert(NULL != hash);
+	assert(NULL != hash->entries);
+
+	free(hash->entries);
+	hash->entries = NULL;
+}
+
+result_t hash_put(hash_t *hash, const char *key, const void *data) {
+	/* the key slot */
+	hash_entry_t *entry = NULL;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != hash);
+	assert(NULL != hash->entries);
+	assert(NULL != key);
+
+	entry = _find(hash->entries, hash->size, key);
+	if (NULL == entry->key) {
+		/* if the hash table is too full, enlarge it first */
+		if ((hash->count * 2) >= hash->size) {
+			result = _resize(hash, hash->size * 2);
+			if (RESULT_OK != result) {
+				goto end;
+			}
+			entry = _find(hash->entries, hash->size, key);
+		}
+		entry->key = key;
+		++(hash->count);
+	}
+	entry->data = data;
+
+end:
+	return result;
+}
+
+const void *hash_get(const hash_t *hash, const char *key) {
+	assert(NULL != hash);
+	assert(NULL != hash->entries);
+	assert(NULL != key);
+
+	return _find(hash->entries, hash->size, key)->data;
+}
+
+bool hash_contains(const hash_t *hash, const char *key) {
+	assert(NULL != hash);
+	assert(NULL != hash->entries);
+	assert(NULL != key);
+
+	return (NULL != _find(hash->entries, hash->size, key)->key);
+}
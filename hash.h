@@ -0,0 +1,79 @@
+#ifndef _HASH_H_INCLUDED
+#	define _HASH_H_INCLUDED
+
+#	include <stdbool.h>
+#	include <stddef.h>
+
+#	include "result.h"
+
+/*!
+ * @defgroup hash Hash
+ * @brief Hash tables keyed by strings
+ * @{ */
+
+/*!
+ * @def MIN_HASH_SIZE
+ * @brief The initial number of slots in a hash table */
+#	define MIN_HASH_SIZE (64)
+
+/*!
+ * @struct hash_entry_t
+ * @brief A hash table slot */
+typedef struct {
+	const char *key; /*!< The key, or NULL if the slot is free */
+	const void *data; /*!< The payload */
+} hash_entry_t;
+
+/*!
+ * @struct hash_t
+ * @brief A hash table
+ *
+ * Keys and payloads are not copied; they must outlive the hash table. */
+typedef struct {
+	hash_entry_t *entries; /*!< The slots */
+	size_t size; /*!< The number of slots; always a power of 2 */
+	size_t count; /*!< The number of used slots */
+} hash_t;
+
+/*!
+ * @fn result_t hash_new(hash_t *hash, const size_t count)
+ * @brief Creates an empty hash table
+ * @param hash A hash table
+ * @param count The expected number of keys
+ * @see hash_free */
+result_t hash_new(hash_t *hash, const size_t count);
+
+/*!
+ * @fn void hash_free(hash_t *hash)
+ * @brief Frees a hash table
+ * @param hash A hash table
+ * @see hash_new */
+void hash_free(hash_t *hash);
+
+/*!
+ * @fn result_t hash_put(hash_t *hash, const char *key, const void *data)
+ * @brief Associates a payload with a key, replacing the previous payload
+ * @param hash A hash table
+ * @param key The key
+ * @param data The payload */
+result_t hash_put(hash_t *hash, const char *key, const void *data);
+
+/*!
+ * @fn const void *hash_get(const hash_t *hash, const char *key)
+ * @brief Looks up the payload associated with a key
+ * @param hash A hash table
+ * @param key The key
+ * @return The payload, or NULL if the key is not in the hash table */
+const void *hash_get(const hash_t *hash, const char *key);
+
+/*!
+ * @fn bool hash_contains(const hash_t *hash, const char *key)
+ * @brief Determines whether a key is in a hash table
+ * @param hash A hash table
+ * @param key The key */
+bool hash_contains(const hash_t *hash, const char *key);
+
+/*!
+ * @} */
+
+#endif
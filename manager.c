@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <string.h>
 #include <assert.h>
@@ -7,18 +8,28 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "log.h"
 #include "package.h"
 #include "package_ops.h"
+#include "version.h"
+#include "workers.h"
 #include "manager.h"
 
-result_t manager_new(manager_t *manager, const char *prefix, const char *repo) {
+result_t manager_new(manager_t *manager,
+                     const char *prefix,
+                     const char *repo,
+                     const manager_settings_t *settings) {
 	/* the return value */
 	result_t result = RESULT_IO_ERROR;
 
 	assert(NULL != manager);
 	assert(NULL != prefix);
+	assert(NULL != settings);
+
+	/* save the package manager settings */
+	(void) memcpy(&manager->settings, settings, sizeof(manager->settings));
 
 	/* change the root directory to the installation prefix */
 	log_write(LOG_DEBUG, "Changing the working directory to %s\n", prefix);
@@ -63,25 +74,46 @@ result_t manager_new(manager_t *manager, const char *prefix, const char *repo) {
 		log_write(LOG_ERROR, "Failed to open the package database\n");
 		goto release_lock;
 	}
+	result = database_set_durability(&manager->inst_packages,
+	                                 settings->durability);
+	if (RESULT_OK != result) {
+		log_write(LOG_ERROR, "Failed to set the package database durability\n");
+		goto close_inst;
+	}
 
 	/* if a repository was specified, open it */
 	if (NULL != repo) {
-		result = repo_open(&manager->repo, repo);
+		result = repo_open(&manager->repo, repo, settings->concurrency);
 		if (RESULT_OK != result) {
 			log_write(LOG_ERROR, "Failed to open the package repository\n");
 			goto close_inst;
 		}
 
 		/* fetch the repository database */
-		result = repo_get_database(&manager->repo, &manager->avail_packages);
+		result = repo_get_database(&manager->repo,
+		                           &manager->avail_packages,
+		                           settings->background_refresh);
 		if (RESULT_OK != result) {
 			log_write(LOG_ERROR, "Failed to fetch the package database\n");
 			goto close_repo;
 		}
+
+		/* make the available packages visible to queries against the
+		 * installed ones */
+		result = database_attach_metadata(&manager->inst_packages,
+		                                  &manager->avail_packages);
+		if (RESULT_OK != result) {
+			log_write(LOG_ERROR, "Failed to attach the package database\n");
+			goto close_avail;
+		}
 	}
 
-	/* initialize the installation stack */
-	manager->inst_stack = NULL;
+	/* initialize the installation plan */
+	manager->closure = NULL;
+	manager->downloads = NULL;
+	manager->closure_size = 0;
+	manager->rejected = NULL;
+	manager->rejected_count = 0;
 
 	/* save the installation prefix */
 	manager->prefix = prefix;
@@ -90,6 +122,10 @@ result_t manager_new(manager_t *manager, const char *prefix, const char *repo) {
 	result = RESULT_OK;
 	goto end;
 
+close_avail:
+	/* close the metadata database */
+	database_close(&manager->avail_packages);
+
 close_repo:
 	/* close the repository */
 	repo_close(&manager->repo);
@@ -131,70 +167,54 @@ void manager_free(manager_t *manager) {
 	(void) close(manager->lock);
 }
 
+static int _run_dependency_callback(manager_dependency_params_t *params,
+                                    int count,
+                                    char **values,
+                                    char **names) {
+	assert(NULL != params);
+	assert(NULL != params->callback);
+	assert(1 == count);
+	assert(NULL != values[0]);
+
+	params->result = params->callback(values[0], params->arg);
+	if (RESULT_OK != params->result) {
+		return 1;
+	}
+
+	return 0;
+}
+
 result_t manager_for_each_dependency(manager_t *manager,
                                      const char *name,
                                      const dependency_callback_t callback,
                                      void *arg) {
-	/* the package information */
-	package_info_t info = {{0}};
+	/* the callback parameters */
+	manager_dependency_params_t params = {0};
 
 	/* the return value */
 	result_t result = RESULT_OK;
 
-	/* strtok_r()'s position within the dependencies list */
-	char *position = NULL;
-
-	/* a single dependency */
-	char *dependency = NULL;
-
 	assert(NULL != manager);
 	assert(NULL != name);
 	assert(NULL != callback);
 
-	/* get the package metadata */
-	result = database_get_metadata(&manager->avail_packages, name, &info);
-	if (RESULT_OK != result) {
-		goto end;
-	}
-
-	/* if the package has no dependencies, do nothing */
-	assert(NULL != info.p_deps);
-	if (0 == strcmp(NO_DEPENDENCIES, info.p_deps)) {
-		goto free_metadata;
-	}
-
 	/* run the callback for each dependency */
-	dependency = strtok_r(info.p_deps, " ", &position);
-	while (NULL != dependency) {
-		result = callback(dependency, arg);
-		if (RESULT_OK != result)
-			break;
-
-		/* continue to the next dependency */
-		dependency = strtok_r(NULL, " ", &position);
+	params.callback = callback;
+	params.arg = arg;
+	params.result = RESULT_OK;
+	result = database_for_each_dependency(
+	                           &manager->avail_packages,
+	                           name,
+	                           (query_callback_t) _run_dependency_callback,
+	                           &params);
+	if (RESULT_ABORTED == result) {
+		result = params.result;
 	}
 
-free_metadata:
-	/* free the package information */
-	package_info_free(&info);
-
-end:
 	return result;
 }
 
-static result_t _install_dependency(const char *name, void *manager) {
-	assert(NULL != name);
-	assert(NULL != manager);
-
-	return manager_fetch((manager_t *) manager,
-	                     name,
-	                     INSTALLATION_REASON_DEPENDENCY);
-}
-
 result_t manager_is_installed(manager_t *manager, const char *name) {
-	/* the package installation data */
-	package_info_t installation_data = {{0}};
-
 	/* the return value */
 	result_t result = RESULT_NO;
 
@@ -203,62 +223,148 @@ result_t manager_is_installed(manager_t *manager, const char *name) {
 
 	/* check whether the package is already installed */
 	log_write(LOG_DEBUG, "Checking whether %s is already installed\n", name);
-	result = database_get_installation_data(&manager->inst_packages,
-	                                        name,
-	                                        &installation_data);
+	result = database_contains(&manager->inst_packages, name);
 	switch (result) {
-		case RESULT_OK:
+		case RESULT_YES:
 			log_write(LOG_DEBUG, "%s is installed\n", name);
-			package_info_free(&installation_data);
-			result = RESULT_YES;
 			break;
 
-		case RESULT_NOT_FOUND:
+		case RESULT_NO:
 			log_write(LOG_DEBUG, "%s is not installed\n", name);
-			result = RESULT_NO;
 			break;
 	}
 
 	return result;
 }
 
-result_t manager_fetch(manager_t *manager,
-                       const char *name,
-                       const char *reason) {
-	/* the package */
-	package_t package = {0};
+static result_t _reject(manager_t *manager, const char *name) {
+	/* the enlarged list of rejected packages */
+	char **rejected = NULL;
+
+	/* the package name */
+	char *copy = NULL;
+
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	assert(NULL != manager);
+	assert(NULL != name);
+
+	/* copy the name, since it may belong to a query result */
+	copy = strdup(name);
+	if (NULL == copy) {
+		goto end;
+	}
+
+	rejected = realloc(manager->rejected,
+	                   sizeof(char *) * (1 + manager->rejected_count));
+	if (NULL == rejected) {
+		goto free_copy;
+	}
+	manager->rejected = rejected;
+
+	/* mark the package as visited, so it is reported only once even if many
+	 * packages depend on it */
+	result = hash_put(&manager->planned, copy, copy);
+	if (RESULT_OK != result) {
+		goto free_copy;
+	}
+
+	rejected[manager->rejected_count] = copy;
+	++(manager->rejected_count);
+	goto end;
+
+free_copy:
+	/* free the package name */
+	free(copy);
+
+end:
+	return result;
+}
+
+static result_t _plan(manager_t *manager, const char *name);
+
+static result_t _plan_dependency(const char *name, void *manager) {
+	assert(NULL != name);
+	assert(NULL != manager);
+
+	return _plan((manager_t *) manager, name);
+}
 
-	/* the package information */
+static result_t _plan(manager_t *manager, const char *name) {
+	/* the package metadata */
 	package_info_t info = {{0}};
 
-	/* the package contents */
-	fetcher_buffer_t contents = {0};
+	/* the installation data of the installed version, when upgrading */
+	package_info_t installed = {{0}};
+
+	/* the package installation reason */
+	const char *reason = NULL;
+
+	/* the enlarged list of package metadata */
+	package_info_t *closure = NULL;
+
+	/* the enlarged list of package downloads */
+	fetcher_job_t *downloads = NULL;
 
 	/* the return value */
 	result_t result = RESULT_OK;
 
 	assert(NULL != manager);
 	assert(NULL != name);
-	assert(NULL != reason);
-	assert((0 == strcmp(INSTALLATION_REASON_USER, reason)) ||
-	       (0 == strcmp(INSTALLATION_REASON_DEPENDENCY, reason)) ||
-	       (0 == strcmp(INSTALLATION_REASON_CORE, reason)));
 
-	/* if the package is currently being installed, do nothing */
-	if (true == stack_contains(manager->inst_stack,
-	                           (node_comparison_t) strcmp,
-	                           name)) {
+	/* packages requested by the user keep the requested installation reason,
+	 * even if they are dependencies of other requested packages */
+	reason = (const char *) hash_get(&manager->requested, name);
+	if (NULL == reason) {
+		reason = INSTALLATION_REASON_DEPENDENCY;
+	}
+
+	/* if the package was already visited, do nothing - this also breaks
+	 * circular dependencies */
+	if (true == hash_contains(&manager->planned, name)) {
+		if (NULL != hash_get(&manager->planned, name)) {
+			log_write(LOG_DEBUG, "%s cannot be installed\n", name);
+		}
 		goto end;
 	}
 
-	/* check whether the package is already installed */
+	/* if the package is already installed, it does not need to be fetched */
 	result = manager_is_installed(manager, name);
 	switch (result) {
 		case RESULT_NO:
+			/* only installed packages can be upgraded, but new dependencies
+			 * are installed as usual */
+			if ((true == manager->upgrade) &&
+			    (true == hash_contains(&manager->requested, name))) {
+				log_write(LOG_ERROR,
+				          "Cannot upgrade %s; it is not installed\n",
+				          name);
+				if (RESULT_OK == manager->problem) {
+					manager->problem = RESULT_NOT_FOUND;
+				}
+				result = _reject(manager, name);
+				goto end;
+			}
 			break;
 
 		case RESULT_YES:
-			log_write(LOG_WARNING, "%s is already installed; skipping\n", name);
+			/* when upgrading, requested packages are replaced */
+			if ((true == manager->upgrade) &&
+			    (true == hash_contains(&manager->requested, name))) {
+				result = database_get_installation_data(&manager->inst_packages,
+				                                        name,
+				                                        &installed);
+				if (RESULT_OK != result) {
+					goto end;
+				}
+				break;
+			}
+			if (0 != strcmp(INSTALLATION_REASON_DEPENDENCY, reason)) {
+				log_write(LOG_WARNING,
+				          "%s is already installed; skipping\n",
+				          name);
+			}
 			result = RESULT_OK;
 			goto end;
 
@@ -269,23 +375,40 @@ result_t manager_fetch(manager_t *manager,
 			goto end;
 	}
 
-	log_write(LOG_DEBUG, "%s is not installed\n", name);
-
-	/* get the package metadata */
+	/* get the package metadata; if the package is missing, keep planning, so
+	 * all missing packages are reported at once */
 	result = database_get_metadata(&manager->avail_packages, name, &info);
-	if (RESULT_OK != result) {
-		log_write(LOG_ERROR,
-		          "Failed to locate %s in the package database\n",
-		          name);
-		goto end;
+	switch (result) {
+		case RESULT_OK:
+			break;
+
+		case RESULT_NOT_FOUND:
+			log_write(LOG_ERROR,
+			          "Failed to locate %s in the package database\n",
+			          name);
+			if (RESULT_OK == manager->problem) {
+				manager->problem = result;
+			}
+			result = _reject(manager, name);
+			goto free_installed;
+
+		default:
+			goto free_installed;
 	}
 
-	/* push the package to the installation stack */
-	log_write(LOG_DEBUG, "Pushing %s to the installation stack\n", name);
-	result = stack_push(&manager->inst_stack, name);
-	if (RESULT_OK != result) {
-		result = RESULT_MEM_ERROR;
-		goto free_info;
+	/* upgrade the package only if the available version is newer; the
+	 * upgraded package keeps its installation reason */
+	if (NULL != installed.p_name) {
+		if (0 >= version_compare(info.p_version, installed.p_version)) {
+			log_write(LOG_INFO, "%s is up to date\n", name);
+			goto free_info;
+		}
+		log_write(LOG_INFO,
+		          "Upgrading %s from %s to %s\n",
+		          name,
+		          installed.p_version,
+		          info.p_version);
+		reason = installed.p_reason;
 	}
 
 	/* make sure the package is compatible with the architecture the package
@@ -294,350 +417,1301 @@ result_t manager_fetch(manager_t *manager,
 	if (0 == strcmp(DEFAULT_PREFIX, manager->prefix)) {
 		if ((0 != strcmp(ARCH, info.p_arch)) &&
 		    (0 != strcmp(ARCHITECTURE_INDEPENDENT, info.p_arch))) {
-			log_write(LOG_ERROR, "The package is incompatible with %s\n", ARCH);
-			result = RESULT_INCOMPATIBLE;
-			goto pop_from_stack;
+			log_write(LOG_ERROR,
+			          "%s is incompatible with %s\n",
+			          name,
+			          ARCH);
+			if (RESULT_OK == manager->problem) {
+				manager->problem = RESULT_INCOMPATIBLE;
+			}
+			result = _reject(manager, name);
+			goto free_info;
 		}
 	}
 
-	/* fetch the package */
-	log_write(LOG_INFO, "Downloading %s (%s)\n", info.p_file_name, info.p_desc);
-	result = repo_get_package(&manager->repo, &info, &contents);
-	if (RESULT_OK != result) {
-		log_write(LOG_ERROR, "Failed to fetch %s\n", name);
-		goto pop_from_stack;
-	}
-
-	/* open the package */
-	result = package_open(&package, contents.buffer, contents.size);
+	/* mark the package as visited; the name stays valid once the metadata
+	 * moves to the plan */
+	result = hash_put(&manager->planned, info.p_name, NULL);
 	if (RESULT_OK != result) {
-		goto free_contents;
+		goto free_info;
 	}
 
-	/* verify the package integrity */
-	result = package_verify(&package);
+	/* plan the installation of the package dependencies first */
+	log_write(LOG_DEBUG, "Resolving the dependencies of %s\n", name);
+	result = manager_for_each_dependency(manager,
+	                                     name,
+	                                     _plan_dependency,
+	                                     manager);
 	if (RESULT_OK != result) {
-		goto close_package;
+		goto free_info;
 	}
 
 	/* set the package installation reason */
 	info.p_reason = strdup(reason);
 	if (NULL == info.p_reason) {
 		result = RESULT_MEM_ERROR;
-		goto close_package;
-	}
-
-	/* install the package dependencies */
-	log_write(LOG_DEBUG, "Installing the dependencies of %s\n", name);
-	result = manager_for_each_dependency(manager,
-	                                     name,
-	                                     _install_dependency,
-	                                     manager);
-	if (RESULT_OK != result) {
-		goto close_package;
+		goto free_info;
 	}
 
-	/* install the package itself */
-	result = package_install(name, &package, &manager->inst_packages);
-	if (RESULT_OK != result) {
-		goto close_package;
+	/* append the package to the plan, after its dependencies */
+	closure = realloc(manager->closure,
+	                  sizeof(package_info_t) * (1 + manager->closure_size));
+	if (NULL == closure) {
+		result = RESULT_MEM_ERROR;
+		goto free_info;
 	}
-
-	/* register the package */
-	log_write(LOG_INFO, "Registering %s\n", name);
-	result = database_set_installation_data(&manager->inst_packages, &info);
-	if (RESULT_OK != result) {
-		goto close_package;
+	manager->closure = closure;
+	downloads = realloc(manager->downloads,
+	                    sizeof(fetcher_job_t) * (1 + manager->closure_size));
+	if (NULL == downloads) {
+		result = RESULT_MEM_ERROR;
+		goto free_info;
 	}
-
-	/* report success */
-	log_write(LOG_INFO, "Sucessfully installed %s\n", name);
-	result = RESULT_OK;
-
-close_package:
-	/* close the package */
-	package_close(&package);
-
-free_contents:
-	/* free the package contents */
-	free(contents.buffer);
-
-pop_from_stack:
-	/* pop the package from the installation stack */
-	log_write(LOG_DEBUG, "Popping %s from the installation stack\n", name);
-	stack_pop(&manager->inst_stack);
+	manager->downloads = downloads;
+	(void) memcpy(&manager->closure[manager->closure_size],
+	              &info,
+	              sizeof(package_info_t));
+	(void) memset(&manager->downloads[manager->closure_size],
+	              0,
+	              sizeof(fetcher_job_t));
+	++(manager->closure_size);
+	goto free_installed;
 
 free_info:
-	/* free the package information */
+	/* free the package metadata */
 	package_info_free(&info);
 
+free_installed:
+	/* free the installation data of the installed version */
+	package_info_free(&installed);
+
 end:
 	return result;
 }
 
-static int _depends_on(char *name, int count, char **values, char **names) {
-	/* the return value */
-	int abort = 0;
+static void _free_plan(manager_t *manager) {
+	/* a loop index */
+	unsigned int i = 0;
 
-	/* the package dependencies */
-	char *dependencies = NULL;
+	assert(NULL != manager);
 
-	/* strtok_r()'s position within the dependencies list */
-	char *position = NULL;
+	for ( ; manager->closure_size > i; ++i) {
+		package_info_free(&manager->closure[i]);
+		fetcher_buffer_free(&manager->downloads[i].buffer);
+	}
 
-	/* a single dependency */
-	char *dependency = NULL;
+	if (NULL != manager->closure) {
+		free(manager->closure);
+		manager->closure = NULL;
+	}
+	if (NULL != manager->downloads) {
+		free(manager->downloads);
+		manager->downloads = NULL;
+	}
+	manager->closure_size = 0;
 
-	assert(NULL != name);
-	assert(NULL != values[PACKAGE_FIELD_NAME]);
-	assert(NULL != values[PACKAGE_FIELD_DEPS]);
+	hash_free(&manager->requested);
+	hash_free(&manager->planned);
 
-	/* do not check whether the package depends on itself */
-	if (0 == strcmp(values[PACKAGE_FIELD_NAME], name)) {
-		goto end;
+	for (i = 0; manager->rejected_count > i; ++i) {
+		free(manager->rejected[i]);
 	}
+	if (NULL != manager->rejected) {
+		free(manager->rejected);
+		manager->rejected = NULL;
+	}
+	manager->rejected_count = 0;
+}
 
-	log_write(LOG_DEBUG,
-	          "Checking whether %s depends on %s\n",
-	          values[PACKAGE_FIELD_NAME],
-	          name);
+static result_t _stream(manager_t *manager,
+                        const package_info_t *info,
+                        const package_files_t *previous) {
+	/* the package download */
+	fetcher_stream_t download = {0};
 
-	/* duplicate the dependencies list */
-	dependencies = strdup(values[PACKAGE_FIELD_DEPS]);
-	if (NULL == dependencies) {
+	/* the package */
+	package_stream_t package = {0};
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != manager);
+	assert(NULL != info);
+
+	/* start downloading the package */
+	log_write(LOG_INFO, "Downloading %s (%s)\n", info->p_file_name, info->p_desc);
+	result = repo_open_package(&manager->repo, info, &download);
+	if (RESULT_OK != result) {
+		log_write(LOG_ERROR, "Failed to fetch %s\n", info->p_name);
 		goto end;
 	}
 
-	dependency = strtok_r(dependencies, " ", &position);
-	while (NULL != dependency) {
-		if (0 == strcmp(dependency, values[PACKAGE_FIELD_NAME])) {
-			continue;
-		}
-		if (0 == strcmp(name, dependency)) {
-			log_write(LOG_DEBUG,
-			          "%s is required by %s\n",
-			          name,
-			          values[PACKAGE_FIELD_NAME]);
-			abort = 1;
-			break;
-		}
-		dependency = strtok_r(NULL, " ", &position);
-	}
+	/* install the package while it is being downloaded */
+	package_stream_open(&package,
+	                    (package_read_callback_t) fetcher_stream_read,
+	                    &download);
+	result = package_install_stream(info->p_name,
+	                                &package,
+	                                previous,
+	                                manager->settings.writers,
+	                                &manager->inst_packages);
 
-	/* free the dependencies list */
-	free(dependencies);
+	/* stop the download */
+	fetcher_stream_close(&download);
 
 end:
-	return abort;
+	return result;
 }
 
-static result_t _remove(manager_t *manager, const char *name) {
+static result_t _sync(const manager_t *manager) {
+	/* the installation prefix */
+	int fd = (-1);
+
 	/* the return value */
 	result_t result = RESULT_OK;
 
 	assert(NULL != manager);
-	assert(NULL != name);
-
-	log_write(LOG_INFO, "Removing files installed by %s\n", name);
 
-	/* remove the package */
-	result = package_remove(name, &manager->inst_packages);
-	if (RESULT_OK != result) {
+	/* with the image building profile, nothing is synced */
+	if (DURABILITY_IMAGE_BUILD == manager->settings.durability) {
 		goto end;
 	}
 
-	/* report success */
-	log_write(LOG_INFO, "Successfully removed %s\n", name);
-	result = RESULT_OK;
+	/* files are extracted without syncing each of them; instead, the whole
+	 * file system is synced once */
+	log_write(LOG_DEBUG, "Syncing the installed files\n");
+	fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (-1 == fd) {
+		result = RESULT_IO_ERROR;
+		goto end;
+	}
+	if (-1 == syncfs(fd)) {
+		log_write(LOG_ERROR, "Failed to sync the installed files\n");
+		result = RESULT_IO_ERROR;
+	}
+	(void) close(fd);
 
 end:
 	return result;
 }
 
-result_t manager_remove(manager_t *manager, const char *name) {
+static result_t _install(manager_t *manager,
+                         const package_info_t *info,
+                         archive_staging_t *staging,
+                         const package_files_t *previous) {
 	/* the return value */
 	result_t result = RESULT_OK;
 
 	assert(NULL != manager);
-	assert(NULL != name);
+	assert(NULL != info);
+	assert(NULL != previous);
 
-	/* make sure the package is installed */
-	result = manager_is_installed(manager, name);
-	if (RESULT_YES != result) {
-		log_write(LOG_ERROR, "Cannot remove %s; it is not installed\n", name);
+	/* register the package and its files in a single transaction, so the
+	 * installation data is written to disk once */
+	result = database_begin(&manager->inst_packages);
+	if (RESULT_OK != result) {
+		if (NULL != staging) {
+			archive_staging_rollback(staging);
+			archive_staging_free(staging);
+		}
 		goto end;
 	}
 
-	/* make sure the package can be removed - if it's not installed, this check
-	 * will fail  */
-	if (RESULT_YES != manager_can_remove(manager, name)) {
-		log_write(LOG_ERROR, "%s cannot be removed\n", name);
-		goto end;
+	/* put the package files in place; in streaming mode, the package is
+	 * downloaded while it is being installed */
+	if (NULL == staging) {
+		result = _stream(manager, info, previous);
+	} else {
+		result = package_commit(info->p_name,
+		                        staging,
+		                        previous,
+		                        &manager->inst_packages);
+	}
+	if (RESULT_OK != result) {
+		goto rollback;
 	}
 
-	/* remove the package */
-	result = _remove(manager, name);
+	/* if another version of the package is installed, replace its
+	 * installation data */
+	result = database_contains(&manager->inst_packages, info->p_name);
+	switch (result) {
+		case RESULT_NO:
+			break;
+
+		case RESULT_YES:
+			result = database_remove_installation_data(&manager->inst_packages,
+			                                           info->p_name);
+			if (RESULT_OK != result) {
+				goto rollback;
+			}
+			break;
+
+		default:
+			goto rollback;
+	}
+
+	/* register the package */
+	log_write(LOG_INFO, "Registering %s\n", info->p_name);
+	result = database_set_installation_data(&manager->inst_packages, info);
 	if (RESULT_OK != result) {
-		goto end;
+		goto rollback;
+	}
+
+	/* make sure the package files reach the disk before the installation
+	 * data refers to them */
+	result = _sync(manager);
+	if (RESULT_OK != result) {
+		goto rollback;
+	}
+
+	result = database_commit(&manager->inst_packages);
+	if (RESULT_OK != result) {
+		goto rollback;
 	}
 
+	/* delete the files of the replaced version only once nothing refers to
+	 * them anymore */
+	package_prune(previous, &manager->inst_packages);
+
 	/* report success */
+	log_write(LOG_INFO, "Sucessfully installed %s\n", info->p_name);
 	result = RESULT_OK;
+	goto end;
+
+rollback:
+	/* discard the registration of the package files */
+	database_rollback(&manager->inst_packages);
 
 end:
 	return result;
 }
 
-result_t manager_can_remove(manager_t *manager, const char *name) {
-	/* the package installation data */
-	package_info_t installation_data = {{0}};
+static result_t _install_stream(manager_t *manager,
+                                const package_info_t *info) {
+	/* the files of the installed version of the package, if any */
+	package_files_t previous = {0};
 
 	/* the return value */
-	result_t result = RESULT_NO;
+	result_t result = RESULT_OK;
 
 	assert(NULL != manager);
-	assert(NULL != name);
-
-	log_write(LOG_DEBUG, "Checking whether %s can be removed\n", name);
+	assert(NULL != info);
 
-	/* get the package installation data */
-	result = database_get_installation_data(&manager->inst_packages,
-	                                        name,
-	                                        &installation_data);
+	result = package_files_load(&previous,
+	                            info->p_name,
+	                            &manager->inst_packages);
 	if (RESULT_OK != result) {
 		goto end;
 	}
 
-	/* do not allow core packages to be removed */
-	if (0 == strcmp(INSTALLATION_REASON_CORE, installation_data.p_reason)) {
-		log_write(LOG_DEBUG,
-		          "%s cannot be removed because it is a core package\n",
-		          name);
-		goto free_installation_data;
-	}
-
-	/* check whether another package depends on the removed one */
-	log_write(LOG_DEBUG,
-	          "Checking whether another package depends on %s\n",
-	          name);
-	result = database_for_each_inst_package(&manager->inst_packages,
-	                                        (query_callback_t) _depends_on,
-	                                        (char *) name);
-	switch (result) {
-		case RESULT_ABORTED:
-			log_write(
-			     LOG_DEBUG,
-			     "%s cannot be removed because another package depends on it\n",
-			     name);
-			result = RESULT_NO;
-			break;
-
-		case RESULT_OK:
-			log_write(LOG_DEBUG, "%s is no longer needed\n", name);
-			result = RESULT_YES;
-			break;
-	}
+	result = _install(manager, info, NULL, &previous);
 
-free_installation_data:
-	/* free the package installation data */
-	package_info_free(&installation_data);
+	/* free the files of the installed version */
+	package_files_free(&previous);
 
 end:
 	return result;
 }
 
-static int _remove_unneeded(manager_cleanup_params_t *params,
-                            int count,
-                            char **values,
-                            char **names) {
-	/* the package installation data */
-	package_info_t installation_data = {{0}};
-
+static result_t _stage(const package_info_t *info,
+                       fetcher_buffer_t *contents,
+                       const unsigned int decompressors,
+                       const unsigned int writers,
+                       manager_extraction_t *extraction) {
 	/* the return value */
-	int abort = 0;
+	result_t result = RESULT_OK;
 
-	assert(NULL != params);
-	assert(NULL != params->manager);
-	assert(NULL != values[PACKAGE_FIELD_NAME]);
+	assert(NULL != info);
+	assert(NULL != contents);
+	assert(NULL != contents->buffer);
+	assert(NULL != extraction);
 
-	log_write(LOG_DEBUG,
-	          "Attempting to auto-remove %s\n",
-	          values[PACKAGE_FIELD_NAME]);
-
-	/* get the package installation data */
-	if (RESULT_OK != database_get_installation_data(
-		                                        &params->manager->inst_packages,
-	                                            values[PACKAGE_FIELD_NAME],
-	                                            &installation_data)) {
-		abort = 1;
+	/* open the package */
+	result = package_open(&extraction->package,
+	                      contents->buffer,
+	                      contents->size);
+	if (RESULT_OK != result) {
 		goto end;
 	}
 
-	/* if the package is a dependency, it cannot be cleaned up automatically -
-	 * otherwise, the user's applications will just disappear */
-	if (0 != strcmp(installation_data.p_reason,
-	                INSTALLATION_REASON_DEPENDENCY)) {
-		log_write(
-		  LOG_DEBUG,
-		  "%s cannot be removed because it was not installed as a dependency\n",
-		  values[PACKAGE_FIELD_NAME]);
-		goto free_installation_data;
+	/* verify the package integrity */
+	result = package_verify(&extraction->package);
+	if (RESULT_OK != result) {
+		goto close_package;
 	}
 
-	/* remove all uneeded packages */
-	if (RESULT_YES == manager_can_remove(params->manager,
-	                                     values[PACKAGE_FIELD_NAME])) {
-		if (RESULT_OK == _remove(params->manager, values[PACKAGE_FIELD_NAME])) {
-			++(params->removed);
-		} else {
-			log_write(LOG_ERROR,
-			          "Failed to auto-remove %s\n",
-			          values[PACKAGE_FIELD_NAME]);
-			abort = 1;
-		}
-	} else {
-		log_write(LOG_DEBUG,
-		          "%s cannot be auto-removed\n",
-		          values[PACKAGE_FIELD_NAME]);
+	/* extract the package, without putting its files in place */
+	result = package_stage(info->p_name,
+	                       &extraction->package,
+	                       &extraction->previous,
+	                       decompressors,
+	                       writers,
+	                       &extraction->staging);
+	if (RESULT_OK == result) {
+		goto end;
 	}
 
-free_installation_data:
-	/* free the package installation data */
-	package_info_free(&installation_data);
+close_package:
+	/* close the package */
+	package_close(&extraction->package);
 
 end:
-	return abort;
+	return result;
 }
 
-result_t manager_cleanup(manager_t *manager) {
-	/* the callback parameters */
-	manager_cleanup_params_t params = {0};
-
-	/* the return value */
+static void *_extract_packages(manager_pool_t *pool) {
+	/* the return value of the last extraction */
 	result_t result = RESULT_OK;
 
-	assert(NULL != manager);
+	/* the index of the extracted package */
+	unsigned int i = 0;
 
-	log_write(LOG_INFO, "Cleaning up unneeded packages\n");
+	assert(NULL != pool);
+
+	(void) pthread_mutex_lock(&pool->lock);
+
+	/* extract packages in installation order, so the main thread waits as
+	 * little as possible */
+	while ((false == pool->stop) &&
+	       (pool->manager->closure_size > pool->next)) {
+		i = pool->next;
+		++(pool->next);
+		(void) pthread_mutex_unlock(&pool->lock);
+
+		result = _stage(&pool->manager->closure[i],
+		                &pool->manager->downloads[i].buffer,
+		                pool->manager->settings.decompressors,
+		                pool->manager->settings.writers,
+		                &pool->extractions[i]);
+
+		(void) pthread_mutex_lock(&pool->lock);
+		pool->extractions[i].result = result;
+		pool->extractions[i].done = true;
+		(void) pthread_cond_broadcast(&pool->extracted);
+	}
+
+	(void) pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static result_t _install_packages(manager_t *manager) {
+	/* the worker threads */
+	workers_t threads = {0};
+
+	/* the extracted package */
+	manager_extraction_t *extraction = NULL;
+
+	/* the worker thread pool */
+	manager_pool_t pool = {0};
+
+	/* the number of worker threads */
+	unsigned int count = 0;
+
+	/* the number of packages whose installed files were loaded */
+	unsigned int loaded = 0;
+
+	/* loop indices */
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	assert(NULL != manager);
+	assert(0 < manager->closure_size);
+	assert(0 < manager->settings.workers);
+
+	/* allocate memory for the extracted packages */
+	pool.extractions = calloc(manager->closure_size,
+	                          sizeof(manager_extraction_t));
+	if (NULL == pool.extractions) {
+		goto end;
+	}
+	count = manager->settings.workers;
+	if (manager->closure_size < count) {
+		count = manager->closure_size;
+	}
+
+	/* load the files of installed versions, so unchanged files are not
+	 * extracted again; the worker threads do not access the database */
+	for ( ; manager->closure_size > loaded; ++loaded) {
+		result = package_files_load(&pool.extractions[loaded].previous,
+		                            manager->closure[loaded].p_name,
+		                            &manager->inst_packages);
+		if (RESULT_OK != result) {
+			goto free_previous;
+		}
+	}
+
+	result = RESULT_MEM_ERROR;
+	pool.manager = manager;
+	pool.next = 0;
+	pool.stop = false;
+	if (0 != pthread_mutex_init(&pool.lock, NULL)) {
+		goto free_previous;
+	}
+	if (0 != pthread_cond_init(&pool.extracted, NULL)) {
+		goto destroy_lock;
+	}
+
+	/* start the worker threads */
+	count = workers_start(&threads,
+	                      count,
+	                      (worker_routine_t) _extract_packages,
+	                      &pool);
+	log_write(LOG_DEBUG, "Extracting packages using %u threads\n", count);
+	if (0 == count) {
+		(void) _extract_packages(&pool);
+	}
+
+	/* put the packages in place and register them in installation order,
+	 * so each package is registered after its dependencies */
+	result = RESULT_OK;
+	for ( ; manager->closure_size > i; ++i) {
+		extraction = &pool.extractions[i];
+
+		/* wait until the package is extracted */
+		(void) pthread_mutex_lock(&pool.lock);
+		while (false == extraction->done) {
+			(void) pthread_cond_wait(&pool.extracted, &pool.lock);
+		}
+		(void) pthread_mutex_unlock(&pool.lock);
+		result = extraction->result;
+		if (RESULT_OK != result) {
+			/* delete the files extracted before the failure */
+			package_unstage(&extraction->staging, &manager->inst_packages);
+			break;
+		}
+
+		/* if the package was downloaded, cache it */
+		if (false == manager->downloads[i].buffer.mapped) {
+			repo_cache_package(&manager->repo,
+			                   &manager->closure[i],
+			                   &extraction->package);
+		}
+		package_close(&extraction->package);
+
+		result = _install(manager,
+		                  &manager->closure[i],
+		                  &extraction->staging,
+		                  &extraction->previous);
+		if (RESULT_OK != result) {
+			break;
+		}
+
+		/* free each package once it is installed */
+		fetcher_buffer_free(&manager->downloads[i].buffer);
+	}
+
+	/* stop the worker threads */
+	(void) pthread_mutex_lock(&pool.lock);
+	pool.stop = true;
+	(void) pthread_mutex_unlock(&pool.lock);
+	workers_join(&threads);
+
+	/* if a package failed to install, delete the files of all packages
+	 * extracted after it */
+	for (j = 1 + i; manager->closure_size > j; ++j) {
+		if (false == pool.extractions[j].done) {
+			continue;
+		}
+		if (RESULT_OK == pool.extractions[j].result) {
+			package_close(&pool.extractions[j].package);
+		}
+		package_unstage(&pool.extractions[j].staging,
+		                &manager->inst_packages);
+	}
+
+	(void) pthread_cond_destroy(&pool.extracted);
+
+destroy_lock:
+	(void) pthread_mutex_destroy(&pool.lock);
+
+free_previous:
+	for (j = 0; loaded > j; ++j) {
+		package_files_free(&pool.extractions[j].previous);
+	}
+	free(pool.extractions);
+
+end:
+	return result;
+}
+
+static result_t _fetch(manager_t *manager,
+                       char *const *names,
+                       const unsigned int count,
+                       const char *reason) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != manager);
+	assert(NULL != names);
+	assert(0 < count);
+	assert(NULL != reason);
+
+	/* find all packages which need to be installed and sort them, before
+	 * anything is downloaded */
+	log_write(LOG_DEBUG, "Planning the installation of %u packages\n", count);
+	result = hash_new(&manager->requested, count);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	result = hash_new(&manager->planned, count);
+	if (RESULT_OK != result) {
+		hash_free(&manager->requested);
+		goto end;
+	}
+	for ( ; count > i; ++i) {
+		result = hash_put(&manager->requested, names[i], reason);
+		if (RESULT_OK != result) {
+			goto free_plan;
+		}
+	}
+	manager->problem = RESULT_OK;
+	for (i = 0; count > i; ++i) {
+		result = _plan(manager, names[i]);
+		if (RESULT_OK != result) {
+			goto free_plan;
+		}
+	}
+	if (RESULT_OK != manager->problem) {
+		log_write(LOG_ERROR,
+		          "Cannot %s the requested packages\n",
+		          (true == manager->upgrade) ? "upgrade" : "install");
+		result = manager->problem;
+		goto free_plan;
+	}
+	log_write(LOG_DEBUG,
+	          "%u packages need to be installed\n",
+	          manager->closure_size);
+	if (0 == manager->closure_size) {
+		goto free_plan;
+	}
+
+	/* download all packages at once, unless each package is downloaded while
+	 * it is being installed */
+	if (false == manager->settings.stream) {
+		for (i = 0; manager->closure_size > i; ++i) {
+			log_write(LOG_INFO,
+			          "Downloading %s (%s)\n",
+			          manager->closure[i].p_file_name,
+			          manager->closure[i].p_desc);
+		}
+		result = repo_get_packages(&manager->repo,
+		                           manager->closure,
+		                           manager->downloads,
+		                           manager->closure_size);
+		if (RESULT_OK != result) {
+			log_write(LOG_ERROR, "Failed to fetch the packages\n");
+			goto free_plan;
+		}
+	}
+
+	/* install the packages, each after its dependencies */
+	if (true == manager->settings.stream) {
+		for (i = 0; manager->closure_size > i; ++i) {
+			result = _install_stream(manager, &manager->closure[i]);
+			if (RESULT_OK != result) {
+				break;
+			}
+		}
+	} else {
+		result = _install_packages(manager);
+	}
+
+free_plan:
+	/* free the installation plan and all fetched packages */
+	_free_plan(manager);
+
+end:
+	return result;
+}
+
+result_t manager_fetch(manager_t *manager,
+                       char *const *names,
+                       const unsigned int count,
+                       const char *reason) {
+	assert(NULL != manager);
+	assert(NULL != names);
+	assert(0 < count);
+	assert(NULL != reason);
+	assert((0 == strcmp(INSTALLATION_REASON_USER, reason)) ||
+	       (0 == strcmp(INSTALLATION_REASON_CORE, reason)));
+
+	manager->upgrade = false;
+	return _fetch(manager, names, count, reason);
+}
+
+static int _add_name(manager_name_list_t *list,
+                     int count,
+                     char **values,
+                     char **names) {
+	/* the enlarged list of package names */
+	char **more_names = NULL;
+
+	assert(NULL != list);
+	assert((int) PACKAGE_FIELD_NAME == (int) UPGRADE_FIELD_NAME);
+	assert(NULL != values[PACKAGE_FIELD_NAME]);
+
+	more_names = realloc(list->names, sizeof(char *) * (1 + list->count));
+	if (NULL == more_names) {
+		return 1;
+	}
+	list->names = more_names;
+
+	more_names[list->count] = strdup(values[PACKAGE_FIELD_NAME]);
+	if (NULL == more_names[list->count]) {
+		return 1;
+	}
+	++(list->count);
+
+	return 0;
+}
+
+result_t manager_upgrade(manager_t *manager,
+                         char *const *names,
+                         const unsigned int count) {
+	/* the names of all upgradable packages */
+	manager_name_list_t upgradable = {0};
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != manager);
+	assert((NULL != names) || (0 == count));
+
+	manager->upgrade = true;
+
+	/* if no packages were specified, upgrade all packages with a newer version
+	 * in the repository */
+	if (0 < count) {
+		result = _fetch(manager, names, count, INSTALLATION_REASON_USER);
+		goto end;
+	}
+
+	result = database_for_each_upgradable_package(
+	                                       &manager->inst_packages,
+	                                       (query_callback_t) _add_name,
+	                                       &upgradable);
+	if (RESULT_OK != result) {
+		goto free_names;
+	}
+	if (0 == upgradable.count) {
+		log_write(LOG_INFO, "All packages are up to date\n");
+		goto free_names;
+	}
+	result = _fetch(manager,
+	                upgradable.names,
+	                upgradable.count,
+	                INSTALLATION_REASON_USER);
+
+free_names:
+	/* free the list of upgradable packages */
+	for ( ; upgradable.count > i; ++i) {
+		free(upgradable.names[i]);
+	}
+	if (NULL != upgradable.names) {
+		free(upgradable.names);
+	}
+
+end:
+	manager->upgrade = false;
+	return result;
+}
+
+static const char *g_file_statuses[FILE_STATUSES_COUNT] = {
+	"ok",
+	"missing",
+	"type",
+	"mode",
+	"size",
+	"contents",
+	"unreadable"
+};
+
+static void *_check_files(manager_verifier_t *verifier) {
+	/* the package whose files are checked */
+	manager_check_t *check = NULL;
+
+	/* the index of the first file in a batch */
+	unsigned int first = 0;
+
+	/* the index of the file after the last file in a batch */
+	unsigned int last = 0;
+
+	assert(NULL != verifier);
 
-	/* remove unneeded packages again and again, until no uneeded packages are
-	 * found */
 	do {
-		params.manager = manager;
-		params.removed = 0;
-		result = database_for_each_inst_package(
-			                                &manager->inst_packages,
-	                                        (query_callback_t) _remove_unneeded,
-	                                        &params);
+		(void) pthread_mutex_lock(&verifier->lock);
+
+		/* skip packages whose files were all handed out */
+		while ((verifier->count > verifier->package) &&
+		       (verifier->checks[verifier->package].files.count <=
+		        verifier->file)) {
+			++(verifier->package);
+			verifier->file = 0;
+		}
+		if (verifier->count <= verifier->package) {
+			(void) pthread_mutex_unlock(&verifier->lock);
+			break;
+		}
+
+		/* take the next batch of files */
+		check = &verifier->checks[verifier->package];
+		first = verifier->file;
+		last = first + VERIFICATION_BATCH_SIZE;
+		if (check->files.count < last) {
+			last = check->files.count;
+		}
+		verifier->file = last;
+
+		(void) pthread_mutex_unlock(&verifier->lock);
+
+		for ( ; last > first; ++first) {
+			check->statuses[first] = package_check_file(
+			                                      check->files.paths[first],
+			                                      &check->files.states[first]);
+		}
+	} while (1);
+
+	return NULL;
+}
+
+result_t manager_verify(manager_t *manager,
+                        char *const *names,
+                        const unsigned int count) {
+	/* the names of all installed packages */
+	manager_name_list_t installed = {0};
+
+	/* the worker thread pool */
+	manager_verifier_t verifier = {0};
+
+	/* the worker threads */
+	workers_t threads = {0};
+
+	/* the checked package */
+	manager_check_t *check = NULL;
+
+	/* the names of the checked packages */
+	char *const *packages = names;
+
+	/* the number of checked packages */
+	unsigned int packages_count = count;
+
+	/* the number of packages whose files were loaded */
+	unsigned int loaded = 0;
+
+	/* loop indices */
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	/* the number of files which do not match their recorded state */
+	unsigned long problems = 0;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != manager);
+	assert((NULL != names) || (0 == count));
+	assert(0 < manager->settings.workers);
+
+	/* if no packages were specified, verify all installed packages */
+	if (0 == count) {
+		result = database_for_each_inst_package(&manager->inst_packages,
+		                                        (query_callback_t) _add_name,
+		                                        &installed);
+		if (RESULT_OK != result) {
+			goto free_names;
+		}
+		packages = installed.names;
+		packages_count = installed.count;
+	}
+	if (0 == packages_count) {
+		goto free_names;
+	}
+
+	verifier.checks = calloc(packages_count, sizeof(manager_check_t));
+	if (NULL == verifier.checks) {
+		result = RESULT_MEM_ERROR;
+		goto free_names;
+	}
+	verifier.count = packages_count;
+
+	/* load the files of all packages; the worker threads do not access the
+	 * database */
+	for ( ; packages_count > loaded; ++loaded) {
+		check = &verifier.checks[loaded];
+		check->name = packages[loaded];
+		result = database_contains(&manager->inst_packages, check->name);
+		switch (result) {
+			case RESULT_YES:
+				break;
+
+			case RESULT_NO:
+				log_write(LOG_ERROR, "%s is not installed\n", check->name);
+				result = RESULT_NOT_FOUND;
+
+				/* fall-through */
+
+			default:
+				goto free_checks;
+		}
+		result = package_files_load(&check->files,
+		                            check->name,
+		                            &manager->inst_packages);
+		if (RESULT_OK != result) {
+			goto free_checks;
+		}
+		check->statuses = malloc(sizeof(file_status_t) *
+		                         (1 + check->files.count));
+		if (NULL == check->statuses) {
+			package_files_free(&check->files);
+			result = RESULT_MEM_ERROR;
+			goto free_checks;
+		}
+	}
+
+	/* start the worker threads */
+	if (0 != pthread_mutex_init(&verifier.lock, NULL)) {
+		result = RESULT_MEM_ERROR;
+		goto free_checks;
+	}
+	(void) workers_start(&threads,
+	                     manager->settings.workers,
+	                     (worker_routine_t) _check_files,
+	                     &verifier);
+	log_write(LOG_DEBUG,
+	          "Verifying files using %u threads\n",
+	          threads.count);
+	if (0 == threads.count) {
+		(void) _check_files(&verifier);
+	}
+	workers_join(&threads);
+	(void) pthread_mutex_destroy(&verifier.lock);
+
+	/* report all files which do not match their recorded state */
+	for (i = 0; verifier.count > i; ++i) {
+		check = &verifier.checks[i];
+		for (j = 0; check->files.count > j; ++j) {
+			if (FILE_STATUS_OK != check->statuses[j]) {
+				log_dumpf("%s|%s|%s\n",
+				          check->name,
+				          check->files.paths[j],
+				          g_file_statuses[check->statuses[j]]);
+				++problems;
+			}
+		}
+	}
+	if (0 < problems) {
+		log_write(LOG_ERROR, "%lu files are damaged\n", problems);
+		result = RESULT_CORRUPT_DATA;
+	}
+
+free_checks:
+	for (i = 0; loaded > i; ++i) {
+		package_files_free(&verifier.checks[i].files);
+		free(verifier.checks[i].statuses);
+	}
+	free(verifier.checks);
+
+free_names:
+	/* free the list of installed packages */
+	for (i = 0; installed.count > i; ++i) {
+		free(installed.names[i]);
+	}
+	if (NULL != installed.names) {
+		free(installed.names);
+	}
+
+	return result;
+}
+
+static result_t _remove(manager_t *manager, const char *name) {
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != manager);
+	assert(NULL != name);
+
+	log_write(LOG_INFO, "Removing files installed by %s\n", name);
+
+	/* unregister the package and its files in a single transaction; deleted
+	 * files cannot be restored, so each package is committed before the next
+	 * one is removed */
+	result = database_begin(&manager->inst_packages);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+
+	/* remove the package */
+	result = package_remove(name, &manager->inst_packages);
+	if (RESULT_OK != result) {
+		goto rollback;
+	}
+
+	result = database_commit(&manager->inst_packages);
+	if (RESULT_OK != result) {
+		goto rollback;
+	}
+
+	/* report success */
+	log_write(LOG_INFO, "Successfully removed %s\n", name);
+	goto end;
+
+rollback:
+	/* discard the unregistration of the package */
+	database_rollback(&manager->inst_packages);
+
+end:
+	return result;
+}
+
+static int _add_node(manager_graph_t *graph,
+                     int count,
+                     char **values,
+                     char **names) {
+	/* the enlarged list of installed packages */
+	manager_node_t *nodes = NULL;
+
+	assert(INSTALLATION_DATA_FIELDS_COUNT == count);
+	assert(NULL != graph);
+	assert(NULL != values[PACKAGE_FIELD_NAME]);
+	assert(NULL != values[PACKAGE_FIELD_REASON]);
+
+	nodes = realloc(graph->nodes, sizeof(manager_node_t) * (1 + graph->count));
+	if (NULL == nodes) {
+		return 1;
+	}
+	graph->nodes = nodes;
+
+	/* packages installed by the user and core packages are the roots of the
+	 * graph */
+	nodes[graph->count].name = strdup(values[PACKAGE_FIELD_NAME]);
+	if (NULL == nodes[graph->count].name) {
+		return 1;
+	}
+	nodes[graph->count].root = (0 != strcmp(INSTALLATION_REASON_DEPENDENCY,
+	                                        values[PACKAGE_FIELD_REASON]));
+	nodes[graph->count].core = (0 == strcmp(INSTALLATION_REASON_CORE,
+	                                        values[PACKAGE_FIELD_REASON]));
+	nodes[graph->count].marked = false;
+	nodes[graph->count].dependencies = NULL;
+	nodes[graph->count].dependencies_count = 0;
+	++(graph->count);
+
+	return 0;
+}
+
+static int _add_edge(manager_graph_t *graph,
+                     int count,
+                     char **values,
+                     char **names) {
+	/* the dependent package */
+	manager_node_t *package = NULL;
+
+	/* the dependency */
+	manager_node_t *dependency = NULL;
+
+	/* the enlarged list of dependencies */
+	manager_node_t **dependencies = NULL;
+
+	assert(2 == count);
+	assert(NULL != graph);
+	assert(NULL != values[DEPENDENCY_FIELD_PACKAGE]);
+	assert(NULL != values[DEPENDENCY_FIELD_DEPENDS_ON]);
+
+	/* ignore dependencies which are not installed and packages which depend
+	 * on themselves */
+	package = (manager_node_t *) hash_get(&graph->index,
+	                                      values[DEPENDENCY_FIELD_PACKAGE]);
+	dependency = (manager_node_t *) hash_get(
+	                                       &graph->index,
+	                                       values[DEPENDENCY_FIELD_DEPENDS_ON]);
+	if ((NULL == package) || (NULL == dependency) || (package == dependency)) {
+		return 0;
+	}
+
+	dependencies = realloc(package->dependencies,
+	                       sizeof(manager_node_t *) *
+	                       (1 + package->dependencies_count));
+	if (NULL == dependencies) {
+		return 1;
+	}
+	dependencies[package->dependencies_count] = dependency;
+	package->dependencies = dependencies;
+	++(package->dependencies_count);
+
+	return 0;
+}
+
+static void _free_graph(manager_graph_t *graph) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != graph);
+
+	if (NULL != graph->index.entries) {
+		hash_free(&graph->index);
+	}
+
+	for ( ; graph->count > i; ++i) {
+		if (NULL != graph->nodes[i].dependencies) {
+			free(graph->nodes[i].dependencies);
+		}
+		if (NULL != graph->nodes[i].name) {
+			free(graph->nodes[i].name);
+		}
+	}
+
+	if (NULL != graph->nodes) {
+		free(graph->nodes);
+	}
+}
+
+static result_t _load_graph(manager_t *manager, manager_graph_t *graph) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != manager);
+	assert(NULL != graph);
+
+	/* list all installed packages */
+	log_write(LOG_DEBUG, "Loading the dependency graph\n");
+	result = database_for_each_inst_package(&manager->inst_packages,
+	                                        (query_callback_t) _add_node,
+	                                        graph);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+
+	/* index the packages by name, once the list no longer moves */
+	result = hash_new(&graph->index, graph->count);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	for ( ; graph->count > i; ++i) {
+		result = hash_put(&graph->index,
+		                  graph->nodes[i].name,
+		                  &graph->nodes[i]);
+		if (RESULT_OK != result) {
+			goto end;
+		}
+	}
+
+	/* connect each package to its dependencies */
+	result = database_for_each_dependency_pair(&manager->inst_packages,
+	                                           (query_callback_t) _add_edge,
+	                                           graph);
+
+end:
+	return result;
+}
+
+static result_t _mark(manager_graph_t *graph) {
+	/* the packages whose dependencies have not been marked yet */
+	manager_node_t **pending = NULL;
+
+	/* the package whose dependencies are being marked */
+	manager_node_t *node = NULL;
+
+	/* the number of pending packages */
+	unsigned int count = 0;
+
+	/* loop indices */
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	assert(NULL != graph);
+
+	if (0 == graph->count) {
+		return RESULT_OK;
+	}
+
+	/* each package is marked once, so it is pending at most once */
+	pending = malloc(sizeof(manager_node_t *) * graph->count);
+	if (NULL == pending) {
+		return RESULT_MEM_ERROR;
+	}
+
+	/* mark all packages reachable from the roots */
+	for ( ; graph->count > i; ++i) {
+		if ((false == graph->nodes[i].root) ||
+		    (true == graph->nodes[i].marked)) {
+			continue;
+		}
+		graph->nodes[i].marked = true;
+		pending[count++] = &graph->nodes[i];
+
+		while (0 < count) {
+			node = pending[--count];
+			for (j = 0; node->dependencies_count > j; ++j) {
+				if (false == node->dependencies[j]->marked) {
+					node->dependencies[j]->marked = true;
+					pending[count++] = node->dependencies[j];
+				}
+			}
+		}
+	}
+
+	free(pending);
+	return RESULT_OK;
+}
+
+static void _sort(manager_node_t *node,
+                  manager_node_t **order,
+                  unsigned int *count) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != node);
+	assert(NULL != order);
+	assert(NULL != count);
+
+	/* skip needed packages and packages which were already sorted */
+	if (true == node->marked) {
+		return;
+	}
+	node->marked = true;
+
+	/* put each package after its dependencies */
+	for ( ; node->dependencies_count > i; ++i) {
+		_sort(node->dependencies[i], order, count);
+	}
+	order[(*count)++] = node;
+}
+
+static result_t _collect(manager_t *manager,
+                         char *const *targets,
+                         const unsigned int targets_count) {
+	/* the dependency graph */
+	manager_graph_t graph = {0};
+
+	/* a removed package */
+	manager_node_t *target = NULL;
+
+	/* the unneeded packages, each after its dependencies */
+	manager_node_t **order = NULL;
+
+	/* the number of unneeded packages */
+	unsigned int count = 0;
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != manager);
+	assert((NULL != targets) || (0 == targets_count));
+
+	/* load the dependency graph once */
+	result = _load_graph(manager, &graph);
+	if (RESULT_OK != result) {
+		goto free_graph;
+	}
+
+	/* packages removed by the user are no longer roots */
+	for ( ; targets_count > i; ++i) {
+		target = (manager_node_t *) hash_get(&graph.index, targets[i]);
+		if (NULL == target) {
+			log_write(LOG_ERROR,
+			          "Cannot remove %s; it is not installed\n",
+			          targets[i]);
+			result = RESULT_NOT_FOUND;
+			goto free_graph;
+		}
+		if (true == target->core) {
+			log_write(LOG_ERROR,
+			          "%s cannot be removed because it is a core package\n",
+			          targets[i]);
+			result = RESULT_NO;
+			goto free_graph;
+		}
+		target->root = false;
+	}
+
+	/* mark all needed packages; if a removed package is still needed by
+	 * another package, nothing is removed */
+	result = _mark(&graph);
+	if (RESULT_OK != result) {
+		goto free_graph;
+	}
+	for (i = 0; targets_count > i; ++i) {
+		target = (manager_node_t *) hash_get(&graph.index, targets[i]);
+		if (true == target->marked) {
+			log_write(
+			     LOG_ERROR,
+			     "%s cannot be removed because another package depends on it\n",
+			     targets[i]);
+			result = RESULT_NO;
+		}
+	}
+	if (RESULT_OK != result) {
+		goto free_graph;
+	}
+
+	/* sort the unneeded packages */
+	order = malloc(sizeof(manager_node_t *) * (1 + graph.count));
+	if (NULL == order) {
+		result = RESULT_MEM_ERROR;
+		goto free_graph;
+	}
+	for (i = 0; graph.count > i; ++i) {
+		_sort(&graph.nodes[i], order, &count);
+	}
+	if (0 == count) {
+		log_write(LOG_DEBUG, "Found no unneeded packages\n");
+		goto free_order;
+	}
+
+	/* remove all unneeded packages, each before its dependencies */
+	log_write(LOG_INFO, "Removing %u packages\n", count);
+	for (i = count; 0 < i; --i) {
+		result = _remove(manager, order[i - 1]->name);
 		if (RESULT_OK != result) {
+			log_write(LOG_ERROR, "Failed to remove %s\n", order[i - 1]->name);
 			break;
 		}
-		log_write(LOG_DEBUG, "Removed %u packages\n", params.removed);
-	} while (0 < params.removed);
+	}
+
+free_order:
+	/* free the list of unneeded packages */
+	free(order);
+
+free_graph:
+	/* free the dependency graph */
+	_free_graph(&graph);
 
 	return result;
 }
 
+result_t manager_remove(manager_t *manager,
+                        char *const *names,
+                        const unsigned int count) {
+	assert(NULL != manager);
+	assert(NULL != names);
+	assert(0 < count);
+
+	return _collect(manager, names, count);
+}
+
+result_t manager_cleanup(manager_t *manager) {
+	assert(NULL != manager);
+
+	log_write(LOG_INFO, "Cleaning up unneeded packages\n");
+	return _collect(manager, NULL, 0);
+}
+
 static int _list_package(manager_t *manager,
                          int count,
                          char **values,
@@ -666,93 +1740,61 @@ result_t manager_list_inst(manager_t *manager) {
 	                                      manager);
 }
 
-static int _list_avail_package(manager_t *manager,
-                               int count,
-                               char **values,
-                               char **names) {
-	assert((METADATA_FIELDS_COUNT == count) ||
-	       (INSTALLATION_DATA_FIELDS_COUNT == count));
-	assert(NULL != manager);
-	assert(NULL != values[PACKAGE_FIELD_NAME]);
-	assert(NULL != values[PACKAGE_FIELD_VERSION]);
-
-	switch (manager_is_installed(manager, values[PACKAGE_FIELD_NAME])) {
-		case RESULT_NO:
-			return _list_package(manager, count, values, names);
-
-		case RESULT_YES:
-			return 0;
-
-		default:
-			return 1;
-	}
-}
-
 result_t manager_list_avail(manager_t *manager) {
 	assert(NULL != manager);
 
 	log_write(LOG_DEBUG, "Listing available packages\n");
-	return database_for_each_avail_package(
-	                                     &manager->avail_packages,
-	                                     (query_callback_t) _list_avail_package,
-	                                     manager);
+	return database_for_each_uninstalled_package(
+	                                          &manager->inst_packages,
+	                                          (query_callback_t) _list_package,
+	                                          manager);
 }
 
-static int _list_removable_package(manager_t *manager,
-                                   int count,
-                                   char **values,
-                                   char **names) {
-	/* the package installation data */
-	package_info_t installation_data = {{0}};
-
-	/* the return value */
-	int abort = 0;
+static int _list_upgrade(manager_t *manager,
+                         int count,
+                         char **values,
+                         char **names) {
+	assert(3 == count);
+	assert(NULL != values[UPGRADE_FIELD_NAME]);
+	assert(NULL != values[UPGRADE_FIELD_INSTALLED_VERSION]);
+	assert(NULL != values[UPGRADE_FIELD_AVAILABLE_VERSION]);
 
-	assert(NULL != manager);
-	assert(NULL != values[PACKAGE_FIELD_NAME]);
+	log_dumpf("%s|%s|%s\n",
+	          values[UPGRADE_FIELD_NAME],
+	          values[UPGRADE_FIELD_INSTALLED_VERSION],
+	          values[UPGRADE_FIELD_AVAILABLE_VERSION]);
 
-	log_write(LOG_DEBUG,
-	          "Checking whether %s can be removed\n",
-	          values[PACKAGE_FIELD_NAME]);
-
-	/* get the package installation data */
-	if (RESULT_OK != database_get_installation_data(&manager->inst_packages,
-	                                                values[PACKAGE_FIELD_NAME],
-	                                                &installation_data)) {
-		abort = 1;
-		goto end;
-	}
+	return 0;
+}
 
-	/* make sure the package was installed by the user */
-	if (0 != strcmp(installation_data.p_reason, INSTALLATION_REASON_USER)) {
-		log_write(
-		      LOG_DEBUG,
-		      "%s cannot be removed because it was not installed by the user\n",
-		      values[PACKAGE_FIELD_NAME]);
-		goto free_installation_data;
-	}
+result_t manager_list_upgradable(manager_t *manager) {
+	assert(NULL != manager);
 
-	/* check whether the package is a dependency of another package */
-	if (RESULT_YES == manager_can_remove(manager, values[PACKAGE_FIELD_NAME])) {
-		abort = _list_package(manager, count, values, names);
-	}
+	log_write(LOG_DEBUG, "Listing upgradable packages\n");
+	return database_for_each_upgradable_package(
+	                                          &manager->inst_packages,
+	                                          (query_callback_t) _list_upgrade,
+	                                          manager);
+}
 
-free_installation_data:
-	/* free the package installation data */
-	package_info_free(&installation_data);
+result_t manager_list_orphaned(manager_t *manager) {
+	assert(NULL != manager);
 
-end:
-	return abort;
+	log_write(LOG_DEBUG, "Listing orphaned packages\n");
+	return database_for_each_orphaned_package(
+	                                          &manager->inst_packages,
+	                                          (query_callback_t) _list_package,
+	                                          manager);
 }
 
 result_t manager_list_removable(manager_t *manager) {
 	assert(NULL != manager);
 
 	log_write(LOG_DEBUG, "Listing removable packages\n");
-	return database_for_each_inst_package(
-	                                 &manager->inst_packages,
-	                                 (query_callback_t) _list_removable_package,
-	                                 manager);
+	return database_for_each_leaf_package(&manager->inst_packages,
+	                                      INSTALLATION_REASON_USER,
+	                                      (query_callback_t) _list_package,
+	                                      manager);
 }
 
 static int _print_path(void *arg, int count, char **values, char **names) {
@@ -790,3 +1832,39 @@ result_t manager_list_files(manager_t *manager, const char *name) {
 end:
 	return result;
 }
+
+static int _print_dependent(void *arg, int count, char **values, char **names) {
+	assert(1 == count);
+	assert(NULL != values);
+	assert(NULL != values[0]);
+
+	if (0 > printf("%s\n", values[0])) {
+		return 1;
+	}
+	return 0;
+}
+
+result_t manager_list_dependents(manager_t *manager, const char *name) {
+	/* the return value */
+	result_t result = RESULT_CORRUPT_DATA;
+
+	assert(NULL != manager);
+	assert(NULL != name);
+
+	log_write(LOG_DEBUG, "Listing packages which depend on %s\n", name);
+
+	/* make sure the package is installed */
+	result = manager_is_installed(manager, name);
+	if (RESULT_YES != result) {
+		goto end;
+	}
+
+	/* print the names of all packages which depend on the package */
+	result = database_for_each_dependent(&manager->inst_packages,
+	                                     name,
+	                                     _print_dependent,
+	                                     NULL);
+
+end:
+	return result;
+}
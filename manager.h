@@ -1,9 +1,15 @@
 #ifndef _MANAGER_H_INCLUDED
 #	define _MANAGER_H_INCLUDED
 
+#	include <stdbool.h>
+#	include <pthread.h>
+
 #	include "repo.h"
 #	include "database.h"
-#	include "stack.h"
+#	include "hash.h"
+#	include "package.h"
+#	include "archive.h"
+#	include "package_ops.h"
 #	include "result.h"
 
 /*!
@@ -47,46 +53,175 @@
 #	define ARCHITECTURE_INDEPENDENT "all"
 
 /*!
- * @def NO_DEPENDENCIES
- * @brief The contents of an empty dependencies list */
-#	define NO_DEPENDENCIES "-"
+ * @struct manager_settings_t
+ * @brief Package manager settings */
+typedef struct {
+	unsigned int concurrency; /*!< The maximum number of simultaneous package
+	                           * downloads */
+	unsigned int workers; /*!< The maximum number of packages extracted
+	                       * simultaneously */
+	unsigned int decompressors; /*!< The number of threads which decompress
+	                             * each package, unless it is installed while
+	                             * it is being downloaded */
+	unsigned int writers; /*!< The number of threads which write the files of
+	                       * each package, while another thread decompresses
+	                       * it */
+	bool stream; /*!< Whether packages are installed while they are being
+	              * downloaded, instead of being downloaded first */
+	bool background_refresh; /*!< Whether an outdated repository database is
+	                          * used while it is being refreshed in the
+	                          * background */
+	durability_t durability; /*!< The durability profile of the installation
+	                          * data database */
+} manager_settings_t;
 
 /*!
  * @struct manager_t
  * @brief A package manager */
 typedef struct {
+	manager_settings_t settings; /*!< The package manager settings */
 	int lock; /*!< The lock file */
 	repo_t repo; /*!< The repository */
 	database_t avail_packages; /*!< The package metadata database */
 	database_t inst_packages; /*!< The installation data database */
-	node_t *inst_stack; /*!< The installation stack */
 	const char *prefix; /*!< The package installation prefix */
+	package_info_t *closure; /*!< The metadata of all packages installed by
+	                          * the current operation, each after its
+	                          * dependencies */
+	fetcher_job_t *downloads; /*!< The contents of all packages installed by
+	                           * the current operation */
+	unsigned int closure_size; /*!< The number of packages installed by the
+	                            * current operation */
+	hash_t requested; /*!< Maps the names of the packages requested by the
+	                   * user to their installation reason */
+	hash_t planned; /*!< The names of all packages visited while planning the
+	                 * current operation; packages which cannot be
+	                 * installed map to their name */
+	char **rejected; /*!< The names of all packages which cannot be installed
+	                  * by the current operation */
+	unsigned int rejected_count; /*!< The number of packages which cannot be
+	                              * installed by the current operation */
+	result_t problem; /*!< The first problem found while planning the current
+	                   * operation */
+	bool upgrade; /*!< Whether the current operation replaces installed
+	               * packages with newer versions */
 } manager_t;
 
 /*!
- * @struct manager_cleanup_params_t
- * @brief The parameters of _remove_unneeded() */
+ * @struct manager_name_list_t
+ * @brief The parameters of _add_name() */
+typedef struct {
+	char **names; /*!< The package names */
+	unsigned int count; /*!< The number of packages */
+} manager_name_list_t;
+
+/*!
+ * @def VERIFICATION_BATCH_SIZE
+ * @brief The number of files a worker thread checks at a time, during
+ *        verification */
+#	define VERIFICATION_BATCH_SIZE (64)
+
+/*!
+ * @struct manager_check_t
+ * @brief The files of an installed package, checked by worker threads */
+typedef struct {
+	const char *name; /*!< The package name */
+	package_files_t files; /*!< The package files */
+	file_status_t *statuses; /*!< The status of each file */
+} manager_check_t;
+
+/*!
+ * @struct manager_verifier_t
+ * @brief The worker threads which check installed files */
+typedef struct {
+	manager_check_t *checks; /*!< The checked packages */
+	unsigned int count; /*!< The number of checked packages */
+	unsigned int package; /*!< The index of the package whose files are
+	                       * checked next */
+	unsigned int file; /*!< The index of the next file to check */
+	pthread_mutex_t lock; /*!< Protects the indices */
+} manager_verifier_t;
+
+/*!
+ * @struct manager_extraction_t
+ * @brief A package extracted by a worker thread */
+typedef struct {
+	package_t package; /*!< The package */
+	package_files_t previous; /*!< The files of the installed version of the
+	                           * package */
+	archive_staging_t staging; /*!< The extracted files */
+	result_t result; /*!< The extraction result */
+	bool done; /*!< Whether the extraction is finished */
+} manager_extraction_t;
+
+/*!
+ * @struct manager_pool_t
+ * @brief The worker threads which extract packages, while the main thread
+ *        puts them in place and registers them */
 typedef struct {
 	manager_t *manager; /*!< The package manager */
-	unsigned int removed; /*!< The number of removed packages */
-} manager_cleanup_params_t;
+	manager_extraction_t *extractions; /*!< The extraction of each package
+	                                    * in the installation plan */
+	unsigned int next; /*!< The index of the next package to extract */
+	bool stop; /*!< Whether the worker threads should stop */
+	pthread_mutex_t lock; /*!< Protects all other members */
+	pthread_cond_t extracted; /*!< Signaled when a package is extracted */
+} manager_pool_t;
+
+/*!
+ * @struct manager_node_t
+ * @brief An installed package, in the dependency graph built by
+ *        manager_cleanup() */
+typedef struct manager_node {
+	char *name; /*!< The package name */
+	bool root; /*!< Whether the package is needed regardless of other
+	            * packages */
+	bool core; /*!< Whether the package is a core package */
+	bool marked; /*!< Whether the package has been visited */
+	struct manager_node **dependencies; /*!< The installed dependencies */
+	unsigned int dependencies_count; /*!< The number of installed
+	                                  * dependencies */
+} manager_node_t;
+
+/*!
+ * @struct manager_graph_t
+ * @brief The dependency graph of all installed packages */
+typedef struct {
+	manager_node_t *nodes; /*!< The installed packages */
+	unsigned int count; /*!< The number of installed packages */
+	hash_t index; /*!< Maps package names to nodes */
+} manager_graph_t;
 
 /*!
  * @typedef dependency_callback_t
  * @brief A callback executed for each dependency */
 typedef result_t (*dependency_callback_t)(const char *name, void *arg);
 
+/*!
+ * @struct manager_dependency_params_t
+ * @brief The parameters of _run_dependency_callback() */
+typedef struct {
+	dependency_callback_t callback; /*!< The callback to run */
+	void *arg; /*!< A pointer passed to the callback */
+	result_t result; /*!< The callback return value */
+} manager_dependency_params_t;
+
 /*!
  * @fn result_t manager_new(manager_t *manager,
  *                          const char *prefix,
- *                          const char *repo)
+ *                          const char *repo,
+ *                          const manager_settings_t *settings)
  * @brief Starts a package manager instance
  * @param manager A package manager
  * @param prefix The package manager operation prefix
  * @param repo The repository URL
+ * @param settings The package manager settings
  * @see manager_free
  * @see DEFAULT_PREFIX */
-result_t manager_new(manager_t *manager, const char *prefix, const char *repo);
+result_t manager_new(manager_t *manager,
+                     const char *prefix,
+                     const char *repo,
+                     const manager_settings_t *settings);
 
 /*!
  * @fn void manager_free(manager_t *manager)
@@ -113,31 +248,80 @@ result_t manager_for_each_dependency(manager_t *manager,
 
 /*!
  * @fn result_t manager_fetch(manager_t *manager,
- *                            const char *name,
+ *                            char *const *names,
+ *                            const unsigned int count,
  *                            const char *reason)
- * @brief Recursively fetches and installs a package and its dependencies
+ * @brief Fetches and installs packages and their dependencies
  * @param manager A package manager
- * @param name The package name
- * @param reason The package installation reason
+ * @param names The package names
+ * @param count The number of packages
+ * @param reason The installation reason of the requested packages
  * @see INSTALLATION_REASON_USER
- * @see INSTALLATION_REASON_DEPENDENCY */
+ * @see INSTALLATION_REASON_CORE
+ *
+ * First, all packages which need to be installed are located in the
+ * repository database and sorted, so each is installed after its
+ * dependencies; missing and incompatible packages are reported before
+ * anything is downloaded. Then, unless packages are installed while they are
+ * being downloaded, all packages are downloaded simultaneously, before any of
+ * them is installed, and extracted simultaneously by worker threads; each
+ * package is put in place and registered only after its dependencies. */
 result_t manager_fetch(manager_t *manager,
-                       const char *name,
+                       char *const *names,
+                       const unsigned int count,
                        const char *reason);
 
 /*!
- * @fn result_t manager_can_remove(manager_t *manager, const char *name)
- * @brief Determines whether a package can be removed safely
+ * @fn result_t manager_upgrade(manager_t *manager,
+ *                              char *const *names,
+ *                              const unsigned int count)
+ * @brief Replaces installed packages with newer versions
  * @param manager A package manager
- * @param name The package name */
-result_t manager_can_remove(manager_t *manager, const char *name);
+ * @param names The package names
+ * @param count The number of packages, or 0 to upgrade all packages
+ * @see manager_fetch
+ * @see version_compare
+ *
+ * Packages are planned, fetched and installed like in manager_fetch(); each
+ * upgraded package keeps its installation reason and only its files which do
+ * not exist in the new version are deleted. Packages which are already up to
+ * date are skipped. */
+result_t manager_upgrade(manager_t *manager,
+                         char *const *names,
+                         const unsigned int count);
 
 /*!
- * @fn result_t manager_remove(manager_t *manager, const char *name)
- * @brief Removes a package
+ * @fn result_t manager_verify(manager_t *manager,
+ *                             char *const *names,
+ *                             const unsigned int count)
+ * @brief Checks whether installed files match their recorded state
  * @param manager A package manager
- * @param name The package name */
-result_t manager_remove(manager_t *manager, const char *name);
+ * @param names The package names
+ * @param count The number of packages, or 0 to verify all packages
+ * @see package_check_file
+ *
+ * Files are checked simultaneously by worker threads, then each file which
+ * does not match its recorded state is reported, in the form
+ * package|path|problem. If any file does not match, \a RESULT_CORRUPT_DATA is
+ * returned. */
+result_t manager_verify(manager_t *manager,
+                        char *const *names,
+                        const unsigned int count);
+
+/*!
+ * @fn result_t manager_remove(manager_t *manager,
+ *                             char *const *names,
+ *                             const unsigned int count)
+ * @brief Removes packages, then all dependencies which are no longer needed
+ * @param manager A package manager
+ * @param names The package names
+ * @param count The number of packages
+ * @see manager_cleanup
+ *
+ * If any of the packages cannot be removed, nothing is removed. */
+result_t manager_remove(manager_t *manager,
+                        char *const *names,
+                        const unsigned int count);
 
 /*!
  * @fn result_t manager_is_installed(manager_t *manager, const char *name)
@@ -150,7 +334,10 @@ result_t manager_is_installed(manager_t *manager, const char *name);
  * @fn result_t manager_cleanup(manager_t *manager)
  * @brief Removes all unneeded dependencies
  * @param manager A package manager
- * @param name The package name */
+ *
+ * Packages which are not reachable from a package installed by the user or a
+ * core package are removed in a single transaction, each before its
+ * dependencies. */
 result_t manager_cleanup(manager_t *manager);
 
 /*!
@@ -159,12 +346,32 @@ result_t manager_cleanup(manager_t *manager);
  * @param manager A package manager */
 result_t manager_list_inst(manager_t *manager);
 
+/*!
+ * @fn result_t manager_list_dependents(manager_t *manager, const char *name)
+ * @brief Lists installed packages which depend on a package
+ * @param manager A package manager
+ * @param name The package name */
+result_t manager_list_dependents(manager_t *manager, const char *name);
+
 /*!
  * @fn result_t manager_list_avail(manager_t *manager)
  * @brief Lists available packages
  * @param manager A package manager */
 result_t manager_list_avail(manager_t *manager);
 
+/*!
+ * @fn result_t manager_list_upgradable(manager_t *manager)
+ * @brief Lists installed packages whose available version is different, in
+ *        the form name|installed version|available version
+ * @param manager A package manager */
+result_t manager_list_upgradable(manager_t *manager);
+
+/*!
+ * @fn result_t manager_list_orphaned(manager_t *manager)
+ * @brief Lists installed packages which are no longer available
+ * @param manager A package manager */
+result_t manager_list_orphaned(manager_t *manager);
+
 /*!
  * @fn result_t manager_list_removable(manager_t *manager)
  * @brief Lists packages installed by the user, which can be removed
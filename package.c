@@ -1,14 +1,66 @@
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include <zlib.h>
 
 #include "log.h"
+#include "archive.h"
 #include "package.h"
 
+/* the magic number of each supported archive compression */
+static const unsigned char g_xz_magic[] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+static const unsigned char g_zstd_magic[] = {0x28, 0xB5, 0x2F, 0xFD};
+
+static size_t _header_size(const package_v1_header_t *header) {
+	assert(NULL != header);
+
+	/* each format version added fields before those of the previous header;
+	 * version 1 headers contain only the fields common to all versions */
+	switch (header->version) {
+		case 1:
+			return sizeof(package_v1_header_t);
+
+		case 2:
+			return sizeof(package_v2_header_t);
+
+		default:
+			return sizeof(package_header_t);
+	}
+}
+
+static compression_t _get_compression(const unsigned char *header,
+                                      const size_t size) {
+	assert(NULL != header);
+
+	switch (size) {
+		/* version 1 packages contain an xz-compressed archive */
+		case sizeof(package_v1_header_t):
+			return COMPRESSION_XZ;
+
+		case sizeof(package_v2_header_t):
+			return (compression_t)
+			       ((const package_v2_header_t *) header)->compression;
+
+		default:
+			return (compression_t)
+			       ((const package_header_t *) header)->compression;
+	}
+}
+
 result_t package_open(package_t *package,
                       unsigned char *contents,
                       const size_t size) {
+	/* the package header */
+	const package_header_t *header = NULL;
+
+	/* the header size */
+	size_t header_size = 0;
+
+	/* the chunk index size */
+	size_t index_size = 0;
+
 	/* the return value */
 	result_t result = RESULT_CORRUPT_DATA;
 
@@ -16,27 +68,57 @@ result_t package_open(package_t *package,
 	assert(NULL != contents);
 	assert(0 < size);
 
-	/* make sure the package size is at bigger than the header size */
-	if (sizeof(package_header_t) >= size) {
-		log_write(LOG_ERROR, "The package is too small to be valid\n");
-		goto end;
+	/* make sure the package size is bigger than the header size; the header
+	 * size depends on the format version, which is found at the same offset
+	 * from the end of all packages */
+	if (sizeof(package_v1_header_t) >= size) {
+		goto too_small;
+	}
+	package->header = (const package_v1_header_t *)
+	                  &contents[size - sizeof(package_v1_header_t)];
+	header_size = _header_size(package->header);
+	if (header_size >= size) {
+		goto too_small;
 	}
 
 	/* locate the archive and calculate its size */
 	package->archive = contents;
-	package->archive_size = size - sizeof(package_header_t);
+	package->archive_size = size - header_size;
+	package->chunks = NULL;
+	package->chunks_count = 0;
+
+	/* packages of older format versions contain a single archive, without a
+	 * chunk index */
+	package->compression = _get_compression(&contents[size - header_size],
+	                                        header_size);
+	if (sizeof(package_header_t) != header_size) {
+		goto save;
+	}
+	header = (const package_header_t *) &contents[size - header_size];
 
-	/* locate the package header */
-	package->header = (package_header_t *) (contents + \
-	                                        size - \
-	                                        sizeof(package_header_t));
+	/* locate the chunk index, which precedes the header; if it does not fit,
+	 * package_verify() reports the package as invalid */
+	if (MAX_CHUNKS >= header->chunks) {
+		index_size = sizeof(package_chunk_t) * header->chunks;
+		if (package->archive_size >= index_size) {
+			package->archive_size -= index_size;
+			package->chunks = (const package_chunk_t *) (contents + \
+			                                             package->archive_size);
+			package->chunks_count = header->chunks;
+		}
+	}
 
+save:
 	/* save the package contains pointer and its size */
 	package->contents = contents;
 	package->size = size;
 
 	/* report success */
 	result = RESULT_OK;
+	goto end;
+
+too_small:
+	log_write(LOG_ERROR, "The package is too small to be valid\n");
 
 end:
 	return result;
@@ -47,32 +129,58 @@ void package_close(package_t *package) {
 	assert(NULL != package->contents);
 }
 
-result_t package_verify(const package_t *package) {
+bool package_detect_compression(const unsigned char *archive,
+                                const size_t size,
+                                compression_t *compression) {
+	assert(NULL != archive);
+	assert(NULL != compression);
+
+	if ((sizeof(g_xz_magic) <= size) &&
+	    (0 == memcmp(archive, &g_xz_magic, sizeof(g_xz_magic)))) {
+		*compression = COMPRESSION_XZ;
+		return true;
+	}
+
+	if ((sizeof(g_zstd_magic) <= size) &&
+	    (0 == memcmp(archive, &g_zstd_magic, sizeof(g_zstd_magic)))) {
+		*compression = COMPRESSION_ZSTD;
+		return true;
+	}
+
+	return false;
+}
+
+static result_t _verify_header(const package_v1_header_t *header,
+                               const compression_t compression,
+                               const uLong checksum) {
 	/* the return value */
 	result_t result = RESULT_CORRUPT_DATA;
 
-	assert(NULL != package);
-
-	log_write(LOG_INFO, "Verifying the package integrity\n");
+	assert(NULL != header);
 
 	/* verify the package is indeed a package, by checking the magic number */
-	if (MAGIC != package->header->magic) {
+	if (MAGIC != header->magic) {
 		log_write(LOG_ERROR, "The package magic number is wrong\n");
 		goto end;
 	}
 
-	/* verify the package is targeted at the running package manager version */
-	if (VERSION != package->header->version) {
+	/* verify the package format is supported by the running package manager
+	 * version */
+	if ((MIN_VERSION > header->version) || (VERSION < header->version)) {
 		log_write(LOG_ERROR, "The package version is incompatible\n");
 		result = RESULT_INCOMPATIBLE;
 		goto end;
 	}
 
+	/* make sure the archive compression is supported */
+	if (COMPRESSIONS_COUNT <= compression) {
+		log_write(LOG_ERROR, "The package compression is unsupported\n");
+		result = RESULT_INCOMPATIBLE;
+		goto end;
+	}
+
 	/* verify the package checksum */
-	if ((uLong) package->header->checksum != crc32(
-	                                            crc32(0L, Z_NULL, 0),
-	                                            package->archive,
-	                                            (uInt) package->archive_size)) {
+	if ((uLong) header->checksum != checksum) {
 		log_write(LOG_ERROR,
 		          "The package is corrupt; the checksum is incorrect\n");
 		result = RESULT_CORRUPT_DATA;
@@ -85,3 +193,575 @@ result_t package_verify(const package_t *package) {
 end:
 	return result;
 }
+
+static bool _verify_chunks(const package_chunk_t *chunks,
+                           const unsigned int count,
+                           const size_t archive_size) {
+	/* the total size of the chunks */
+	size_t total = 0;
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	if ((NULL == chunks) || (0 == count)) {
+		return false;
+	}
+
+	/* make sure no chunk is empty and the chunks cover the whole archive */
+	for ( ; count > i; ++i) {
+		if ((0 == chunks[i].size) || (0 == chunks[i].extracted_size)) {
+			return false;
+		}
+		total += chunks[i].size;
+	}
+
+	return (archive_size == total) ? true : false;
+}
+
+result_t package_verify(const package_t *package) {
+	/* the compression of a chunk */
+	compression_t compression = COMPRESSION_XZ;
+
+	/* the offset of a chunk */
+	size_t offset = 0;
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_CORRUPT_DATA;
+
+	assert(NULL != package);
+
+	log_write(LOG_INFO, "Verifying the package integrity\n");
+
+	result = _verify_header(package->header,
+	                        package->compression,
+	                        crc32(crc32(0L, Z_NULL, 0),
+	                              package->contents,
+	                              (uInt) (package->size - \
+	                                      _header_size(package->header))));
+	if (RESULT_OK != result) {
+		return result;
+	}
+
+	/* packages of older format versions contain a single archive */
+	if (VERSION != package->header->version) {
+		if ((false == package_detect_compression(package->archive,
+		                                         package->archive_size,
+		                                         &compression)) ||
+		    (compression != package->compression)) {
+			log_write(LOG_ERROR,
+			          "The package is corrupt; the compression is incorrect\n");
+			return RESULT_CORRUPT_DATA;
+		}
+		return RESULT_OK;
+	}
+
+	/* make sure the chunk index matches the archive */
+	if (false == _verify_chunks(package->chunks,
+	                            package->chunks_count,
+	                            package->archive_size)) {
+		log_write(LOG_ERROR,
+		          "The package is corrupt; the chunk index is invalid\n");
+		return RESULT_CORRUPT_DATA;
+	}
+
+	/* make sure all chunks are compressed as the header says */
+	for ( ; package->chunks_count > i; ++i) {
+		if ((false == package_detect_compression(
+		                                        &package->archive[offset],
+		                                        package->chunks[i].size,
+		                                        &compression)) ||
+		    (compression != package->compression)) {
+			log_write(LOG_ERROR,
+			          "The package is corrupt; the compression is incorrect\n");
+			return RESULT_CORRUPT_DATA;
+		}
+		offset += package->chunks[i].size;
+	}
+
+	return RESULT_OK;
+}
+
+static bool _decompress_next(package_reader_t *reader) {
+	/* the decompressed chunk */
+	unsigned char *extracted = NULL;
+
+	/* the chunk */
+	const package_chunk_t *chunk = NULL;
+
+	/* the chunk offset */
+	size_t offset = 0;
+
+	/* the chunk index */
+	unsigned int i = 0;
+
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	assert(NULL != reader);
+
+	/* take the next chunk, unless it is too far ahead of the reader */
+	if ((true == reader->stop) ||
+	    (reader->package->chunks_count <= reader->next) ||
+	    ((reader->current + reader->window) <= reader->next)) {
+		return false;
+	}
+	i = reader->next;
+	chunk = &reader->package->chunks[i];
+	offset = reader->offset;
+	++(reader->next);
+	reader->offset += chunk->size;
+
+	/* decompress the chunk without holding the lock */
+	(void) pthread_mutex_unlock(&reader->lock);
+	extracted = malloc(chunk->extracted_size);
+	if (NULL != extracted) {
+		result = archive_decompress(&reader->package->archive[offset],
+		                            chunk->size,
+		                            extracted,
+		                            chunk->extracted_size);
+		if (RESULT_OK != result) {
+			free(extracted);
+		}
+	}
+	(void) pthread_mutex_lock(&reader->lock);
+
+	if (RESULT_OK == result) {
+		reader->extracted[i] = extracted;
+	} else {
+		reader->stop = true;
+		(void) pthread_cond_broadcast(&reader->consumed);
+	}
+	(void) pthread_cond_broadcast(&reader->decompressed);
+
+	return true;
+}
+
+static void *_decompress_chunks(package_reader_t *reader) {
+	assert(NULL != reader);
+
+	(void) pthread_mutex_lock(&reader->lock);
+
+	while ((false == reader->stop) &&
+	       (reader->package->chunks_count > reader->next)) {
+		/* if the reader is too far behind, wait until it reads a chunk */
+		if (false == _decompress_next(reader)) {
+			(void) pthread_cond_wait(&reader->consumed, &reader->lock);
+		}
+	}
+
+	(void) pthread_mutex_unlock(&reader->lock);
+
+	return NULL;
+}
+
+result_t package_reader_open(package_reader_t *reader,
+                             const package_t *package,
+                             const unsigned int threads) {
+	assert(NULL != reader);
+	assert(NULL != package);
+	assert(0 < threads);
+
+	reader->package = package;
+	reader->block = NULL;
+	reader->next = 0;
+	reader->offset = 0;
+	reader->current = 0;
+	reader->window = 2 * threads;
+	reader->stop = false;
+
+	/* packages without a chunk index are decompressed serially, by the archive
+	 * reader */
+	if (0 == package->chunks_count) {
+		return RESULT_OK;
+	}
+
+	reader->extracted = calloc(package->chunks_count, sizeof(unsigned char *));
+	if (NULL == reader->extracted) {
+		goto end;
+	}
+	if (0 != pthread_mutex_init(&reader->lock, NULL)) {
+		goto free_extracted;
+	}
+	if (0 != pthread_cond_init(&reader->decompressed, NULL)) {
+		goto destroy_lock;
+	}
+	if (0 != pthread_cond_init(&reader->consumed, NULL)) {
+		goto destroy_decompressed;
+	}
+
+	/* start the decompression threads, besides the reading thread, which
+	 * decompresses chunks no other thread took */
+	(void) workers_start(&reader->threads,
+	                     threads - 1,
+	                     (worker_routine_t) _decompress_chunks,
+	                     reader);
+
+	return RESULT_OK;
+
+destroy_decompressed:
+	(void) pthread_cond_destroy(&reader->decompressed);
+
+destroy_lock:
+	(void) pthread_mutex_destroy(&reader->lock);
+
+free_extracted:
+	free(reader->extracted);
+
+end:
+	return RESULT_MEM_ERROR;
+}
+
+ssize_t package_reader_read(package_reader_t *reader, const void **block) {
+	/* the return value */
+	ssize_t size = 0;
+
+	assert(NULL != reader);
+	assert(NULL != block);
+
+	/* the previous chunk has been read */
+	if (NULL != reader->block) {
+		free(reader->block);
+		reader->block = NULL;
+	}
+
+	/* if the package has no chunk index, pass the whole archive at once */
+	if (0 == reader->package->chunks_count) {
+		if (0 < reader->current) {
+			return 0;
+		}
+		++(reader->current);
+		*block = reader->package->archive;
+		return (ssize_t) reader->package->archive_size;
+	}
+
+	(void) pthread_mutex_lock(&reader->lock);
+
+	if (reader->package->chunks_count <= reader->current) {
+		goto unlock;
+	}
+
+	/* wait until the chunk is decompressed; if no thread took it yet,
+	 * decompress it */
+	while ((NULL == reader->extracted[reader->current]) &&
+	       (false == reader->stop)) {
+		if ((reader->current != reader->next) ||
+		    (false == _decompress_next(reader))) {
+			(void) pthread_cond_wait(&reader->decompressed, &reader->lock);
+		}
+	}
+	if (NULL == reader->extracted[reader->current]) {
+		size = (-1);
+		goto unlock;
+	}
+
+	/* hand the chunk to the reader and let the decompression threads move on
+	 * to the next one */
+	reader->block = reader->extracted[reader->current];
+	reader->extracted[reader->current] = NULL;
+	size = (ssize_t) reader->package->chunks[reader->current].extracted_size;
+	++(reader->current);
+	(void) pthread_cond_broadcast(&reader->consumed);
+	*block = reader->block;
+
+unlock:
+	(void) pthread_mutex_unlock(&reader->lock);
+
+	return size;
+}
+
+void package_reader_close(package_reader_t *reader) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != reader);
+
+	/* packages without a chunk index are not decompressed by the reader */
+	if (0 == reader->package->chunks_count) {
+		return;
+	}
+
+	/* stop the decompression threads */
+	(void) pthread_mutex_lock(&reader->lock);
+	reader->stop = true;
+	(void) pthread_cond_broadcast(&reader->consumed);
+	(void) pthread_mutex_unlock(&reader->lock);
+	workers_join(&reader->threads);
+
+	/* free all chunks which were not read */
+	for (i = 0; reader->package->chunks_count > i; ++i) {
+		if (NULL != reader->extracted[i]) {
+			free(reader->extracted[i]);
+		}
+	}
+	if (NULL != reader->block) {
+		free(reader->block);
+	}
+
+	(void) pthread_cond_destroy(&reader->consumed);
+	(void) pthread_cond_destroy(&reader->decompressed);
+	(void) pthread_mutex_destroy(&reader->lock);
+	free(reader->extracted);
+}
+
+void package_stream_open(package_stream_t *stream,
+                         const package_read_callback_t read,
+                         void *arg) {
+	assert(NULL != stream);
+	assert(NULL != read);
+
+	stream->read = read;
+	stream->arg = arg;
+	stream->trailer_size = 0;
+	stream->pending = NULL;
+	stream->pending_size = 0;
+	stream->checksum = (uint32_t) crc32(0L, Z_NULL, 0);
+	stream->archive_size = 0;
+	stream->finished = false;
+}
+
+static ssize_t _release(package_stream_t *stream,
+                        const unsigned char *block,
+                        const size_t size,
+                        const void **output) {
+	assert(NULL != stream);
+	assert(NULL != block);
+	assert(0 < size);
+	assert(NULL != output);
+
+	/* update the checksum */
+	stream->checksum = (uint32_t) crc32((uLong) stream->checksum,
+	                                    (const Bytef *) block,
+	                                    (uInt) size);
+
+	stream->archive_size += size;
+
+	*output = block;
+	return (ssize_t) size;
+}
+
+static ssize_t _release_rest(package_stream_t *stream, const void **output) {
+	/* the package header */
+	const package_header_t *header = NULL;
+
+	/* the header size */
+	size_t header_size = 0;
+
+	/* the chunk index size */
+	size_t index_size = 0;
+
+	/* the number of bytes which can be passed to the reader */
+	size_t released = 0;
+
+	assert(NULL != stream);
+	assert(NULL != output);
+
+	/* once the package is read completely, all bytes that precede the chunk
+	 * index belong to the archive; packages of other format versions have no
+	 * chunk index. If the header is invalid, package_stream_verify() reports
+	 * it */
+	if (sizeof(package_v1_header_t) > stream->trailer_size) {
+		return 0;
+	}
+	header_size = _header_size((const package_v1_header_t *) &stream->trailer[
+	                      stream->trailer_size - sizeof(package_v1_header_t)]);
+	if (header_size > stream->trailer_size) {
+		return 0;
+	}
+	header = (const package_header_t *) &stream->trailer[
+	                                      stream->trailer_size - header_size];
+	if ((sizeof(package_header_t) == header_size) &&
+	    (MAGIC == header->magic) &&
+	    (VERSION == header->version)) {
+		if (MAX_CHUNKS < header->chunks) {
+			return 0;
+		}
+		index_size = sizeof(package_chunk_t) * header->chunks;
+	}
+	if ((stream->trailer_size - header_size) <= index_size) {
+		return 0;
+	}
+	released = stream->trailer_size - header_size - index_size;
+
+	(void) memcpy(&stream->spill, &stream->trailer, released);
+	(void) memmove(&stream->trailer,
+	               &stream->trailer[released],
+	               stream->trailer_size - released);
+	stream->trailer_size -= released;
+	return _release(stream, stream->spill, released, output);
+}
+
+ssize_t package_stream_read(package_stream_t *stream, const void **block) {
+	/* a block read from the package */
+	const unsigned char *input = NULL;
+
+	/* the block passed to the reader */
+	const unsigned char *output = NULL;
+
+	/* the size of the block read from the package */
+	ssize_t size = 0;
+
+	/* the number of bytes which can be passed to the reader */
+	size_t released = 0;
+
+	assert(NULL != stream);
+	assert(NULL != block);
+
+	/* if part of the previous block was not returned yet, return it now */
+	if (0 < stream->pending_size) {
+		size = (ssize_t) stream->pending_size;
+		stream->pending_size = 0;
+		return _release(stream, stream->pending, (size_t) size, block);
+	}
+
+	do {
+		/* read a block */
+		if (true == stream->finished) {
+			return _release_rest(stream, block);
+		}
+		size = stream->read(stream->arg, (const void **) &input);
+		if (0 > size) {
+			return size;
+		}
+		if (0 == size) {
+			stream->finished = true;
+			continue;
+		}
+
+		/* if the block and the trailer are too small to contain anything but
+		 * the header, keep reading */
+		if (sizeof(stream->trailer) >= (stream->trailer_size + (size_t) size)) {
+			(void) memcpy(&stream->trailer[stream->trailer_size],
+			              input,
+			              (size_t) size);
+			stream->trailer_size += (size_t) size;
+			continue;
+		}
+
+		/* everything but the last bytes can be passed to the reader */
+		released = stream->trailer_size + \
+		           (size_t) size - \
+		           sizeof(stream->trailer);
+
+		/* if only part of the trailer can be released, the block becomes the
+		 * end of the trailer */
+		if (released <= stream->trailer_size) {
+			(void) memcpy(&stream->spill, &stream->trailer, released);
+			(void) memmove(&stream->trailer,
+			               &stream->trailer[released],
+			               stream->trailer_size - released);
+			(void) memcpy(&stream->trailer[stream->trailer_size - released],
+			              input,
+			              (size_t) size);
+			stream->trailer_size = sizeof(stream->trailer);
+			return _release(stream, stream->spill, released, block);
+		}
+
+		/* otherwise, release the whole trailer, then the beginning of the
+		 * block; its end becomes the new trailer */
+		released -= stream->trailer_size;
+		if (0 < stream->trailer_size) {
+			(void) memcpy(&stream->spill,
+			              &stream->trailer,
+			              stream->trailer_size);
+			stream->pending = input;
+			stream->pending_size = released;
+			output = stream->spill;
+			size = (ssize_t) stream->trailer_size;
+		} else {
+			output = input;
+			size = (ssize_t) released;
+		}
+		(void) memcpy(&stream->trailer,
+		              &input[released],
+		              sizeof(stream->trailer));
+		stream->trailer_size = sizeof(stream->trailer);
+		return _release(stream, output, (size_t) size, block);
+	} while (1);
+}
+
+result_t package_stream_verify(package_stream_t *stream) {
+	/* a block of the archive */
+	const void *block = NULL;
+
+	/* the package header */
+	const package_header_t *header = NULL;
+
+	/* the fields common to all package header versions */
+	const package_v1_header_t *common = NULL;
+
+	/* the header size */
+	size_t header_size = 0;
+
+	/* the chunk index size */
+	size_t index_size = 0;
+
+	/* the block size */
+	ssize_t size = 0;
+
+	/* the return value */
+	result_t result = RESULT_CORRUPT_DATA;
+
+	assert(NULL != stream);
+
+	log_write(LOG_INFO, "Verifying the package integrity\n");
+
+	/* read the rest of the package, to reach the header */
+	do {
+		size = package_stream_read(stream, &block);
+		if (0 > size) {
+			return RESULT_IO_ERROR;
+		}
+	} while (0 < size);
+
+	/* make sure the package contains a header; the rest of the trailer is the
+	 * chunk index */
+	if (sizeof(package_v1_header_t) > stream->trailer_size) {
+		goto too_small;
+	}
+	common = (const package_v1_header_t *) &stream->trailer[
+	                      stream->trailer_size - sizeof(package_v1_header_t)];
+	header_size = _header_size(common);
+	if (header_size > stream->trailer_size) {
+		goto too_small;
+	}
+	index_size = stream->trailer_size - header_size;
+
+	/* packages of older format versions contain a single archive, without a
+	 * chunk index */
+	if (sizeof(package_header_t) != header_size) {
+		return _verify_header(common,
+		                      _get_compression(&stream->trailer[index_size],
+		                                       header_size),
+		                      (uLong) stream->checksum);
+	}
+
+	header = (const package_header_t *) &stream->trailer[index_size];
+	result = _verify_header(common,
+	                        (compression_t) header->compression,
+	                        crc32((uLong) stream->checksum,
+	                              (const Bytef *) &stream->trailer,
+	                              (uInt) index_size));
+	if (RESULT_OK != result) {
+		return result;
+	}
+
+	/* make sure the chunk index matches the archive */
+	if ((MAX_CHUNKS < header->chunks) ||
+	    ((sizeof(package_chunk_t) * header->chunks) != index_size) ||
+	    (false == _verify_chunks((const package_chunk_t *) &stream->trailer,
+	                             header->chunks,
+	                             stream->archive_size))) {
+		log_write(LOG_ERROR,
+		          "The package is corrupt; the chunk index is invalid\n");
+		return RESULT_CORRUPT_DATA;
+	}
+
+	return RESULT_OK;
+
+too_small:
+	log_write(LOG_ERROR, "The package is too small to be valid\n");
+	return RESULT_CORRUPT_DATA;
+}
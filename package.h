@@ -2,9 +2,13 @@
 #	define _PACKAGE_H_INCLUDED
 
 #	include <stdint.h>
+#	include <stdbool.h>
+#	include <sys/types.h>
 #	include <arpa/inet.h>
+#	include <pthread.h>
 
 #	include "result.h"
+#	include "workers.h"
 
 /*!
  * @defgroup package Package
@@ -17,28 +21,167 @@
  * @see package_header_t */
 #	define MAGIC ((uint32_t) (ntohl(0x65647564)))
 
+/*!
+ * @def MIN_VERSION
+ * @brief The oldest supported package format version */
+#	define MIN_VERSION (1)
+
+/*!
+ * @typedef compression_t
+ * @brief The compression of the archive contained in a package */
+typedef unsigned int compression_t;
+
+enum compressions {
+	COMPRESSION_XZ     = 0,
+	COMPRESSION_ZSTD   = 1,
+	COMPRESSIONS_COUNT = 2
+};
+
+/*!
+ * @def CHUNK_SIZE
+ * @brief The decompressed size of each package chunk, except the last one
+ * @see package_chunk_t */
+#	define CHUNK_SIZE (4 * 1024 * 1024)
+
+/*!
+ * @def MAX_CHUNKS
+ * @brief The maximum number of chunks in a package */
+#	define MAX_CHUNKS (8192)
+
+/*!
+ * @struct package_chunk_t
+ * @brief An entry in the chunk index of a package
+ *
+ * The archive contained in a package is split into chunks, which are
+ * compressed independently, so they can be decompressed in parallel.
+ * Together, the compressed chunks are also a valid compressed archive. */
+typedef struct __attribute__((packed)) {
+	uint32_t size; /*!< The compressed chunk size */
+	uint32_t extracted_size; /*!< The decompressed chunk size */
+} package_chunk_t;
+
+/*!
+ * @struct package_v1_header_t
+ * @brief The header of version 1 packages
+ * @see MAGIC
+ *
+ * Version 1 packages contain a single xz-compressed archive, without a chunk
+ * index. The fields of this header are also the last fields of all later
+ * header versions. */
+typedef struct __attribute__((packed)) {
+	uint32_t magic; /*!< A magic number */
+	uint8_t version; /*!< The package format version */
+	uint32_t checksum; /*!< A CRC32 checksum of the archive */
+} package_v1_header_t;
+
+/*!
+ * @struct package_v2_header_t
+ * @brief The header of version 2 packages
+ * @see MAGIC
+ *
+ * Version 2 packages contain a single archive, without a chunk index. */
+typedef struct __attribute__((packed)) {
+	uint8_t compression; /*!< The archive compression */
+	uint32_t magic; /*!< A magic number */
+	uint8_t version; /*!< The package format version */
+	uint32_t checksum; /*!< A CRC32 checksum of the archive */
+} package_v2_header_t;
+
 /*!
  * @struct package_header_t
  * @brief A package header
- * @see MAGIC */
+ * @see MAGIC
+ *
+ * The header is preceded by the chunk index and the chunks.
+ *
+ * Fields added in later package format versions precede the original ones, so
+ * the magic number and the version are always found at the same offset from
+ * the end of the package. */
 typedef struct __attribute__((packed)) {
+	uint32_t chunks; /*!< The number of chunks */
+	uint8_t compression; /*!< The archive compression */
 	uint32_t magic; /*!< A magic number */
 	uint8_t version; /*!< The package format version */
-	uint32_t checksum; /*!< A CRC32 checksum of the archive contained in the
-	                    * package */
+	uint32_t checksum; /*!< A CRC32 checksum of the chunks and the chunk
+	                    * index */
 } package_header_t;
 
+/*!
+ * @def TRAILER_SIZE
+ * @brief The maximum size of the package header and the chunk index */
+#	define TRAILER_SIZE (sizeof(package_header_t) + \
+                         (MAX_CHUNKS * sizeof(package_chunk_t)))
+
 /*!
  * @struct package_t
  * @brief A package */
 typedef struct {
 	unsigned char *contents; /*!< The package contents */
 	size_t size; /*!< The package size */
-	package_header_t *header; /*!< The package header */
+	const package_v1_header_t *header; /*!< The package header fields common
+	                                    * to all format versions */
+	compression_t compression; /*!< The archive compression */
 	unsigned char *archive; /*!< The archive contained in the package */
 	size_t archive_size; /*!< The archive size */
+	const package_chunk_t *chunks; /*!< The chunk index, or NULL if the
+	                                * package is invalid */
+	unsigned int chunks_count; /*!< The number of chunks */
 } package_t;
 
+/*!
+ * @struct package_reader_t
+ * @brief The decompressed archive contained in a package, read in order
+ *        while a pool of threads decompresses the following chunks */
+typedef struct {
+	const package_t *package; /*!< The package */
+	unsigned char **extracted; /*!< Decompressed chunks which were not read
+	                            * yet, or NULL */
+	unsigned char *block; /*!< The last chunk read */
+	unsigned int next; /*!< The next chunk to decompress */
+	size_t offset; /*!< The offset of the next chunk to decompress */
+	unsigned int current; /*!< The next chunk to read */
+	unsigned int window; /*!< The maximum number of chunks decompressed
+	                      * ahead of the reader */
+	bool stop; /*!< Whether decompression stopped, because of a failure or
+	            * because the reader was closed */
+	pthread_mutex_t lock; /*!< A lock which protects the reader */
+	pthread_cond_t decompressed; /*!< Signaled when a chunk is
+	                              * decompressed */
+	pthread_cond_t consumed; /*!< Signaled when a chunk is read */
+	workers_t threads; /*!< The decompression threads */
+} package_reader_t;
+
+/*!
+ * @typedef package_read_callback_t
+ * @brief A callback which reads the next block of a package
+ *
+ * This function should return the block size, 0 at the end of the package or
+ * -1 on failure. The block should remain valid until the next call. */
+typedef ssize_t (*package_read_callback_t)(void *arg, const void **block);
+
+/*!
+ * @struct package_stream_t
+ * @brief A package read incrementally, without holding it in memory
+ *
+ * Since the package header and the chunk index are located at the end of the
+ * package, the last \a TRAILER_SIZE bytes read are held back until more data
+ * arrives; once the package is read completely, the header tells where the
+ * chunk index starts and the rest of the archive is released. The chunks are
+ * decompressed serially, as a single archive. */
+typedef struct {
+	package_read_callback_t read; /*!< The callback which reads the package */
+	void *arg; /*!< A pointer passed to the callback */
+	unsigned char trailer[TRAILER_SIZE]; /*!< The last bytes read */
+	size_t trailer_size; /*!< The number of bytes held in the trailer */
+	unsigned char spill[TRAILER_SIZE]; /*!< Trailer bytes released to the
+	                                    * reader */
+	const unsigned char *pending; /*!< A block to return on the next read */
+	size_t pending_size; /*!< The size of the pending block */
+	uint32_t checksum; /*!< The checksum of the archive bytes read so far */
+	size_t archive_size; /*!< The number of archive bytes read so far */
+	bool finished; /*!< Whether the package was read completely */
+} package_stream_t;
+
 /*!
  * @fn result_t package_open(package_t *package,
  *                           unsigned char *contents,
@@ -63,6 +206,82 @@ void package_close(package_t *package);
  * @param package The package */
 result_t package_verify(const package_t *package);
 
+/*!
+ * @fn bool package_detect_compression(const unsigned char *archive,
+ *                                     const size_t size,
+ *                                     compression_t *compression)
+ * @brief Determines the compression of an archive, by its magic number
+ * @param archive The beginning of the archive
+ * @param size The size of \a archive
+ * @param compression The archive compression
+ * @return true if the compression is supported, false otherwise */
+bool package_detect_compression(const unsigned char *archive,
+                                const size_t size,
+                                compression_t *compression);
+
+/*!
+ * @fn result_t package_reader_open(package_reader_t *reader,
+ *                                  const package_t *package,
+ *                                  const unsigned int threads)
+ * @brief Starts decompressing the archive contained in a verified package
+ * @param reader The decompressed archive
+ * @param package The package
+ * @param threads The number of threads which decompress the package
+ * @see package_reader_read
+ * @see package_reader_close
+ *
+ * If \a threads is 1, chunks are decompressed by the reading thread. Packages
+ * without a chunk index, created by older format versions, are read as a
+ * single compressed block, which the archive reader decompresses serially. */
+result_t package_reader_open(package_reader_t *reader,
+                             const package_t *package,
+                             const unsigned int threads);
+
+/*!
+ * @fn ssize_t package_reader_read(package_reader_t *reader,
+ *                                 const void **block)
+ * @brief Reads the next decompressed chunk of the archive contained in a
+ *        package
+ * @param reader The decompressed archive
+ * @param block The decompressed chunk
+ * @return The chunk size, 0 at the end of the archive or -1 on failure */
+ssize_t package_reader_read(package_reader_t *reader, const void **block);
+
+/*!
+ * @fn void package_reader_close(package_reader_t *reader)
+ * @brief Stops decompressing the archive contained in a package
+ * @param reader The decompressed archive */
+void package_reader_close(package_reader_t *reader);
+
+/*!
+ * @fn void package_stream_open(package_stream_t *stream,
+ *                              const package_read_callback_t read,
+ *                              void *arg)
+ * @brief Opens a package for incremental reading
+ * @param stream The package
+ * @param read The callback which reads the package
+ * @param arg A pointer passed to the callback
+ * @see package_stream_read
+ * @see package_stream_verify */
+void package_stream_open(package_stream_t *stream,
+                         const package_read_callback_t read,
+                         void *arg);
+
+/*!
+ * @fn ssize_t package_stream_read(package_stream_t *stream,
+ *                                 const void **block)
+ * @brief Reads the next block of the archive contained in a package
+ * @param stream The package
+ * @param block The archive block
+ * @return The block size, 0 at the end of the archive or -1 on failure */
+ssize_t package_stream_read(package_stream_t *stream, const void **block);
+
+/*!
+ * @fn result_t package_stream_verify(package_stream_t *stream)
+ * @brief Reads the rest of a package and verifies its integrity
+ * @param stream The package */
+result_t package_stream_verify(package_stream_t *stream);
+
 /*!
  * @} */
 
@@ -1,127 +1,705 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <errno.h>
 
+#include <zlib.h>
+
 #include "log.h"
 #include "archive.h"
 #include "package_ops.h"
 
-static result_t _register_file(const char *path,
+static result_t _register_file(const archive_staged_file_t *file,
                                file_register_params_t *params) {
-	assert(NULL != path);
+	assert(NULL != file);
 	assert(NULL != params);
 	assert(NULL != params->database);
 	assert(NULL != params->package);
 
-	return database_register_path(params->database, path, params->package);
+	return database_register_path(params->database,
+	                              file->path,
+	                              params->package,
+	                              file->state.size,
+	                              file->state.mode,
+	                              file->state.digest,
+	                              file->state.mtime);
 }
 
-result_t package_install(const char *name,
-                         package_t *package,
-                         database_t *database) {
-	/* the callback parameters */
-	file_register_params_t params = {0};
+static int _save_file(package_files_t *files,
+                      int count,
+                      char **values,
+                      char **names) {
+	/* the enlarged list of paths */
+	char **paths = NULL;
+
+	/* the enlarged list of file states */
+	archive_file_state_t *states = NULL;
+
+	/* the file state */
+	archive_file_state_t *state = NULL;
+
+	assert(NULL != files);
+	assert(NULL != values[FILE_FIELD_PATH]);
+
+	paths = realloc(files->paths, sizeof(char *) * (1 + files->count));
+	if (NULL == paths) {
+		return 1;
+	}
+	files->paths = paths;
+	states = realloc(files->states,
+	                 sizeof(archive_file_state_t) * (1 + files->count));
+	if (NULL == states) {
+		return 1;
+	}
+	files->states = states;
+
+	/* files registered before their state was recorded never match */
+	state = &states[files->count];
+	state->size = 0;
+	state->mode = 0;
+	state->digest = 0;
+	state->mtime = 0;
+	if ((NULL != values[FILE_FIELD_SIZE]) &&
+	    (NULL != values[FILE_FIELD_MODE]) &&
+	    (NULL != values[FILE_FIELD_DIGEST])) {
+		state->size = (off_t) strtoll(values[FILE_FIELD_SIZE], NULL, 10);
+		state->mode = (mode_t) strtoul(values[FILE_FIELD_MODE], NULL, 10);
+		state->digest = (uint32_t) strtoul(values[FILE_FIELD_DIGEST],
+		                                   NULL,
+		                                   10);
+	}
+	if (NULL != values[FILE_FIELD_MTIME]) {
+		state->mtime = (time_t) strtoll(values[FILE_FIELD_MTIME], NULL, 10);
+	}
+
+	paths[files->count] = strdup(values[FILE_FIELD_PATH]);
+	if (NULL == paths[files->count]) {
+		return 1;
+	}
+	++(files->count);
+
+	return 0;
+}
+
+result_t package_files_load(package_files_t *files,
+                            const char *name,
+                            database_t *database) {
+	/* a loop index */
+	unsigned int i = 0;
 
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != files);
 	assert(NULL != name);
-	assert(NULL != package);
 	assert(NULL != database);
 
-	log_write(LOG_INFO, "Unpacking %s\n", name);
+	files->paths = NULL;
+	files->states = NULL;
+	files->count = 0;
 
-	/* extract the archive */
-	params.package = name;
-	params.database = database;
-	return archive_extract(package->archive,
-	                       package->archive_size,
-	                       (file_callback_t) _register_file,
-	                       &params);
+	/* list the files, in reverse installation order */
+	result = database_for_each_file(database,
+	                                name,
+	                                (query_callback_t) _save_file,
+	                                files);
+	if (RESULT_OK != result) {
+		goto free_files;
+	}
+
+	/* index the files by path, once the list stopped moving */
+	result = hash_new(&files->index, files->count);
+	if (RESULT_OK != result) {
+		goto free_files;
+	}
+	for ( ; files->count > i; ++i) {
+		result = hash_put(&files->index, files->paths[i], &files->states[i]);
+		if (RESULT_OK != result) {
+			hash_free(&files->index);
+			goto free_files;
+		}
+	}
+	goto end;
+
+free_files:
+	/* free the list of files */
+	for (i = 0; files->count > i; ++i) {
+		free(files->paths[i]);
+	}
+	if (NULL != files->paths) {
+		free(files->paths);
+	}
+	if (NULL != files->states) {
+		free(files->states);
+	}
+
+end:
+	return result;
+}
+
+void package_files_free(package_files_t *files) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != files);
+
+	hash_free(&files->index);
+	for ( ; files->count > i; ++i) {
+		free(files->paths[i]);
+	}
+	if (NULL != files->paths) {
+		free(files->paths);
+	}
+	if (NULL != files->states) {
+		free(files->states);
+	}
 }
 
-static int _remove_file(database_t *database,
-                        int count,
-                        char **values,
-                        char **names) {
+file_status_t package_check_file(const char *path,
+                                 const archive_file_state_t *state) {
+	/* a chunk of the file */
+	unsigned char buffer[CHECK_BUFFER_SIZE];
+
 	/* the file attributes */
 	struct stat attributes = {0};
 
+	/* the size of a chunk */
+	ssize_t size = 0;
+
+	/* the file digest */
+	uint32_t digest = 0;
+
+	/* the file descriptor */
+	int fd = (-1);
+
 	/* the return value */
-	int abort = 0;
+	file_status_t status = FILE_STATUS_UNREADABLE;
 
-	assert(NULL != database);
-	assert(NULL != values[FILE_FIELD_PATH]);
+	assert(NULL != path);
+	assert(NULL != state);
+
+	if (-1 == lstat(path, &attributes)) {
+		if (ENOENT == errno) {
+			status = FILE_STATUS_MISSING;
+		}
+		goto end;
+	}
+
+	/* if the file state was not recorded, there is nothing to compare */
+	status = FILE_STATUS_OK;
+	if (0 == state->mode) {
+		goto end;
+	}
+
+	/* compare the file type and permissions; symbolic links have no
+	 * meaningful permissions */
+	if ((S_IFMT & state->mode) != (S_IFMT & attributes.st_mode)) {
+		status = FILE_STATUS_TYPE;
+		goto end;
+	}
+	if (S_ISLNK(attributes.st_mode)) {
+		goto end;
+	}
+	if (state->mode != attributes.st_mode) {
+		status = FILE_STATUS_MODE;
+		goto end;
+	}
+
+	/* compare the contents of regular files, unless they were not modified
+	 * since they were installed */
+	if (!S_ISREG(attributes.st_mode)) {
+		goto end;
+	}
+	if (state->size != attributes.st_size) {
+		status = FILE_STATUS_SIZE;
+		goto end;
+	}
+	if ((0 != state->mtime) && (state->mtime == attributes.st_mtime)) {
+		goto end;
+	}
+
+	status = FILE_STATUS_UNREADABLE;
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (-1 == fd) {
+		goto end;
+	}
+	(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	digest = (uint32_t) crc32(0L, Z_NULL, 0);
+	do {
+		size = read(fd, &buffer, sizeof(buffer));
+		switch (size) {
+			case (-1):
+				goto close_file;
+
+			case 0:
+				break;
+
+			default:
+				digest = (uint32_t) crc32((uLong) digest,
+				                          (const Bytef *) &buffer,
+				                          (uInt) size);
+				continue;
+		}
+		break;
+	} while (1);
+
+	if (state->digest == digest) {
+		status = FILE_STATUS_OK;
+	} else {
+		status = FILE_STATUS_CONTENTS;
+	}
+
+close_file:
+	/* close the file */
+	(void) close(fd);
+
+end:
+	return status;
+}
+
+static const archive_file_state_t *_lookup(const char *path,
+                                           const package_files_t *files) {
+	assert(NULL != path);
+	assert(NULL != files);
+
+	return (const archive_file_state_t *) hash_get(&files->index, path);
+}
+
+result_t package_stage(const char *name,
+                       package_t *package,
+                       const package_files_t *previous,
+                       const unsigned int decompressors,
+                       const unsigned int writers,
+                       archive_staging_t *staging) {
+	/* the decompressed archive */
+	package_reader_t reader = {0};
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != name);
+	assert(NULL != package);
+	assert(NULL != staging);
+
+	log_write(LOG_INFO, "Unpacking %s\n", name);
+
+	/* decompress the package chunks in parallel */
+	result = package_reader_open(&reader, package, decompressors);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+
+	/* extract the archive next to its destination */
+	result = archive_extract_staged(
+	                             (archive_read_callback_t) package_reader_read,
+	                             &reader,
+	                             name,
+	                             (archive_lookup_callback_t) _lookup,
+	                             (void *) previous,
+	                             writers,
+	                             staging);
+	package_reader_close(&reader);
+	if (RESULT_OK != result) {
+		log_write(LOG_ERROR, "Failed to unpack %s\n", name);
+	}
+
+end:
+	return result;
+}
+
+static result_t _delete_path(const char *path) {
+	/* the file attributes */
+	struct stat attributes = {0};
+
+	assert(NULL != path);
 
-	log_write(LOG_DEBUG, "Removing %s\n", values[FILE_FIELD_PATH]);
+	log_write(LOG_DEBUG, "Removing %s\n", path);
 
 	/* determine the file type - if it doesn't exist, it's fine */
-	if (-1 == lstat(values[FILE_FIELD_PATH], &attributes)) {
+	if (-1 == lstat(path, &attributes)) {
 		if (ENOENT != errno) {
-			abort = 1;
+			return RESULT_IO_ERROR;
 		}
-		goto end;
+		return RESULT_OK;
 	}
 
 	/* delete the file */
 	if (S_ISDIR(attributes.st_mode)) {
-		if (-1 == rmdir(values[FILE_FIELD_PATH])) {
+		if (-1 == rmdir(path)) {
 			switch (errno) {
 				case ENOTEMPTY:
 				case EROFS:
 					break;
 
 				default:
-					log_write(LOG_ERROR,
-					          "Failed to remove %s\n",
-					          values[FILE_FIELD_PATH]);
-					abort = 1;
-					goto end;
+					log_write(LOG_ERROR, "Failed to remove %s\n", path);
+					return RESULT_IO_ERROR;
 			}
 		}
 	} else {
-		if (-1 == unlink(values[FILE_FIELD_PATH])) {
-			log_write(LOG_ERROR,
-			          "Failed to remove %s\n",
-			          values[FILE_FIELD_PATH]);
-			abort = 1;
-			goto end;
+		if (-1 == unlink(path)) {
+			log_write(LOG_ERROR, "Failed to remove %s\n", path);
+			return RESULT_IO_ERROR;
 		}
 	}
 
-	/* unregister the file */
-	if (RESULT_OK != database_unregister_path(database,
-	                                          values[FILE_FIELD_PATH])) {
-		abort = 1;
+	return RESULT_OK;
+}
+
+result_t package_commit(const char *name,
+                        archive_staging_t *staging,
+                        const package_files_t *previous,
+                        database_t *database) {
+	/* the callback parameters */
+	file_register_params_t params = {0};
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != name);
+	assert(NULL != staging);
+	assert(NULL != previous);
+	assert(NULL != database);
+
+	/* if another version of the package is installed, unregister its files,
+	 * but keep them in place until they are replaced */
+	if (0 < previous->count) {
+		result = database_unregister_files(database, name);
+		if (RESULT_OK != result) {
+			goto rollback;
+		}
 	}
 
-end:
-	return abort;
+	/* put the files in place and register them */
+	params.package = name;
+	params.database = database;
+	result = archive_staging_commit(staging,
+	                                (staged_file_callback_t) _register_file,
+	                                &params);
+	if (RESULT_OK != result) {
+		goto rollback;
+	}
+	goto free_staging;
+
+rollback:
+	/* delete all files which were not put in place */
+	log_write(LOG_ERROR, "Failed to install %s\n", name);
+	archive_staging_rollback(staging);
+
+free_staging:
+	/* free the list of extracted files */
+	archive_staging_free(staging);
+
+	return result;
+}
+
+void package_prune(const package_files_t *previous, database_t *database) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != previous);
+	assert(NULL != database);
+
+	/* delete files which no longer belong to any package; the files are listed
+	 * in reverse installation order, so directories are empty when they get
+	 * deleted */
+	for ( ; previous->count > i; ++i) {
+		switch (database_owns_path(database, previous->paths[i])) {
+			case RESULT_YES:
+				break;
+
+			case RESULT_NO:
+				if (RESULT_OK != _delete_path(previous->paths[i])) {
+					log_write(LOG_WARNING,
+					          "Failed to remove %s, which is no longer "
+					          "needed\n",
+					          previous->paths[i]);
+				}
+				break;
+
+			default:
+				log_write(LOG_WARNING,
+				          "Failed to determine whether %s is still needed\n",
+				          previous->paths[i]);
+				return;
+		}
+	}
+}
+
+void package_unstage(archive_staging_t *staging, database_t *database) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != staging);
+	assert(NULL != database);
+
+	/* another package may have been installed after creating a directory it
+	 * shares with this one */
+	for ( ; staging->count > i; ++i) {
+		if ((true == staging->files[i].created) &&
+		    (RESULT_YES == database_owns_path(database,
+		                                      staging->files[i].path))) {
+			staging->files[i].created = false;
+		}
+	}
+
+	archive_staging_rollback(staging);
+	archive_staging_free(staging);
+}
+
+result_t package_install_stream(const char *name,
+                                package_stream_t *stream,
+                                const package_files_t *previous,
+                                const unsigned int writers,
+                                database_t *database) {
+	/* the extracted files */
+	archive_staging_t staging = {0};
+
+	/* the return value */
+	result_t result = RESULT_OK;
+
+	assert(NULL != name);
+	assert(NULL != stream);
+	assert(NULL != previous);
+	assert(NULL != database);
+
+	log_write(LOG_INFO, "Unpacking %s\n", name);
+
+	/* extract the archive while it is being read */
+	result = archive_extract_staged(
+	                             (archive_read_callback_t) package_stream_read,
+	                             stream,
+	                             name,
+	                             (archive_lookup_callback_t) _lookup,
+	                             (void *) previous,
+	                             writers,
+	                             &staging);
+	if (RESULT_OK != result) {
+		goto rollback;
+	}
+
+	/* verify the package integrity */
+	result = package_stream_verify(stream);
+	if (RESULT_OK != result) {
+		goto rollback;
+	}
+
+	/* put the files in place and register them */
+	return package_commit(name, &staging, previous, database);
+
+rollback:
+	/* delete all files which were not put in place */
+	log_write(LOG_ERROR, "Failed to unpack %s\n", name);
+	archive_staging_rollback(&staging);
+
+	/* free the list of extracted files */
+	archive_staging_free(&staging);
+
+	return result;
+}
+
+static void _locate(package_removed_file_t *file,
+                    const char *path,
+                    const mode_t mode) {
+	/* the end of the path, without a trailing slash */
+	const char *end = NULL;
+
+	/* a character in the path */
+	const char *position = NULL;
+
+	assert(NULL != file);
+	assert(NULL != path);
+
+	file->path = path;
+	file->name = path;
+	file->parent_length = 0;
+	file->depth = 0;
+	file->mode = mode;
+
+	end = path + strlen(path);
+	if ((path < end) && ('/' == end[-1])) {
+		--end;
+	}
+	for (position = path; end > position; ++position) {
+		if ('/' == *position) {
+			file->name = position + 1;
+			file->parent_length = (size_t) (position - path);
+			++(file->depth);
+		}
+	}
+}
+
+static int _compare_removed(const package_removed_file_t *a,
+                            const package_removed_file_t *b) {
+	assert(NULL != a);
+	assert(NULL != b);
+
+	/* delete deeper files first, so directories are empty when they get
+	 * deleted */
+	if (a->depth != b->depth) {
+		return (a->depth > b->depth) ? (-1) : 1;
+	}
+
+	/* files of equal depth in the same directory share a path prefix, so
+	 * sorting by path groups them together */
+	return strcmp(a->path, b->path);
+}
+
+static result_t _delete_at(const int fd, const package_removed_file_t *file) {
+	/* the unlinkat() flags */
+	int flags = 0;
+
+	assert(NULL != file);
+
+	log_write(LOG_DEBUG, "Removing %s\n", file->path);
+
+	if (S_ISDIR(file->mode)) {
+		flags = AT_REMOVEDIR;
+	}
+	if (0 == unlinkat(fd, file->name, flags)) {
+		return RESULT_OK;
+	}
+
+	/* if the file type is unknown or changed since installation, try again */
+	if ((EISDIR == errno) || (ENOTDIR == errno)) {
+		flags ^= AT_REMOVEDIR;
+		if (0 == unlinkat(fd, file->name, flags)) {
+			return RESULT_OK;
+		}
+	}
+
+	switch (errno) {
+		/* if the file doesn't exist, it's fine */
+		case ENOENT:
+			return RESULT_OK;
+
+		/* directories which contain other files are kept */
+		case ENOTEMPTY:
+		case EEXIST:
+		case EROFS:
+			if (AT_REMOVEDIR == flags) {
+				return RESULT_OK;
+			}
+			break;
+	}
+
+	log_write(LOG_ERROR, "Failed to remove %s\n", file->path);
+	return RESULT_IO_ERROR;
 }
 
 result_t package_remove(const char *name, database_t *database) {
+	/* the package files */
+	package_files_t files = {0};
+
+	/* the package files, in deletion order */
+	package_removed_file_t *removed = NULL;
+
+	/* the path of the open parent directory */
+	const char *parent = NULL;
+
+	/* the length of the parent directory path */
+	size_t parent_length = 0;
+
+	/* the parent directory path, as a string */
+	char *parent_path = NULL;
+
+	/* the parent directory file descriptor or -1 if it doesn't exist */
+	int fd = AT_FDCWD;
+
+	/* a loop index */
+	unsigned int i = 0;
+
 	/* the return value */
 	result_t result = RESULT_OK;
 
 	assert(NULL != name);
 	assert(NULL != database);
 
-	/* delete the package files */
-	result = database_for_each_file(database,
-	                                name,
-	                                (query_callback_t) _remove_file,
-	                                database);
+	/* list the package files */
+	result = package_files_load(&files, name, database);
 	if (RESULT_OK != result) {
 		goto end;
 	}
+	removed = malloc(sizeof(package_removed_file_t) * (1 + files.count));
+	if (NULL == removed) {
+		result = RESULT_MEM_ERROR;
+		goto free_files;
+	}
+	for ( ; files.count > i; ++i) {
+		_locate(&removed[i], files.paths[i], files.states[i].mode);
+	}
+	qsort(removed,
+	      files.count,
+	      sizeof(package_removed_file_t),
+	      (int (*)(const void *, const void *)) _compare_removed);
+
+	/* delete the package files */
+	for (i = 0; files.count > i; ++i) {
+		/* open the parent directory, once for all files it contains */
+		if ((NULL == parent) ||
+		    (removed[i].parent_length != parent_length) ||
+		    (0 != strncmp(parent, removed[i].path, parent_length))) {
+			if (0 <= fd) {
+				(void) close(fd);
+			}
+			fd = AT_FDCWD;
+			parent = removed[i].path;
+			parent_length = removed[i].parent_length;
+			if (0 < parent_length) {
+				parent_path = strndup(parent, parent_length);
+				if (NULL == parent_path) {
+					result = RESULT_MEM_ERROR;
+					goto free_removed;
+				}
+				fd = open(parent_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+				if ((-1 == fd) && (ENOENT != errno)) {
+					log_write(LOG_ERROR, "Failed to open %s\n", parent_path);
+					free(parent_path);
+					result = RESULT_IO_ERROR;
+					goto free_removed;
+				}
+				free(parent_path);
+			}
+		}
+
+		/* if the parent directory doesn't exist, neither does the file */
+		if (-1 == fd) {
+			continue;
+		}
+
+		result = _delete_at(fd, &removed[i]);
+		if (RESULT_OK != result) {
+			goto close_parent;
+		}
+	}
+
+	/* unregister all files at once */
+	result = database_unregister_files(database, name);
+	if (RESULT_OK != result) {
+		goto close_parent;
+	}
 
 	/* unregister the package */
 	result = database_remove_installation_data(database, name);
-	if (RESULT_OK != result) {
-		goto end;
+
+close_parent:
+	/* close the last parent directory */
+	if (0 <= fd) {
+		(void) close(fd);
 	}
 
-	/* report success */
-	result = RESULT_OK;
+free_removed:
+	/* free the deletion order */
+	free(removed);
+
+free_files:
+	/* free the list of files */
+	package_files_free(&files);
 
 end:
 	return result;
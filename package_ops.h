@@ -4,6 +4,8 @@
 #	include "result.h"
 #	include "database.h"
 #	include "package.h"
+#	include "archive.h"
+#	include "hash.h"
 
 /*!
  * @defgroup package_ops "Package Operations"
@@ -19,22 +21,183 @@ typedef struct {
 } file_register_params_t;
 
 /*!
- * @fn result_t package_install(const char *name,
- *                              package_t *package,
- *                              database_t *database);
- * @brief Installs a package
+ * @struct package_files_t
+ * @brief The files of an installed package
+ * @see package_files_load */
+typedef struct {
+	char **paths; /*!< The file paths, in reverse installation order */
+	archive_file_state_t *states; /*!< The recorded state of each file */
+	unsigned int count; /*!< The number of files */
+	hash_t index; /*!< Maps each path to its recorded state */
+} package_files_t;
+
+/*!
+ * @struct package_removed_file_t
+ * @brief A file removed with its package
+ * @see package_remove */
+typedef struct {
+	const char *path; /*!< The file path */
+	const char *name; /*!< The file name, relative to its parent directory */
+	size_t parent_length; /*!< The length of the parent directory path or 0
+	                       *   if the file is in the working directory */
+	unsigned int depth; /*!< The number of parent directories */
+	mode_t mode; /*!< The recorded file mode or 0 */
+} package_removed_file_t;
+
+/*!
+ * @def CHECK_BUFFER_SIZE
+ * @brief The size of the buffer used to read files whose digest is checked */
+#	define CHECK_BUFFER_SIZE (64 * 1024)
+
+/*!
+ * @typedef file_status_t
+ * @brief The result of comparing an installed file with its recorded state */
+typedef unsigned int file_status_t;
+
+enum file_statuses {
+	FILE_STATUS_OK         = 0, /*!< The file matches its recorded state */
+	FILE_STATUS_MISSING    = 1, /*!< The file does not exist */
+	FILE_STATUS_TYPE       = 2, /*!< The file type changed */
+	FILE_STATUS_MODE       = 3, /*!< The file permissions changed */
+	FILE_STATUS_SIZE       = 4, /*!< The file size changed */
+	FILE_STATUS_CONTENTS   = 5, /*!< The file contents changed */
+	FILE_STATUS_UNREADABLE = 6, /*!< The file could not be checked */
+	FILE_STATUSES_COUNT    = 7
+};
+
+/*!
+ * @fn result_t package_files_load(package_files_t *files,
+ *                                 const char *name,
+ *                                 database_t *database)
+ * @brief Loads the files of an installed package
+ * @param files The files
+ * @param name The package name
+ * @param database The installation data database
+ * @see package_files_free
+ *
+ * If the package is not installed, the list of files is empty. */
+result_t package_files_load(package_files_t *files,
+                            const char *name,
+                            database_t *database);
+
+/*!
+ * @fn void package_files_free(package_files_t *files)
+ * @brief Frees the files loaded by package_files_load()
+ * @param files The files */
+void package_files_free(package_files_t *files);
+
+/*!
+ * @fn file_status_t package_check_file(const char *path,
+ *                                      const archive_file_state_t *state)
+ * @brief Compares an installed file with its recorded state
+ * @param path The file path
+ * @param state The recorded state of the file
+ *
+ * The contents of a regular file are read only if its modification time
+ * differs from the recorded one. Files registered before their state was
+ * recorded are only checked for existence. */
+file_status_t package_check_file(const char *path,
+                                 const archive_file_state_t *state);
+
+/*!
+ * @fn result_t package_stage(const char *name,
+ *                            package_t *package,
+ *                            const package_files_t *previous,
+ *                            const unsigned int decompressors,
+ *                            const unsigned int writers,
+ *                            archive_staging_t *staging);
+ * @brief Extracts a package without replacing existing files
  * @param name The package name
  * @param package The package
- * @param database The database the package gets added to */
-result_t package_install(const char *name,
-                         package_t *package,
-                         database_t *database);
+ * @param previous The files of the installed version of the package
+ * @param decompressors The number of threads which decompress the package
+ * @param writers The number of threads which write files
+ * @param staging The extracted files
+ * @see package_commit
+ *
+ * Files identical to those of the installed version are not extracted. This
+ * function does not access any database, so packages may be extracted
+ * simultaneously by multiple threads. Even if it fails, the extracted files
+ * must be deleted using package_unstage() or put in place using
+ * package_commit(). */
+result_t package_stage(const char *name,
+                       package_t *package,
+                       const package_files_t *previous,
+                       const unsigned int decompressors,
+                       const unsigned int writers,
+                       archive_staging_t *staging);
+
+/*!
+ * @fn result_t package_commit(const char *name,
+ *                             archive_staging_t *staging,
+ *                             const package_files_t *previous,
+ *                             database_t *database);
+ * @brief Puts the files extracted by package_stage() in place and registers
+ *        them
+ * @param name The package name
+ * @param staging The extracted files
+ * @param previous The files of the installed version of the package
+ * @param database The database the package gets added to
+ *
+ * If another version of the package is installed, its files are replaced in
+ * place; files which are no longer needed must be deleted using
+ * package_prune(), once the database changes are committed. The list of
+ * extracted files is freed, even if this function fails. */
+result_t package_commit(const char *name,
+                        archive_staging_t *staging,
+                        const package_files_t *previous,
+                        database_t *database);
+
+/*!
+ * @fn void package_prune(const package_files_t *previous,
+ *                        database_t *database)
+ * @brief Deletes the files of a replaced package version which no longer belong
+ *        to any package
+ * @param previous The files of the replaced version
+ * @param database The database of installed packages */
+void package_prune(const package_files_t *previous, database_t *database);
+
+/*!
+ * @fn void package_unstage(archive_staging_t *staging,
+ *                          database_t *database)
+ * @brief Deletes the files extracted by package_stage() and frees their list
+ * @param staging The extracted files
+ * @param database The database of installed packages
+ *
+ * Directories created during extraction are kept if a package installed
+ * meanwhile contains them. */
+void package_unstage(archive_staging_t *staging, database_t *database);
+
+/*!
+ * @fn result_t package_install_stream(const char *name,
+ *                                     package_stream_t *stream,
+ *                                     const package_files_t *previous,
+ *                                     const unsigned int writers,
+ *                                     database_t *database);
+ * @brief Installs a package while it is being read
+ * @param name The package name
+ * @param stream The package
+ * @param previous The files of the installed version of the package
+ * @param writers The number of threads which write files
+ * @param database The database the package gets added to
+ *
+ * The package files are put in place and registered only once the integrity of
+ * the whole package has been verified. */
+result_t package_install_stream(const char *name,
+                                package_stream_t *stream,
+                                const package_files_t *previous,
+                                const unsigned int writers,
+                                database_t *database);
 
 /*!
  * @fn result_t package_remove(const char *name, database_t *database);
  * @brief Removes a package
  * @param name The package name
- * @param databasee The database the package gets removed from */
+ * @param databasee The database the package gets removed from
+ *
+ * Files are deleted deepest first, relative to their parent directory, which
+ * is opened once for all files it contains. Then, all files are unregistered
+ * at once; the caller should run this within a transaction. */
 result_t package_remove(const char *name, database_t *database);
 
 /*!
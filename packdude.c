@@ -1,31 +1,134 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdbool.h>
 
 #include "log.h"
+#include "cache.h"
 #include "manager.h"
 
 #define REPO_ENVIRONMENT_VARIABLE "REPO"
 
+#define DURABILITY_SAFE_NAME "safe"
+#define DURABILITY_BALANCED_NAME "balanced"
+#define DURABILITY_IMAGE_BUILD_NAME "image-build"
+
+#define STANDARD_INPUT_PATH "-"
+
 typedef unsigned int action_t;
 
 enum actions {
-	ACTION_INSTALL        = 0,
-	ACTION_REMOVE         = 1,
-	ACTION_LIST_INSTALLED = 2,
-	ACTION_LIST_AVAILABLE = 3,
-	ACTION_LIST_REMOVABLE = 4,
-	ACTION_LIST_FILES     = 5,
-	ACTION_INVALID        = 6
+	ACTION_INSTALL         = 0,
+	ACTION_REMOVE          = 1,
+	ACTION_LIST_INSTALLED  = 2,
+	ACTION_LIST_AVAILABLE  = 3,
+	ACTION_LIST_REMOVABLE  = 4,
+	ACTION_LIST_FILES      = 5,
+	ACTION_PRUNE_CACHE     = 6,
+	ACTION_LIST_DEPENDENTS = 7,
+	ACTION_LIST_UPGRADABLE = 8,
+	ACTION_LIST_ORPHANED   = 9,
+	ACTION_UPGRADE         = 10,
+	ACTION_VERIFY          = 11,
+	ACTION_INVALID         = 12
 };
 
 __attribute__((noreturn)) static void _show_help() {
-	log_dump("Usage: packdude [-d] [-n] [-p PREFIX] [-u URL] -l|-q|-c|-f|-i|-r PACKAGE\n");
+	log_dump("Usage: packdude [-d] [-n] [-s] [-b] [-p PREFIX] [-u URL] [-j JOBS] [-w WORKERS] [-Z DECOMPRESSORS] [-W WRITERS] [-D DURABILITY] [-F FILE] -l|-q|-c|-o|-O|-f PACKAGE|-R PACKAGE|-i|-r|-U|-V [PACKAGE]...|-P SIZE\n");
 	exit(EXIT_FAILURE);
 }
 
+static bool _add_package(char ***packages,
+                         unsigned int *count,
+                         const char *name) {
+	/* the enlarged list of packages */
+	char **more_packages = NULL;
+
+	more_packages = realloc(*packages, sizeof(char *) * (1 + *count));
+	if (NULL == more_packages) {
+		return false;
+	}
+	*packages = more_packages;
+
+	more_packages[*count] = strdup(name);
+	if (NULL == more_packages[*count]) {
+		return false;
+	}
+	++(*count);
+
+	return true;
+}
+
+static bool _read_packages(char ***packages,
+                           unsigned int *count,
+                           const char *path) {
+	/* the list file */
+	FILE *file = NULL;
+
+	/* a line */
+	char *line = NULL;
+
+	/* the line buffer size */
+	size_t size = 0;
+
+	/* the line length */
+	ssize_t length = 0;
+
+	/* the return value */
+	bool is_success = false;
+
+	/* open the list */
+	if (0 == strcmp(STANDARD_INPUT_PATH, path)) {
+		file = stdin;
+	} else {
+		file = fopen(path, "r");
+		if (NULL == file) {
+			log_write(LOG_ERROR, "Failed to open %s\n", path);
+			goto end;
+		}
+	}
+
+	/* add each non-empty line to the list of packages */
+	do {
+		length = getline(&line, &size, file);
+		if (-1 == length) {
+			if (0 != ferror(file)) {
+				log_write(LOG_ERROR, "Failed to read %s\n", path);
+				goto close_file;
+			}
+			break;
+		}
+		for ( ; (0 < length) && (NULL != strchr(" \t\r\n", line[length - 1]));
+		     --length);
+		if (0 == length) {
+			continue;
+		}
+		line[length] = '\0';
+		if (false == _add_package(packages, count, line)) {
+			goto close_file;
+		}
+	} while (1);
+
+	/* report success */
+	is_success = true;
+
+close_file:
+	/* free the line buffer */
+	if (NULL != line) {
+		free(line);
+	}
+
+	/* close the list */
+	if (stdin != file) {
+		(void) fclose(file);
+	}
+
+end:
+	return is_success;
+}
+
 int main(int argc, char *argv[]) {
 	/* the package mangager instance */
 	manager_t manager = {{0}};
@@ -51,15 +154,49 @@ int main(int argc, char *argv[]) {
 	/* the package installation reason */
 	const char *reason = INSTALLATION_REASON_USER;
 
-	/* the installed or removed package */
+	/* the package whose files or dependents are listed */
 	const char *package = NULL;
 
+	/* the installed or removed packages */
+	char **packages = NULL;
+
+	/* the number of installed or removed packages */
+	unsigned int count = 0;
+
+	/* a loop index */
+	unsigned int i = 0;
+
 	/* the repository URL */
 	const char *url = NULL;
 
+	/* the package manager settings */
+	manager_settings_t settings = {0};
+
+	/* the end of a parsed number */
+	char *number_end = NULL;
+
+	/* the package cache */
+	cache_t cache = {0};
+
+	/* the maximum package cache size, in megabytes */
+	unsigned long cache_size = 0;
+
+	/* the number of processors */
+	long processors = 0;
+
+	/* set the default settings */
+	settings.concurrency = DEFAULT_FETCHER_CONCURRENCY;
+	processors = sysconf(_SC_NPROCESSORS_ONLN);
+	settings.workers = (0 < processors) ? (unsigned int) processors : 1;
+	settings.decompressors = 1;
+	settings.writers = 1;
+	settings.stream = false;
+	settings.background_refresh = false;
+	settings.durability = DURABILITY_SAFE;
+
 	/* parse the command-line */
 	do {
-		option = getopt(argc, argv, "dnlqcf:u:i:r:p:");
+		option = getopt(argc, argv, "dnsblqcoOirUVf:R:u:p:j:w:Z:W:P:D:F:");
 		switch (option) {
 			case 'd':
 				debug = true;
@@ -71,12 +208,25 @@ int main(int argc, char *argv[]) {
 
 			case 'r':
 				action = ACTION_REMOVE;
-				package = optarg;
 				break;
 
 			case 'i':
 				action = ACTION_INSTALL;
-				package = optarg;
+				break;
+
+			case 'U':
+				action = ACTION_UPGRADE;
+				break;
+
+			case 'V':
+				action = ACTION_VERIFY;
+				verbosity_level = LOG_NOTHING;
+				break;
+
+			case 'F':
+				if (false == _read_packages(&packages, &count, optarg)) {
+					goto free_packages;
+				}
 				break;
 
 			case 'n':
@@ -98,33 +248,131 @@ int main(int argc, char *argv[]) {
 				verbosity_level = LOG_NOTHING;
 				break;
 
+			case 'o':
+				action = ACTION_LIST_UPGRADABLE;
+				verbosity_level = LOG_NOTHING;
+				break;
+
+			case 'O':
+				action = ACTION_LIST_ORPHANED;
+				verbosity_level = LOG_NOTHING;
+				break;
+
 			case 'f':
 				action = ACTION_LIST_FILES;
 				verbosity_level = LOG_NOTHING;
 				package = optarg;
 				break;
 
+			case 'R':
+				action = ACTION_LIST_DEPENDENTS;
+				verbosity_level = LOG_NOTHING;
+				package = optarg;
+				break;
+
 			case 'u':
 				url = optarg;
 				break;
 
+			case 'P':
+				action = ACTION_PRUNE_CACHE;
+				cache_size = strtoul(optarg, &number_end, 10);
+				if ('\0' != *number_end) {
+					_show_help();
+				}
+				break;
+
+			case 's':
+				settings.stream = true;
+				break;
+
+			case 'b':
+				settings.background_refresh = true;
+				break;
+
+			case 'j':
+				settings.concurrency = (unsigned int) strtoul(optarg,
+				                                              &number_end,
+				                                              10);
+				if ((0 == settings.concurrency) || ('\0' != *number_end)) {
+					_show_help();
+				}
+				break;
+
+			case 'w':
+				settings.workers = (unsigned int) strtoul(optarg,
+				                                          &number_end,
+				                                          10);
+				if ((0 == settings.workers) || ('\0' != *number_end)) {
+					_show_help();
+				}
+				break;
+
+			case 'Z':
+				settings.decompressors = (unsigned int) strtoul(optarg,
+				                                                &number_end,
+				                                                10);
+				if ((0 == settings.decompressors) || ('\0' != *number_end)) {
+					_show_help();
+				}
+				break;
+
+			case 'W':
+				settings.writers = (unsigned int) strtoul(optarg,
+				                                          &number_end,
+				                                          10);
+				if ((0 == settings.writers) || ('\0' != *number_end)) {
+					_show_help();
+				}
+				break;
+
+			case 'D':
+				if (0 == strcmp(DURABILITY_SAFE_NAME, optarg)) {
+					settings.durability = DURABILITY_SAFE;
+				} else if (0 == strcmp(DURABILITY_BALANCED_NAME, optarg)) {
+					settings.durability = DURABILITY_BALANCED;
+				} else if (0 == strcmp(DURABILITY_IMAGE_BUILD_NAME, optarg)) {
+					settings.durability = DURABILITY_IMAGE_BUILD;
+				} else {
+					_show_help();
+				}
+				break;
+
 			case (-1):
+				/* all other arguments are installed or removed packages */
+				for ( ; argc > optind; ++optind) {
+					if (false == _add_package(&packages,
+					                          &count,
+					                          argv[optind])) {
+						goto free_packages;
+					}
+				}
+
 				switch (action) {
-					case ACTION_REMOVE:
 					case ACTION_LIST_FILES:
+					case ACTION_LIST_DEPENDENTS:
 						if (NULL == package) {
 							_show_help();
 						}
 						break;
 
+					case ACTION_REMOVE:
+						if (0 == count) {
+							_show_help();
+						}
+						break;
+
 					case ACTION_INSTALL:
-						if (NULL == package) {
+						if (0 == count) {
 							_show_help();
 						}
 
 						/* fall-through */
 
+					case ACTION_UPGRADE:
 					case ACTION_LIST_AVAILABLE:
+					case ACTION_LIST_UPGRADABLE:
+					case ACTION_LIST_ORPHANED:
 						if (NULL == url) {
 							url = getenv(REPO_ENVIRONMENT_VARIABLE);
 							if (NULL == url) {
@@ -150,29 +398,57 @@ done:
 	}
 	log_set_level(verbosity_level);
 
+	/* the package cache is shared by all prefixes, so pruning it does not
+	 * involve the package manager */
+	if (ACTION_PRUNE_CACHE == action) {
+		if (RESULT_OK != cache_open(&cache,
+		                            PACKAGE_CACHE_PATH,
+		                            MAX_PACKAGE_CACHE_SIZE)) {
+			goto free_packages;
+		}
+		if (RESULT_OK != cache_prune(&cache,
+		                             (off_t) cache_size * 1024 * 1024)) {
+			goto free_packages;
+		}
+		exit_code = EXIT_SUCCESS;
+		goto free_packages;
+	}
+
 	/* initialize the package manager */
-	if (RESULT_OK != manager_new(&manager, prefix, url)) {
-		goto end;
+	if (RESULT_OK != manager_new(&manager, prefix, url, &settings)) {
+		goto free_packages;
 	}
 
 	switch (action) {
 		case ACTION_INSTALL:
-			if (RESULT_OK != manager_fetch(&manager, package, reason)) {
+			if (RESULT_OK != manager_fetch(&manager,
+			                               packages,
+			                               count,
+			                               reason)) {
 				goto close_package_manager;
 			}
 			break;
 
-		case ACTION_REMOVE:
-			if (RESULT_OK != manager_remove(&manager, package)) {
+		case ACTION_UPGRADE:
+			/* if no packages were specified, upgrade all packages */
+			if (RESULT_OK != manager_upgrade(&manager, packages, count)) {
 				goto close_package_manager;
 			}
+			break;
 
-			/* once the package is removed, clean up all unneeded
-			 * dependencies */
-			if (RESULT_OK != manager_cleanup(&manager)) {
+		case ACTION_VERIFY:
+			/* if no packages were specified, verify all packages */
+			if (RESULT_OK != manager_verify(&manager, packages, count)) {
 				goto close_package_manager;
 			}
+			break;
 
+		case ACTION_REMOVE:
+			/* remove the packages and clean up all unneeded dependencies,
+			 * in one pass */
+			if (RESULT_OK != manager_remove(&manager, packages, count)) {
+				goto close_package_manager;
+			}
 			break;
 
 		case ACTION_LIST_INSTALLED:
@@ -193,11 +469,29 @@ done:
 			}
 			break;
 
+		case ACTION_LIST_UPGRADABLE:
+			if (RESULT_OK != manager_list_upgradable(&manager)) {
+				goto close_package_manager;
+			}
+			break;
+
+		case ACTION_LIST_ORPHANED:
+			if (RESULT_OK != manager_list_orphaned(&manager)) {
+				goto close_package_manager;
+			}
+			break;
+
 		case ACTION_LIST_FILES:
 			if (RESULT_OK != manager_list_files(&manager, package)) {
 				goto close_package_manager;
 			}
 			break;
+
+		case ACTION_LIST_DEPENDENTS:
+			if (RESULT_OK != manager_list_dependents(&manager, package)) {
+				goto close_package_manager;
+			}
+			break;
 	}
 
 	/* report success */
@@ -207,6 +501,14 @@ close_package_manager:
 	/* shut down the package manager */
 	manager_free(&manager);
 
-end:
+free_packages:
+	/* free the list of installed or removed packages */
+	for ( ; count > i; ++i) {
+		free(packages[i]);
+	}
+	if (NULL != packages) {
+		free(packages);
+	}
+
 	return exit_code;
 }
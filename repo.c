@@ -3,6 +3,8 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
@@ -11,14 +13,18 @@
 #include <zlib.h>
 
 #include "log.h"
+#include "delta.h"
 #include "repo.h"
 
-result_t repo_open(repo_t *repo, const char *url) {
+result_t repo_open(repo_t *repo,
+                   const char *url,
+                   const unsigned int concurrency) {
 	/* the return value */
 	result_t result = RESULT_MEM_ERROR;
 
 	assert(NULL != repo);
 	assert(NULL != url);
+	assert(0 < concurrency);
 
 	/* initialize the repository fetcher */
 	log_write(LOG_DEBUG, "Connecting to the repository at %s\n", url);
@@ -27,11 +33,34 @@ result_t repo_open(repo_t *repo, const char *url) {
 		goto end;
 	}
 
+	/* initialize the fetcher pool used for parallel downloads */
+	result = fetcher_pool_new(&repo->pool, concurrency);
+	if (RESULT_OK != result) {
+		goto free_fetcher;
+	}
+
+	/* open the package cache - if it's unavailable, packages are always
+	 * fetched */
+	if (RESULT_OK == cache_open(&repo->cache,
+	                            PACKAGE_CACHE_PATH,
+	                            MAX_PACKAGE_CACHE_SIZE)) {
+		repo->cached = true;
+	} else {
+		log_write(LOG_WARNING, "The package cache is unavailable\n");
+		repo->cached = false;
+	}
+
 	/* save the repository URL */
 	repo->url = url;
+	repo->refresh.running = false;
 
 	/* report success */
 	result = RESULT_OK;
+	goto end;
+
+free_fetcher:
+	/* free the fetcher */
+	fetcher_free(&repo->fetcher);
 
 end:
 	return result;
@@ -40,71 +69,556 @@ end:
 void repo_close(repo_t *repo) {
 	assert(NULL != repo);
 
+	/* wait for the background refresh of the metadata database */
+	if (true == repo->refresh.running) {
+		log_write(LOG_DEBUG, "Waiting for the package database refresh\n");
+		(void) pthread_join(repo->refresh.thread, NULL);
+		fetcher_free(&repo->refresh.fetcher);
+		repo->refresh.running = false;
+	}
+
 	/* free the fetcher */
 	log_write(LOG_DEBUG, "Disconnecting from %s\n", repo->url);
+	fetcher_pool_free(&repo->pool);
 	fetcher_free(&repo->fetcher);
 }
 
-result_t repo_get_database(repo_t *repo, database_t *database) {
-	/* the dayabase path */
-	char path[PATH_MAX] = {'\0'};
+static void _load_validators(const char *path,
+                             fetcher_validators_t *validators) {
+	/* the validators file */
+	FILE *file = NULL;
+
+	/* the modification time */
+	long last_modified = 0;
+
+	/* the entity tag length */
+	size_t length = 0;
+
+	assert(NULL != path);
+	assert(NULL != validators);
+
+	/* if the validators are missing or corrupt, fetch the database
+	 * unconditionally */
+	validators->etag[0] = '\0';
+	validators->last_modified = 0;
+
+	file = fopen(path, "r");
+	if (NULL == file) {
+		return;
+	}
+
+	if (1 != fscanf(file, "%ld\n", &last_modified)) {
+		goto close_file;
+	}
+	if (NULL == fgets((char *) &validators->etag,
+	                  sizeof(validators->etag),
+	                  file)) {
+		validators->etag[0] = '\0';
+	} else {
+		/* strip the line break */
+		length = strlen((const char *) &validators->etag);
+		if ((0 < length) && ('\n' == validators->etag[length - 1])) {
+			validators->etag[length - 1] = '\0';
+		}
+	}
+	validators->last_modified = (time_t) last_modified;
+
+close_file:
+	/* close the file */
+	(void) fclose(file);
+}
+
+static void _save_validators(const char *path,
+                             const fetcher_validators_t *validators) {
+	/* the validators file */
+	FILE *file = NULL;
+
+	assert(NULL != path);
+	assert(NULL != validators);
+
+	file = fopen(path, "w");
+	if (NULL == file) {
+		return;
+	}
+
+	if (0 > fprintf(file,
+	                "%ld\n%s\n",
+	                (long) validators->last_modified,
+	                (const char *) &validators->etag)) {
+		(void) fclose(file);
+		(void) unlink(path);
+		return;
+	}
+
+	if (0 != fclose(file)) {
+		(void) unlink(path);
+	}
+}
+
+static result_t _revalidate(fetcher_t *fetcher,
+                            const repo_refresh_t *refresh,
+                            const bool cached) {
+	/* the validators of the cached database */
+	fetcher_validators_t validators = {{'\0'}};
+
+	/* the return value */
+	result_t result = RESULT_NETWORK_ERROR;
+
+	assert(NULL != fetcher);
+	assert(NULL != refresh);
+
+	/* if there is no cached copy, the validators are meaningless */
+	if (true == cached) {
+		_load_validators((const char *) &refresh->validators_path,
+		                 &validators);
+	}
+
+	/* fetch the database, only if it changed */
+	result = fetcher_revalidate_to_file(fetcher,
+	                                    (const char *) &refresh->url,
+	                                    (const char *) &refresh->path,
+	                                    &validators);
+	switch (result) {
+		case RESULT_NOT_MODIFIED:
+			/* the cached database is fresh again */
+			log_write(LOG_DEBUG, "The package database is up-to-date\n");
+			(void) utimes((const char *) &refresh->path, NULL);
+			result = RESULT_OK;
+			break;
+
+		case RESULT_OK:
+			_save_validators((const char *) &refresh->validators_path,
+			                 &validators);
+			break;
+	}
+
+	return result;
+}
+
+static result_t _fetch_string(fetcher_t *fetcher,
+                              const char *url,
+                              char **string) {
+	/* the fetched file */
+	fetcher_buffer_t buffer = {0};
+
+	/* the enlarged buffer */
+	unsigned char *terminated = NULL;
+
+	/* the return value */
+	result_t result = RESULT_NETWORK_ERROR;
+
+	assert(NULL != fetcher);
+	assert(NULL != url);
+	assert(NULL != string);
+
+	result = fetcher_fetch_to_memory(fetcher, url, &buffer);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+
+	/* terminate the file contents */
+	terminated = realloc(buffer.buffer, 1 + buffer.size);
+	if (NULL == terminated) {
+		fetcher_buffer_free(&buffer);
+		result = RESULT_MEM_ERROR;
+		goto end;
+	}
+	terminated[buffer.size] = '\0';
+	*string = (char *) terminated;
+
+end:
+	return result;
+}
+
+static result_t _copy_file(const char *source, const char *destination) {
+	/* a chunk of the file */
+	unsigned char chunk[BUFSIZ] = {0};
+
+	/* the chunk size */
+	ssize_t size = 0;
+
+	/* the source file */
+	int input = (-1);
+
+	/* the destination file */
+	int output = (-1);
+
+	/* the return value */
+	result_t result = RESULT_IO_ERROR;
 
-	/* the database URL */
+	assert(NULL != source);
+	assert(NULL != destination);
+
+	input = open(source, O_RDONLY);
+	if (-1 == input) {
+		goto end;
+	}
+	output = open(destination,
+	              O_WRONLY | O_CREAT | O_TRUNC,
+	              S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (-1 == output) {
+		goto close_input;
+	}
+
+	do {
+		size = read(input, (void *) &chunk, sizeof(chunk));
+		if (0 == size) {
+			break;
+		}
+		if ((-1 == size) ||
+		    (size != write(output, (const void *) &chunk, (size_t) size))) {
+			goto close_output;
+		}
+	} while (1);
+
+	/* report success */
+	result = RESULT_OK;
+
+close_output:
+	/* close the destination file */
+	if (-1 == close(output)) {
+		result = RESULT_IO_ERROR;
+	}
+
+	/* on failure, delete the destination file */
+	if (RESULT_OK != result) {
+		(void) unlink(destination);
+	}
+
+close_input:
+	/* close the source file */
+	(void) close(input);
+
+end:
+	return result;
+}
+
+static result_t _update(fetcher_t *fetcher, const repo_refresh_t *refresh) {
+	/* a URL */
 	char url[MAX_URL_LENGTH] = {'\0'};
 
+	/* a delta file name */
+	char file_name[NAME_MAX + 1] = {'\0'};
+
+	/* the path of the updated copy */
+	char temporary_path[PATH_MAX] = {'\0'};
+
+	/* the cached database */
+	database_t database = {0};
+
+	/* the generation of the cached database */
+	unsigned long generation = 0;
+
+	/* the generation of the repository database */
+	unsigned long latest = 0;
+
+	/* the generation of the oldest delta */
+	unsigned long oldest = 0;
+
+	/* the list of deltas or a delta */
+	char *contents = NULL;
+
+	/* the return value */
+	result_t result = RESULT_DATABASE_ERROR;
+
+	assert(NULL != fetcher);
+	assert(NULL != refresh);
+
+	/* get the generation of the cached database */
+	result = database_open_read(&database, (const char *) &refresh->path);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	result = database_get_generation(&database, &generation);
+	database_close(&database);
+	if ((RESULT_OK != result) || (0 == generation)) {
+		result = RESULT_NOT_FOUND;
+		goto end;
+	}
+
+	/* fetch the list of deltas */
+	if (sizeof(url) <= snprintf((char *) &url,
+	                            sizeof(url),
+	                            "%s/%s",
+	                            refresh->repository,
+	                            DELTA_INDEX_FILE_NAME)) {
+		result = RESULT_CORRUPT_DATA;
+		goto end;
+	}
+	result = _fetch_string(fetcher, (const char *) &url, &contents);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	if (2 != sscanf(contents, DELTA_INDEX_FORMAT, &latest, &oldest)) {
+		result = RESULT_CORRUPT_DATA;
+		goto free_contents;
+	}
+	free(contents);
+	contents = NULL;
+
+	/* if the cached database is the latest one, it is fresh again */
+	if (generation == latest) {
+		log_write(LOG_DEBUG, "The package database is up-to-date\n");
+		(void) utimes((const char *) &refresh->path, NULL);
+		result = RESULT_OK;
+		goto end;
+	}
+
+	/* if the deltas do not cover the cached database, it has to be fetched */
+	if ((generation > latest) || ((1 + generation) < oldest)) {
+		log_write(LOG_DEBUG,
+		          "No deltas from generation %lu to %lu\n",
+		          generation,
+		          latest);
+		result = RESULT_NOT_FOUND;
+		goto end;
+	}
+
+	log_write(LOG_INFO,
+	          "Updating the package database from generation %lu to %lu\n",
+	          generation,
+	          latest);
+
+	/* apply the deltas to a copy of the cached database, since it may be in
+	 * use */
+	if (sizeof(temporary_path) <= snprintf((char *) &temporary_path,
+	                                       sizeof(temporary_path),
+	                                       "%s"FETCHER_TEMPORARY_SUFFIX,
+	                                       (const char *) &refresh->path)) {
+		result = RESULT_CORRUPT_DATA;
+		goto end;
+	}
+	result = _copy_file((const char *) &refresh->path,
+	                    (const char *) &temporary_path);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	result = database_open_write(&database,
+	                             DATABASE_TYPE_METADATA,
+	                             (const char *) &temporary_path);
+	if (RESULT_OK != result) {
+		goto delete_copy;
+	}
+	result = database_begin(&database);
+	if (RESULT_OK != result) {
+		goto close_copy;
+	}
+
+	for (++generation; latest >= generation; ++generation) {
+		(void) sprintf((char *) &file_name, DELTA_FILE_NAME_FORMAT, generation);
+		if (sizeof(url) <= snprintf((char *) &url,
+		                            sizeof(url),
+		                            "%s/%s",
+		                            refresh->repository,
+		                            (const char *) &file_name)) {
+			result = RESULT_CORRUPT_DATA;
+			goto rollback;
+		}
+		result = _fetch_string(fetcher, (const char *) &url, &contents);
+		if (RESULT_OK != result) {
+			goto rollback;
+		}
+		result = delta_apply(&database, contents);
+		free(contents);
+		contents = NULL;
+		if (RESULT_OK != result) {
+			goto rollback;
+		}
+	}
+
+	result = database_set_generation(&database, latest);
+	if (RESULT_OK != result) {
+		goto rollback;
+	}
+	result = database_commit(&database);
+	if (RESULT_OK != result) {
+		goto rollback;
+	}
+	database_close(&database);
+
+	/* replace the cached database with the updated copy; the validators of
+	 * the cached database no longer match it */
+	if (-1 == rename((const char *) &temporary_path,
+	                 (const char *) &refresh->path)) {
+		result = RESULT_IO_ERROR;
+		goto delete_copy;
+	}
+	(void) unlink((const char *) &refresh->validators_path);
+	goto end;
+
+rollback:
+	/* discard the changes */
+	database_rollback(&database);
+
+close_copy:
+	/* close the copy */
+	database_close(&database);
+
+delete_copy:
+	/* delete the copy */
+	(void) unlink((const char *) &temporary_path);
+
+free_contents:
+	/* free the fetched file */
+	if (NULL != contents) {
+		free(contents);
+	}
+
+end:
+	return result;
+}
+
+static result_t _upgrade(const char *path) {
+	/* the database */
+	database_t database = {0};
+
+	/* the return value */
+	result_t result = RESULT_DATABASE_ERROR;
+
+	assert(NULL != path);
+
+	/* databases published by older repositories lack tables the package
+	 * manager relies on; opening a database for writing adds them */
+	result = database_open_write(&database, DATABASE_TYPE_METADATA, path);
+	if (RESULT_OK == result) {
+		database_close(&database);
+	}
+
+	return result;
+}
+
+static result_t _synchronize(fetcher_t *fetcher,
+                             const repo_refresh_t *refresh,
+                             const bool cached) {
+	/* the return value */
+	result_t result = RESULT_NETWORK_ERROR;
+
+	assert(NULL != fetcher);
+	assert(NULL != refresh);
+
+	/* prefer updating the cached database over fetching the whole database */
+	if ((false == cached) || (RESULT_OK != _update(fetcher, refresh))) {
+		result = _revalidate(fetcher, refresh, cached);
+		if (RESULT_OK != result) {
+			return result;
+		}
+	}
+
+	return _upgrade((const char *) &refresh->path);
+}
+
+static void *_refresh(void *arg) {
+	assert(NULL != arg);
+
+	if (RESULT_OK != _synchronize(&((repo_refresh_t *) arg)->fetcher,
+	                              (const repo_refresh_t *) arg,
+	                              true)) {
+		log_write(LOG_WARNING, "Failed to refresh the package database\n");
+	}
+
+	return NULL;
+}
+
+result_t repo_get_database(repo_t *repo,
+                           database_t *database,
+                           const bool background) {
 	/* the database attributes */
 	struct stat attributes = {0};
 
+	/* the repository identifier */
+	unsigned long id = 0;
+
 	/* the return value */
 	result_t result = RESULT_CORRUPT_DATA;
 
+	/* whether a cached copy of the database exists */
+	bool cached = false;
+
 	assert(NULL != repo);
 	assert(NULL != database);
 
-	/* format the database path */
-	if (sizeof(path) <= sprintf(path,
-	                            METADATA_DATABASE_PATH_FORMAT,
-	                            crc32(
-	                              crc32(0L, Z_NULL, 0),
-	                              (const Bytef *) repo->url,
-	                              (uInt) (sizeof(char) * strlen(repo->url))))) {
+	/* format the database path, the path of its validators and its URL */
+	repo->refresh.repository = repo->url;
+	id = crc32(crc32(0L, Z_NULL, 0),
+	           (const Bytef *) repo->url,
+	           (uInt) (sizeof(char) * strlen(repo->url)));
+	if (sizeof(repo->refresh.path) <= snprintf(
+	                                         (char *) &repo->refresh.path,
+	                                         sizeof(repo->refresh.path),
+	                                         METADATA_DATABASE_PATH_FORMAT,
+	                                         id)) {
+		goto end;
+	}
+	if (sizeof(repo->refresh.validators_path) <= snprintf(
+	                                    (char *) &repo->refresh.validators_path,
+	                                    sizeof(repo->refresh.validators_path),
+	                                    METADATA_VALIDATORS_PATH_FORMAT,
+	                                    id)) {
+		goto end;
+	}
+	if (sizeof(repo->refresh.url) <= snprintf((char *) &repo->refresh.url,
+	                                          sizeof(repo->refresh.url),
+	                                          "%s/%s",
+	                                          repo->url,
+	                                          REPO_DATABASE_FILE_NAME)) {
 		goto end;
 	}
 
 	/* get the database attributes */
-	if (-1 == stat((const char *) &path, &attributes)) {
+	if (-1 == stat((const char *) &repo->refresh.path, &attributes)) {
 		if (ENOENT != errno) {
 			result = RESULT_IO_ERROR;
 			goto end;
 		}
 	} else {
+		/* upgrade the cached database before anything else uses it */
+		result = _upgrade((const char *) &repo->refresh.path);
+		if (RESULT_OK != result) {
+			goto end;
+		}
+		cached = true;
+
 		/* if the database exists and not too old, do not fetch it again */
 		if (MAX_METADATA_CACHE_AGE >
 		    (time(NULL) - (time_t) attributes.st_mtime)) {
 			log_write(LOG_DEBUG, "Using the package database cache\n");
 			goto open_database;
 		}
-	}
 
-	/* format the database URL */
-	if (sizeof(url) <= snprintf((char *) &url,
-	                            sizeof(url),
-	                            "%s/%s",
-	                            repo->url,
-	                            REPO_DATABASE_FILE_NAME)) {
-		goto end;
+		/* if requested, use the outdated database and refresh it in the
+		 * background; the new copy is used next time */
+		if (true == background) {
+			log_write(LOG_DEBUG, "Refreshing the package database in the "
+			                     "background\n");
+			if (RESULT_OK != fetcher_new(&repo->refresh.fetcher)) {
+				goto revalidate;
+			}
+			if (0 != pthread_create(&repo->refresh.thread,
+			                        NULL,
+			                        _refresh,
+			                        &repo->refresh)) {
+				fetcher_free(&repo->refresh.fetcher);
+				goto revalidate;
+			}
+			repo->refresh.running = true;
+			goto open_database;
+		}
 	}
 
-	/* fetch the database */
+revalidate:
+	/* fetch the database, if it changed */
 	log_write(LOG_INFO, "Fetching the package database from %s\n", repo->url);
-	result = fetcher_fetch_to_file(&repo->fetcher, (const char *) &url, path);
+	result = _synchronize(&repo->fetcher, &repo->refresh, cached);
 	if (RESULT_OK != result) {
-		goto end;
+		if (false == cached) {
+			goto end;
+		}
+		log_write(LOG_WARNING, "Using an outdated package database\n");
 	}
 
 open_database:
 	/* open the database */
-	result = database_open_read(database, (const char *) &path);
+	result = database_open_read(database, (const char *) &repo->refresh.path);
 	if (RESULT_OK != result) {
 		goto end;
 	}
@@ -116,26 +630,211 @@ end:
 	return result;
 }
 
-result_t repo_get_package(repo_t *repo,
-                          const package_info_t *info,
-                          fetcher_buffer_t *buffer) {
+static result_t _get_cached(repo_t *repo,
+                            const package_info_t *info,
+                            fetcher_buffer_t *tail,
+                            fetcher_buffer_t *buffer) {
+	/* the result */
+	result_t result = RESULT_NOT_FOUND;
+
+	assert(NULL != repo);
+	assert(NULL != info);
+	assert(NULL != tail);
+	assert(NULL != buffer);
+
+	/* if the server sent the entire package, use it */
+	if (sizeof(package_header_t) < tail->size) {
+		(void) memcpy(buffer, tail, sizeof(fetcher_buffer_t));
+		tail->buffer = NULL;
+		return RESULT_OK;
+	}
+
+	/* otherwise, look for a cached package with the same checksum */
+	if ((sizeof(package_header_t) == tail->size) &&
+	    (MAGIC == ((const package_header_t *) tail->buffer)->magic)) {
+		result = cache_get(
+		                &repo->cache,
+		                info->p_file_name,
+		                ((const package_header_t *) tail->buffer)->checksum,
+		                &buffer->buffer,
+		                &buffer->size);
+		if (RESULT_OK == result) {
+			buffer->mapped = true;
+		}
+	}
+
+	/* free the package header */
+	fetcher_buffer_free(tail);
+
+	return result;
+}
+
+static result_t _format_url(const repo_t *repo,
+                            const package_info_t *info,
+                            char *url,
+                            const size_t size) {
+	assert(NULL != repo);
+	assert(NULL != info);
+	assert(NULL != info->p_file_name);
+	assert(NULL != url);
+
+	if (size <= snprintf(url, size, "%s/%s", repo->url, info->p_file_name)) {
+		return RESULT_CORRUPT_DATA;
+	}
+
+	return RESULT_OK;
+}
+
+void repo_cache_package(repo_t *repo,
+                        const package_info_t *info,
+                        const package_t *package) {
+	assert(NULL != repo);
+	assert(NULL != info);
+	assert(NULL != info->p_file_name);
+	assert(NULL != package);
+
+	if (false == repo->cached) {
+		return;
+	}
+
+	if (RESULT_OK != cache_put(&repo->cache,
+	                           info->p_file_name,
+	                           package->header->checksum,
+	                           package->contents,
+	                           package->size)) {
+		log_write(LOG_WARNING, "Failed to cache %s\n", info->p_file_name);
+	}
+}
+
+result_t repo_open_package(repo_t *repo,
+                           const package_info_t *info,
+                           fetcher_stream_t *stream) {
 	/* the package URL */
 	char url[MAX_URL_LENGTH] = {'\0'};
 
 	assert(NULL != repo);
 	assert(NULL != info);
 	assert(NULL != info->p_file_name);
-	assert(NULL != buffer);
+	assert(NULL != stream);
 
 	/* format the package URL */
-	if (sizeof(url) <= snprintf((char *) &url,
-	                            sizeof(url),
-	                            "%s/%s",
-	                            repo->url,
-	                            info->p_file_name)) {
+	if (RESULT_OK != _format_url(repo, info, (char *) &url, sizeof(url))) {
 		return RESULT_CORRUPT_DATA;
 	}
 
-	/* fetch the package */
-	return fetcher_fetch_to_memory(&repo->fetcher, (const char *) &url, buffer);
+	/* start fetching the package */
+	return fetcher_stream_open(stream, &repo->fetcher, (const char *) &url);
+}
+
+result_t repo_get_packages(repo_t *repo,
+                           const package_info_t *infos,
+                           fetcher_job_t *jobs,
+                           const unsigned int count) {
+	/* the packages which are not cached */
+	fetcher_job_t *misses = NULL;
+
+	/* the indices of packages which are not cached */
+	unsigned int *indices = NULL;
+
+	/* the package header */
+	fetcher_buffer_t tail = {0};
+
+	/* a loop index */
+	unsigned int i = 0;
+
+	/* the number of packages which are not cached */
+	unsigned int miss_count = 0;
+
+	/* the return value */
+	result_t result = RESULT_MEM_ERROR;
+
+	assert(NULL != repo);
+	assert(NULL != infos);
+	assert(NULL != jobs);
+
+	/* format the package URLs */
+	for ( ; count > i; ++i) {
+		result = _format_url(repo,
+		                     &infos[i],
+		                     (char *) &jobs[i].url,
+		                     sizeof(jobs[i].url));
+		if (RESULT_OK != result) {
+			goto end;
+		}
+		jobs[i].tail = 0;
+	}
+
+	/* if there is no cache, fetch all packages */
+	if (false == repo->cached) {
+		result = fetcher_pool_fetch_to_memory(&repo->pool, jobs, count);
+		goto end;
+	}
+
+	/* fetch the headers of all packages */
+	for (i = 0; count > i; ++i) {
+		jobs[i].tail = sizeof(package_header_t);
+	}
+	(void) fetcher_pool_fetch_to_memory(&repo->pool, jobs, count);
+
+	misses = malloc(sizeof(fetcher_job_t) * count);
+	if (NULL == misses) {
+		result = RESULT_MEM_ERROR;
+		goto free_buffers;
+	}
+	indices = malloc(sizeof(unsigned int) * count);
+	if (NULL == indices) {
+		result = RESULT_MEM_ERROR;
+		goto free_misses;
+	}
+
+	/* use the cached copy of each package with an identical header */
+	for (i = 0; count > i; ++i) {
+		jobs[i].tail = 0;
+		if (RESULT_OK == jobs[i].result) {
+			(void) memcpy(&tail, &jobs[i].buffer, sizeof(tail));
+			jobs[i].buffer.buffer = NULL;
+			if (RESULT_OK == _get_cached(repo,
+			                             &infos[i],
+			                             &tail,
+			                             &jobs[i].buffer)) {
+				continue;
+			}
+		}
+
+		/* otherwise, fetch the package */
+		(void) memcpy(&misses[miss_count], &jobs[i], sizeof(fetcher_job_t));
+		indices[miss_count] = i;
+		++miss_count;
+	}
+
+	/* fetch all packages which are not cached */
+	log_write(LOG_DEBUG, "%u packages need to be fetched\n", miss_count);
+	result = fetcher_pool_fetch_to_memory(&repo->pool, misses, miss_count);
+	for (i = 0; miss_count > i; ++i) {
+		(void) memcpy(&jobs[indices[i]], &misses[i], sizeof(fetcher_job_t));
+	}
+	if (RESULT_OK == result) {
+		goto free_indices;
+	}
+
+free_buffers:
+	/* free all packages */
+	for (i = 0; count > i; ++i) {
+		fetcher_buffer_free(&jobs[i].buffer);
+	}
+
+free_indices:
+	/* free the list of package indices */
+	if (NULL != indices) {
+		free(indices);
+	}
+
+free_misses:
+	/* free the list of packages which are not cached */
+	if (NULL != misses) {
+		free(misses);
+	}
+
+end:
+	return result;
 }
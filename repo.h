@@ -2,9 +2,15 @@
 #	define _REPO_H_INCLUDED
 
 #	include <stdio.h>
+#	include <stdbool.h>
+#	include <limits.h>
+#	include <pthread.h>
+
 #	include "result.h"
 #	include "database.h"
 #	include "fetch.h"
+#	include "cache.h"
+#	include "package.h"
 
 /*!
  * @defgroup repo Repository
@@ -22,53 +28,133 @@
  * @see REPO_DATABASE_FILE_NAME */
 #	define METADATA_DATABASE_PATH_FORMAT "."VAR_DIR"/packdude/repo-%lu.sqlite3"
 
+/*!
+ * @def METADATA_VALIDATORS_PATH_FORMAT
+ * @brief The path of the file which holds the validators of the repository
+ *        metadata database
+ * @see METADATA_DATABASE_PATH_FORMAT */
+#	define METADATA_VALIDATORS_PATH_FORMAT \
+	                               "."VAR_DIR"/packdude/repo-%lu.validators"
+
 /*!
  * @def MAX_METADATA_CACHE_AGE
  * @brief The maximum age of the repository metadata database cache, in
- *        seconds */
+ *        seconds; older copies are revalidated against the repository before
+ *        they are used */
 #	define MAX_METADATA_CACHE_AGE (3600)
 
+/*!
+ * @struct repo_refresh_t
+ * @brief A refresh of the repository metadata database */
+typedef struct {
+	const char *repository; /*!< The repository base URL */
+	char url[MAX_URL_LENGTH]; /*!< The database URL */
+	char path[PATH_MAX]; /*!< The database path */
+	char validators_path[PATH_MAX]; /*!< The path of the database validators */
+	fetcher_t fetcher; /*!< The fetcher used by a background refresh */
+	pthread_t thread; /*!< The thread which runs a background refresh */
+	bool running; /*!< Whether a background refresh is running */
+} repo_refresh_t;
+
 /*!
  * @struct repo_t
  * @brief A repository */
 typedef struct {
 	const char *url; /*!< The repository base URL */
 	fetcher_t fetcher; /*!< A fetcher used to fetch files from the repository */
+	fetcher_pool_t pool; /*!< A fetcher pool used to fetch multiple packages
+	                      * simultaneously */
+	cache_t cache; /*!< The local package cache */
+	bool cached; /*!< Whether the package cache is available */
+	repo_refresh_t refresh; /*!< The metadata database refresh */
 } repo_t;
 
 /*!
- * @fn result_t repo_open(repo_t *repo, const char *url)
+ * @fn result_t repo_open(repo_t *repo,
+ *                        const char *url,
+ *                        const unsigned int concurrency)
  * @brief Connects to a repository
  * @param repo A repository
  * @param url The repository base URL
- * @see repo_close */
-result_t repo_open(repo_t *repo, const char *url);
+ * @param concurrency The maximum number of simultaneous package downloads
+ * @see repo_close
+ * @see DEFAULT_FETCHER_CONCURRENCY */
+result_t repo_open(repo_t *repo,
+                   const char *url,
+                   const unsigned int concurrency);
 
 /*!
  * @fn void repo_close(repo_t *repo);
  * @brief Disconnects from a repository
  * @param repo A repository
- * @see repo_open */
+ * @see repo_open
+ *
+ * If the metadata database is being refreshed in the background, this function
+ * waits for the refresh to finish. */
 void repo_close(repo_t *repo);
 
 /*!
- * @fn result_t repo_get_database(repo_t *repo, database_t *database)
+ * @fn result_t repo_get_database(repo_t *repo,
+ *                                database_t *database,
+ *                                const bool background)
  * @brief Fetches the metadata database of a repository
  * @param repo A repository
- * @param database A database */
-result_t repo_get_database(repo_t *repo, database_t *database);
+ * @param database A database
+ * @param background Whether an outdated copy of the database is used as-is,
+ *                   while it is being refreshed in the background
+ *
+ * A cached copy older than \a MAX_METADATA_CACHE_AGE is updated using the
+ * deltas published by the repository, if possible; otherwise, it is fetched
+ * again only if it changed. If the repository is unreachable, the outdated copy
+ * is used. */
+result_t repo_get_database(repo_t *repo,
+                           database_t *database,
+                           const bool background);
 
 /*!
- * @fn result_t repo_get_package(repo_t *repo,
- *                               const package_info_t *info,
- *                               fetcher_buffer_t *buffer)
- * @brief Fetches the a package from a repository
+ * @fn void repo_cache_package(repo_t *repo,
+ *                             const package_info_t *info,
+ *                             const package_t *package)
+ * @brief Adds a fetched package to the local package cache
  * @param repo A repository
  * @param info The package metadata
- * @param buffer The output buffer */
-result_t repo_get_package(repo_t *repo,
-                          const package_info_t *info,
-                          fetcher_buffer_t *buffer);
+ * @param package The package, after its integrity has been verified */
+void repo_cache_package(repo_t *repo,
+                        const package_info_t *info,
+                        const package_t *package);
+
+/*!
+ * @fn result_t repo_open_package(repo_t *repo,
+ *                                const package_info_t *info,
+ *                                fetcher_stream_t *stream)
+ * @brief Starts fetching a package from a repository, for incremental reading
+ * @param repo A repository
+ * @param info The package metadata
+ * @param stream The output stream
+ * @see fetcher_stream_close */
+result_t repo_open_package(repo_t *repo,
+                           const package_info_t *info,
+                           fetcher_stream_t *stream);
+
+/*!
+ * @fn result_t repo_get_packages(repo_t *repo,
+ *                                const package_info_t *infos,
+ *                                fetcher_job_t *jobs,
+ *                                const unsigned int count)
+ * @brief Fetches multiple packages from a repository, simultaneously
+ * @param repo A repository
+ * @param infos The metadata of all packages
+ * @param jobs The output buffers, one per package
+ * @param count The number of packages
+ * @see fetcher_buffer_free
+ * @see repo_cache_package
+ *
+ * If a package with the same file name and checksum is cached, the cached copy
+ * is used and only the package header is fetched. */
+result_t repo_get_packages(repo_t *repo,
+                           const package_info_t *infos,
+                           fetcher_job_t *jobs,
+                           const unsigned int count);
 
 /*!
  * @} */
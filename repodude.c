@@ -1,14 +1,179 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
 
 #include "log.h"
 #include "database.h"
+#include "delta.h"
 
 /* the maximum length of an input line */
 #define MAX_LINE_LENGTH (1024)
 
+/* the suffix of the output database path, while it is being created */
+#define TEMPORARY_SUFFIX ".new"
+
+static result_t _format_path(char *path,
+                             const char *database,
+                             const char *file_name) {
+	/* the last slash in the database path */
+	const char *slash = NULL;
+
+	/* the length of the directory path, including the slash */
+	int length = 0;
+
+	assert(NULL != path);
+	assert(NULL != database);
+	assert(NULL != file_name);
+
+	/* deltas are placed next to the database */
+	slash = strrchr(database, '/');
+	if (NULL != slash) {
+		length = 1 + (int) (slash - database);
+	}
+	if (PATH_MAX <= snprintf(path,
+	                         PATH_MAX,
+	                         "%.*s%s",
+	                         length,
+	                         database,
+	                         file_name)) {
+		return RESULT_CORRUPT_DATA;
+	}
+
+	return RESULT_OK;
+}
+
+static result_t _publish_delta(database_t *output,
+                               const char *database,
+                               const unsigned long generation,
+                               unsigned long *oldest) {
+	/* the delta or index path */
+	char path[PATH_MAX] = {'\0'};
+
+	/* a file name */
+	char file_name[NAME_MAX + 1] = {'\0'};
+
+	/* the generation of the previous delta index */
+	unsigned long latest = 0;
+
+	/* the return value */
+	result_t result = RESULT_IO_ERROR;
+
+	/* the delta or the index */
+	FILE *file = NULL;
+
+	assert(NULL != output);
+	assert(NULL != database);
+	assert(1 < generation);
+	assert(NULL != oldest);
+
+	/* write the changes since the previous generation */
+	(void) sprintf((char *) &file_name, DELTA_FILE_NAME_FORMAT, generation);
+	result = _format_path((char *) &path, database, (const char *) &file_name);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	log_write(LOG_INFO, "Writing %s\n", path);
+	file = fopen((const char *) &path, "w");
+	if (NULL == file) {
+		result = RESULT_IO_ERROR;
+		goto end;
+	}
+	result = delta_write(output, database, file);
+	if (0 != fclose(file)) {
+		result = RESULT_IO_ERROR;
+	}
+	if (RESULT_OK != result) {
+		(void) unlink((const char *) &path);
+		goto end;
+	}
+
+	/* if the previous index ends at the previous generation, the chain of
+	 * deltas continues; otherwise, it starts at this generation */
+	result = _format_path((char *) &path, database, DELTA_INDEX_FILE_NAME);
+	if (RESULT_OK != result) {
+		goto end;
+	}
+	*oldest = generation;
+	file = fopen((const char *) &path, "r");
+	if (NULL != file) {
+		if ((2 != fscanf(file, DELTA_INDEX_FORMAT, &latest, oldest)) ||
+		    ((generation - 1) != latest) ||
+		    (*oldest > generation)) {
+			*oldest = generation;
+		}
+		(void) fclose(file);
+	}
+
+	/* delete the oldest deltas */
+	for ( ; MAX_DELTAS <= (generation - *oldest); ++(*oldest)) {
+		(void) sprintf((char *) &file_name, DELTA_FILE_NAME_FORMAT, *oldest);
+		if (RESULT_OK == _format_path((char *) &path,
+		                              database,
+		                              (const char *) &file_name)) {
+			log_write(LOG_INFO, "Deleting %s\n", path);
+			(void) unlink((const char *) &path);
+		}
+	}
+
+	/* the index is written once the database is in place, so clients never
+	 * see deltas newer than the database */
+	result = RESULT_OK;
+
+end:
+	return result;
+}
+
+static result_t _publish_index(const char *database,
+                               const unsigned long generation,
+                               const unsigned long oldest) {
+	/* the index path */
+	char path[PATH_MAX] = {'\0'};
+
+	/* the temporary index path */
+	char temporary_path[PATH_MAX] = {'\0'};
+
+	/* the index */
+	FILE *file = NULL;
+
+	assert(NULL != database);
+
+	if (RESULT_OK != _format_path((char *) &path,
+	                              database,
+	                              DELTA_INDEX_FILE_NAME)) {
+		return RESULT_CORRUPT_DATA;
+	}
+	if (RESULT_OK != _format_path((char *) &temporary_path,
+	                              database,
+	                              DELTA_INDEX_FILE_NAME TEMPORARY_SUFFIX)) {
+		return RESULT_CORRUPT_DATA;
+	}
+
+	file = fopen((const char *) &temporary_path, "w");
+	if (NULL == file) {
+		return RESULT_IO_ERROR;
+	}
+	if (0 > fprintf(file, DELTA_INDEX_FORMAT, generation, oldest)) {
+		(void) fclose(file);
+		goto delete_index;
+	}
+	if (0 != fclose(file)) {
+		goto delete_index;
+	}
+	if (-1 == rename((const char *) &temporary_path, (const char *) &path)) {
+		goto delete_index;
+	}
+
+	return RESULT_OK;
+
+delete_index:
+	(void) unlink((const char *) &temporary_path);
+	return RESULT_IO_ERROR;
+}
+
 int main(int argc, char *argv[]) {
 	/* a reading buffer */
 	char buffer[MAX_LINE_LENGTH] = {'\0'};
@@ -37,6 +202,18 @@ int main(int argc, char *argv[]) {
 	/* the input file */
 	FILE *input = NULL;
 
+	/* the output database path, while it is being created */
+	char temporary_path[PATH_MAX] = {'\0'};
+
+	/* the previous output database */
+	database_t previous = {0};
+
+	/* the generation of the previous output database */
+	unsigned long generation = 0;
+
+	/* the generation of the oldest delta */
+	unsigned long oldest = 0;
+
 	/* make sure a CSV file and a database were specified */
 	if (3 != argc) {
 		log_dump("Usage: repodude CSV DEST\n");
@@ -50,18 +227,43 @@ int main(int argc, char *argv[]) {
 		goto end;
 	}
 
-	/* if the output file exists, delete it to ensure the newly created database
-	 * is clean from any remains */
-	(void) unlink(argv[2]);
+	/* if the output file exists, get its generation; the new database belongs
+	 * to the next one */
+	if (0 == access(argv[2], F_OK)) {
+		if (RESULT_OK == database_open_read(&previous, argv[2])) {
+			if (RESULT_OK != database_get_generation(&previous, &generation)) {
+				generation = 0;
+			}
+			database_close(&previous);
+		}
+	}
+	++generation;
+	oldest = 1 + generation;
+
+	/* create the database next to the output file, so clients never see a
+	 * partially written one; if a leftover exists, delete it to ensure the
+	 * newly created database is clean from any remains */
+	if (sizeof(temporary_path) <= snprintf((char *) &temporary_path,
+	                                       sizeof(temporary_path),
+	                                       "%s"TEMPORARY_SUFFIX,
+	                                       argv[2])) {
+		goto close_input;
+	}
+	(void) unlink((const char *) &temporary_path);
 
 	/* open the output file */
 	log_write(LOG_INFO, "Initializing %s\n", argv[2]);
 	if (RESULT_OK != database_open_write(&output,
 	                                     DATABASE_TYPE_METADATA,
-	                                     argv[2])) {
+	                                     (const char *) &temporary_path)) {
 		goto close_input;
 	}
 
+	/* add all packages in a single transaction */
+	if (RESULT_OK != database_begin(&output)) {
+		goto close_output;
+	}
+
 	do {
 		/* read an input line */
 		line = fgets((char *) &buffer, sizeof(buffer), input);
@@ -103,13 +305,52 @@ int main(int argc, char *argv[]) {
 		}
 	} while (1);
 
+	/* set the database generation */
+	log_write(LOG_INFO, "Publishing generation %lu\n", generation);
+	if (RESULT_OK != database_set_generation(&output, generation)) {
+		goto close_output;
+	}
+	if (RESULT_OK != database_commit(&output)) {
+		goto close_output;
+	}
+
+	/* if the previous database has a generation, publish the changes since
+	 * then, so clients can update their copy instead of fetching the new
+	 * one */
+	if (1 < generation) {
+		if (RESULT_OK != _publish_delta(&output,
+		                                argv[2],
+		                                generation,
+		                                &oldest)) {
+			log_write(LOG_ERROR, "Failed to write the delta\n");
+			goto close_output;
+		}
+	}
+
+	/* put the database in place */
+	(void) database_close(&output);
+	if (-1 == rename((const char *) &temporary_path, argv[2])) {
+		goto delete_output;
+	}
+
+	/* publish the list of available deltas */
+	if (RESULT_OK != _publish_index(argv[2], generation, oldest)) {
+		log_write(LOG_ERROR, "Failed to write the delta index\n");
+		goto close_input;
+	}
+
 	/* report success */
 	exit_code = EXIT_SUCCESS;
+	goto close_input;
 
 close_output:
 	/* close the database */
 	(void) database_close(&output);
 
+delete_output:
+	/* delete the incomplete database */
+	(void) unlink((const char *) &temporary_path);
+
 close_input:
 	/* close the input file */
 	(void) fclose(input);
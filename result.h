@@ -23,7 +23,8 @@ enum results {
 	RESULT_ALREADY_INSTALLED = 8,
 	RESULT_DATABASE_ERROR    = 9,
 	RESULT_ABORTED           = 10,
-	RESULT_NOT_FOUND         = 11
+	RESULT_NOT_FOUND         = 11,
+	RESULT_NOT_MODIFIED      = 12
 };
 
 /*!
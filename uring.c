@@ -0,0 +1,248 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#include "uring.h"
+
+static int _setup(const unsigned int entries, struct io_uring_params *params) {
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int _enter(const int fd,
+                  const unsigned int submit,
+                  const unsigned int wait,
+                  const unsigned int flags) {
+	return (int) syscall(__NR_io_uring_enter,
+	                     fd,
+	                     submit,
+	                     wait,
+	                     flags,
+	                     NULL,
+	                     0);
+}
+
+static int _register(const int fd,
+                     const unsigned int opcode,
+                     void *arg,
+                     const unsigned int count) {
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+result_t uring_new(uring_t *ring,
+                   const unsigned int entries,
+                   const unsigned int files) {
+	/* the ring parameters */
+	struct io_uring_params params;
+
+	/* the direct file descriptor table parameters */
+	struct io_uring_rsrc_register table;
+
+	assert(NULL != ring);
+	assert(0 < entries);
+	assert(0 < files);
+
+	(void) memset(&params, 0, sizeof(params));
+	ring->fd = _setup(entries, &params);
+	if (-1 == ring->fd) {
+		goto end;
+	}
+
+	/* map the submission queue ring, which may include the completion queue
+	 * ring */
+	ring->sq_ring_size = params.sq_off.array +
+	                     (params.sq_entries * sizeof(unsigned int));
+	ring->cq_ring_size = params.cq_off.cqes +
+	                     (params.cq_entries * sizeof(struct io_uring_cqe));
+	if (0 != (IORING_FEAT_SINGLE_MMAP & params.features)) {
+		if (ring->cq_ring_size > ring->sq_ring_size) {
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL,
+	                     ring->sq_ring_size,
+	                     PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE,
+	                     ring->fd,
+	                     IORING_OFF_SQ_RING);
+	if (MAP_FAILED == ring->sq_ring) {
+		goto close_ring;
+	}
+	if (0 != (IORING_FEAT_SINGLE_MMAP & params.features)) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL,
+		                     ring->cq_ring_size,
+		                     PROT_READ | PROT_WRITE,
+		                     MAP_SHARED | MAP_POPULATE,
+		                     ring->fd,
+		                     IORING_OFF_CQ_RING);
+		if (MAP_FAILED == ring->cq_ring) {
+			goto unmap_sq_ring;
+		}
+	}
+
+	/* map the submission queue entries */
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL,
+	                  ring->sqes_size,
+	                  PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE,
+	                  ring->fd,
+	                  IORING_OFF_SQES);
+	if (MAP_FAILED == ring->sqes) {
+		goto unmap_cq_ring;
+	}
+
+	ring->sq_head = (unsigned int *) ((char *) ring->sq_ring +
+	                                  params.sq_off.head);
+	ring->sq_tail = (unsigned int *) ((char *) ring->sq_ring +
+	                                  params.sq_off.tail);
+	ring->sq_mask = (unsigned int *) ((char *) ring->sq_ring +
+	                                  params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *) ((char *) ring->sq_ring +
+	                                   params.sq_off.array);
+	ring->cq_head = (unsigned int *) ((char *) ring->cq_ring +
+	                                  params.cq_off.head);
+	ring->cq_tail = (unsigned int *) ((char *) ring->cq_ring +
+	                                  params.cq_off.tail);
+	ring->cq_mask = (unsigned int *) ((char *) ring->cq_ring +
+	                                  params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ring +
+	                                      params.cq_off.cqes);
+	ring->entries = params.sq_entries;
+	ring->queued = 0;
+
+	/* allocate empty direct file descriptor slots; this fails on kernels
+	 * older than 5.19, which may not support direct file descriptors in all
+	 * operations */
+	(void) memset(&table, 0, sizeof(table));
+	table.nr = files;
+	table.flags = IORING_RSRC_REGISTER_SPARSE;
+	if (0 > _register(ring->fd,
+	                  IORING_REGISTER_FILES2,
+	                  &table,
+	                  sizeof(table))) {
+		goto unmap_sqes;
+	}
+
+	return RESULT_OK;
+
+unmap_sqes:
+	(void) munmap(ring->sqes, ring->sqes_size);
+
+unmap_cq_ring:
+	if (ring->cq_ring != ring->sq_ring) {
+		(void) munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+
+unmap_sq_ring:
+	(void) munmap(ring->sq_ring, ring->sq_ring_size);
+
+close_ring:
+	(void) close(ring->fd);
+
+end:
+	return RESULT_IO_ERROR;
+}
+
+void uring_free(uring_t *ring) {
+	assert(NULL != ring);
+
+	(void) munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring) {
+		(void) munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	(void) munmap(ring->sq_ring, ring->sq_ring_size);
+	(void) close(ring->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+	/* the submission queue tail */
+	unsigned int tail = 0;
+
+	/* the entry index */
+	unsigned int index = 0;
+
+	assert(NULL != ring);
+
+	/* the kernel consumes all entries during submission, so only entries
+	 * allocated since the last submission occupy the queue */
+	if (ring->entries <= ring->queued) {
+		return NULL;
+	}
+
+	tail = *ring->sq_tail + ring->queued;
+	index = tail & *ring->sq_mask;
+	ring->sq_array[index] = index;
+	++(ring->queued);
+
+	(void) memset(&ring->sqes[index], 0, sizeof(struct io_uring_sqe));
+	return &ring->sqes[index];
+}
+
+result_t uring_submit(uring_t *ring, const unsigned int wait) {
+	/* the number of submitted entries */
+	int submitted = 0;
+
+	/* the number of entries not submitted yet */
+	unsigned int submit = 0;
+
+	/* the number of completions to wait for */
+	unsigned int pending = wait;
+
+	assert(NULL != ring);
+
+	/* publish the allocated entries */
+	__atomic_store_n(ring->sq_tail,
+	                 *ring->sq_tail + ring->queued,
+	                 __ATOMIC_RELEASE);
+	submit = ring->queued;
+	ring->queued = 0;
+
+	do {
+		submitted = _enter(ring->fd,
+		                   submit,
+		                   pending,
+		                   (0 < pending) ? IORING_ENTER_GETEVENTS : 0);
+		if (-1 == submitted) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return RESULT_IO_ERROR;
+		}
+		submit -= (unsigned int) submitted;
+
+		/* a signal may interrupt the wait after all entries were
+		 * submitted */
+		pending = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) -
+		          *ring->cq_head;
+		pending = (wait > pending) ? (wait - pending) : 0;
+	} while ((0 < submit) || (0 < pending));
+
+	return RESULT_OK;
+}
+
+bool uring_get_cqe(uring_t *ring, struct io_uring_cqe *cqe) {
+	/* the completion queue head */
+	unsigned int head = 0;
+
+	assert(NULL != ring);
+	assert(NULL != cqe);
+
+	head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+
+	(void) memcpy(cqe,
+	              &ring->cqes[head & *ring->cq_mask],
+	              sizeof(struct io_uring_cqe));
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
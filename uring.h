@@ -0,0 +1,85 @@
+#ifndef _URING_H_INCLUDED
+#	define _URING_H_INCLUDED
+
+#	include <stdbool.h>
+#	include <stddef.h>
+#	include <linux/io_uring.h>
+
+#	include "result.h"
+
+/*!
+ * @defgroup uring io_uring
+ * @brief Batched system calls through io_uring
+ * @{ */
+
+/*!
+ * @struct uring_t
+ * @brief An io_uring instance, with a table of direct file descriptors */
+typedef struct {
+	int fd; /*!< The ring file descriptor */
+	void *sq_ring; /*!< The submission queue ring */
+	size_t sq_ring_size; /*!< The size of the submission queue ring */
+	void *cq_ring; /*!< The completion queue ring */
+	size_t cq_ring_size; /*!< The size of the completion queue ring */
+	struct io_uring_sqe *sqes; /*!< The submission queue entries */
+	size_t sqes_size; /*!< The size of the submission queue entries */
+	unsigned int *sq_head; /*!< The submission queue head */
+	unsigned int *sq_tail; /*!< The submission queue tail */
+	unsigned int *sq_mask; /*!< The submission queue index mask */
+	unsigned int *sq_array; /*!< The submission queue index array */
+	unsigned int *cq_head; /*!< The completion queue head */
+	unsigned int *cq_tail; /*!< The completion queue tail */
+	unsigned int *cq_mask; /*!< The completion queue index mask */
+	struct io_uring_cqe *cqes; /*!< The completion queue entries */
+	unsigned int entries; /*!< The number of submission queue entries */
+	unsigned int queued; /*!< The number of entries not submitted yet */
+} uring_t;
+
+/*!
+ * @fn result_t uring_new(uring_t *ring,
+ *                        const unsigned int entries,
+ *                        const unsigned int files)
+ * @brief Creates an io_uring instance
+ * @param ring The instance
+ * @param entries The number of submission queue entries
+ * @param files The number of direct file descriptor slots
+ * @see uring_free
+ *
+ * This function fails if the kernel does not support io_uring or direct file
+ * descriptors, so callers should fall back to regular system calls. */
+result_t uring_new(uring_t *ring,
+                   const unsigned int entries,
+                   const unsigned int files);
+
+/*!
+ * @fn void uring_free(uring_t *ring)
+ * @brief Frees an io_uring instance and closes its direct file descriptors
+ * @param ring The instance */
+void uring_free(uring_t *ring);
+
+/*!
+ * @fn struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+ * @brief Allocates a zeroed submission queue entry
+ * @param ring The instance
+ * @return The entry or NULL if the submission queue is full */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+/*!
+ * @fn result_t uring_submit(uring_t *ring, const unsigned int wait)
+ * @brief Submits all allocated entries
+ * @param ring The instance
+ * @param wait The number of completions to wait for */
+result_t uring_submit(uring_t *ring, const unsigned int wait);
+
+/*!
+ * @fn bool uring_get_cqe(uring_t *ring, struct io_uring_cqe *cqe)
+ * @brief Removes a completion from the completion queue
+ * @param ring The instance
+ * @param cqe The completion
+ * @return true if a completion was available, false otherwise */
+bool uring_get_cqe(uring_t *ring, struct io_uring_cqe *cqe);
+
+/*!
+ * @} */
+
+#endif
@@ -0,0 +1,100 @@
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "version.h"
+
+static const char *_skip_separators(const char *version) {
+	for ( ;
+	     ('\0' != *version) && (0 == isalnum((unsigned char) *version));
+	     ++version);
+
+	return version;
+}
+
+static const char *_find_run_end(const char *run) {
+	/* the end of the run */
+	const char *end = run;
+
+	if (0 != isdigit((unsigned char) *run)) {
+		for ( ; 0 != isdigit((unsigned char) *end); ++end);
+	} else {
+		for ( ; 0 != isalpha((unsigned char) *end); ++end);
+	}
+
+	return end;
+}
+
+int version_compare(const char *a, const char *b) {
+	/* the end of the current run in a */
+	const char *a_end = NULL;
+
+	/* the end of the current run in b */
+	const char *b_end = NULL;
+
+	/* the length of the current run in a */
+	size_t a_length = 0;
+
+	/* the length of the current run in b */
+	size_t b_length = 0;
+
+	/* the comparison result */
+	int result = 0;
+
+	assert(NULL != a);
+	assert(NULL != b);
+
+	do {
+		a = _skip_separators(a);
+		b = _skip_separators(b);
+		if (('\0' == *a) || ('\0' == *b)) {
+			break;
+		}
+
+		/* numbers are newer than letters */
+		if (0 != isdigit((unsigned char) *a)) {
+			if (0 == isdigit((unsigned char) *b)) {
+				return 1;
+			}
+
+			/* leading zeros do not count */
+			for ( ; ('0' == *a) && (0 != isdigit((unsigned char) a[1])); ++a);
+			for ( ; ('0' == *b) && (0 != isdigit((unsigned char) b[1])); ++b);
+		} else {
+			if (0 != isdigit((unsigned char) *b)) {
+				return (-1);
+			}
+		}
+
+		a_end = _find_run_end(a);
+		b_end = _find_run_end(b);
+		a_length = (size_t) (a_end - a);
+		b_length = (size_t) (b_end - b);
+
+		/* a longer number is bigger */
+		if ((0 != isdigit((unsigned char) *a)) && (a_length != b_length)) {
+			return (a_length > b_length) ? 1 : (-1);
+		}
+
+		/* numbers of equal length compare like strings */
+		result = strncmp(a, b, (a_length < b_length) ? a_length : b_length);
+		if (0 != result) {
+			return (0 < result) ? 1 : (-1);
+		}
+		if (a_length != b_length) {
+			return (a_length > b_length) ? 1 : (-1);
+		}
+
+		a = a_end;
+		b = b_end;
+	} while (1);
+
+	/* if one version has more runs, it is newer */
+	if ('\0' != *a) {
+		return 1;
+	}
+	if ('\0' != *b) {
+		return (-1);
+	}
+	return 0;
+}
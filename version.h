@@ -0,0 +1,26 @@
+#ifndef _VERSION_H_INCLUDED
+#	define _VERSION_H_INCLUDED
+
+/*!
+ * @defgroup version Version
+ * @brief Package version comparison
+ * @{ */
+
+/*!
+ * @fn int version_compare(const char *a, const char *b)
+ * @brief Compares two package versions
+ * @param a A version
+ * @param b Another version
+ * @return A positive number if \a a is newer, a negative number if \a b is
+ *         newer or 0 if both are equivalent
+ *
+ * Versions are split into runs of digits and runs of letters; all other
+ * characters are separators. Runs of digits are compared numerically and are
+ * newer than runs of letters, which are compared alphabetically. If all runs
+ * are equal, the version with more runs is newer. */
+int version_compare(const char *a, const char *b);
+
+/*!
+ * @} */
+
+#endif
@@ -0,0 +1,55 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "workers.h"
+
+unsigned int workers_start(workers_t *workers,
+                           const unsigned int count,
+                           const worker_routine_t routine,
+                           void *arg) {
+	assert(NULL != workers);
+	assert(NULL != routine);
+
+	workers->count = 0;
+	workers->threads = NULL;
+
+	if (0 == count) {
+		goto end;
+	}
+	workers->threads = malloc(sizeof(pthread_t) * count);
+	if (NULL == workers->threads) {
+		goto end;
+	}
+
+	for ( ; count > workers->count; ++(workers->count)) {
+		if (0 != pthread_create(&workers->threads[workers->count],
+		                        NULL,
+		                        routine,
+		                        arg)) {
+			break;
+		}
+	}
+	if (0 == workers->count) {
+		free(workers->threads);
+		workers->threads = NULL;
+	}
+
+end:
+	return workers->count;
+}
+
+void workers_join(workers_t *workers) {
+	/* a loop index */
+	unsigned int i = 0;
+
+	assert(NULL != workers);
+
+	for ( ; workers->count > i; ++i) {
+		(void) pthread_join(workers->threads[i], NULL);
+	}
+	if (NULL != workers->threads) {
+		free(workers->threads);
+		workers->threads = NULL;
+	}
+	workers->count = 0;
+}
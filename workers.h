@@ -0,0 +1,54 @@
+#ifndef _WORKERS_H_INCLUDED
+#	define _WORKERS_H_INCLUDED
+
+#	include <pthread.h>
+
+/*!
+ * @defgroup workers Workers
+ * @brief Pools of threads which run the same routine
+ * @{ */
+
+/*!
+ * @typedef worker_routine_t
+ * @brief A routine run by each thread of a pool */
+typedef void *(*worker_routine_t)(void *arg);
+
+/*!
+ * @struct workers_t
+ * @brief A pool of threads */
+typedef struct {
+	pthread_t *threads; /*!< The threads */
+	unsigned int count; /*!< The number of running threads */
+} workers_t;
+
+/*!
+ * @fn unsigned int workers_start(workers_t *workers,
+ *                                const unsigned int count,
+ *                                const worker_routine_t routine,
+ *                                void *arg)
+ * @brief Starts a pool of threads
+ * @param workers A thread pool
+ * @param count The number of threads to start
+ * @param routine The routine run by each thread
+ * @param arg The routine argument
+ * @return The number of threads which started
+ * @see workers_join
+ *
+ * If some threads fail to start, the pool makes do with the rest; if none
+ * starts, the caller is responsible for running \a routine itself. */
+unsigned int workers_start(workers_t *workers,
+                           const unsigned int count,
+                           const worker_routine_t routine,
+                           void *arg);
+
+/*!
+ * @fn void workers_join(workers_t *workers)
+ * @brief Waits until all threads of a pool exit and frees the pool
+ * @param workers A thread pool
+ * @see workers_start */
+void workers_join(workers_t *workers);
+
+/*!
+ * @} */
+
+#endif